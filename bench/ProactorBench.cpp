@@ -0,0 +1,617 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <new>
+#include <random>
+#include <semaphore>
+#include <thread>
+#include <vector>
+
+#ifdef PROACTOR_WITH_FOLLY
+#include <folly/MPMCQueue.h>
+#endif
+
+#include "PartitionMetrics.h"
+#include "Proactor.h"
+#include "Queue.h"
+
+// Benchmarks of the Proactor. Every benchmark reports its throughput as
+// items_per_second. Most run twice: with ThroughputTraits, the defaults, and
+// with LatencyTraits, which also report the p50, p99 and p999
+// enqueue-to-execute latency of the tasks from the partitions' metrics.
+// The metrics cost two clock reads per task, so the throughput of the
+// latency runs is lower. For JSON output, run with
+//
+//   proactor_bench --benchmark_out=results.json --benchmark_out_format=json
+
+using namespace mbucko;
+
+namespace {
+// Set while a benchmark counts its allocations.
+std::atomic<bool> counting{false};
+std::atomic<std::uint64_t> allocations{0};
+}  // namespace
+
+// Counts the global allocations made while 'counting' is set, for the
+// allocs_per_message counters. Not inlined, so that the compiler does not
+// pair the malloc() and free() with new expressions and delete expressions.
+[[gnu::noinline]] void* operator new(std::size_t size) {
+  if (counting.load(std::memory_order_relaxed)) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (void* ptr = std::malloc(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+[[gnu::noinline]] void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+namespace {
+
+constexpr std::size_t kPartitions = 4;
+constexpr std::size_t kQueueSize = 64 * 1024;
+constexpr std::size_t kMessages = 64 * 1024;
+
+using ThroughputTraits = DefaultProactorTraits;
+
+struct LatencyTraits : DefaultProactorTraits {
+  static constexpr bool kMetrics = true;
+};
+
+// Payloads above kTaskCapacity are boxed rather than rejected.
+template <typename TRAITS>
+struct BoxingTraits : TRAITS {
+  static constexpr bool kTaskHeapFallback = true;
+};
+
+struct Hash {
+  std::size_t operator()(std::uint64_t key) const { return key; }
+};
+
+template <std::size_t N>
+struct Payload {
+  std::array<unsigned char, N> bytes;
+};
+
+class Worker {
+ public:
+  std::uint64_t add(std::uint64_t value) {
+    total_ += value;
+    return value;
+  }
+
+  template <std::size_t N>
+  void consume(const Payload<N>& payload) {
+    total_ += payload.bytes[0] + payload.bytes[N - 1];
+  }
+
+  // Busy for about 'nanoseconds', to saturate the queues.
+  void spin(std::uint64_t nanoseconds) {
+    const auto until = std::chrono::steady_clock::now() +
+                       std::chrono::nanoseconds(nanoseconds);
+    while (std::chrono::steady_clock::now() < until) {
+    }
+    ++total_;
+  }
+
+  std::uint64_t apply(const std::function<std::uint64_t(Worker&)>& work) {
+    return work(*this);
+  }
+
+  std::uint64_t get() const { return total_; }
+
+  // Worker keeps no per-key state, so moving a key hands nothing over.
+  std::uint64_t exportKey(std::uint64_t) { return 0; }
+  void importKey(std::uint64_t, std::uint64_t) {}
+
+ private:
+  std::uint64_t total_ = 0;
+};
+
+template <typename TRAITS>
+using WorkerProactor =
+    Proactor<std::uint64_t, Hash, kPartitions, Worker, TRAITS>;
+
+// Runs 'send(producer, count)' on 'producers' threads, which together send
+// exactly 'messages' messages.
+template <typename Send>
+void produce(std::size_t producers, std::size_t messages, const Send& send) {
+  if (producers == 1) {
+    send(0, messages);
+    return;
+  }
+  std::vector<std::thread> threads;
+  for (std::size_t p = 0; p < producers; ++p) {
+    threads.emplace_back(send, p,
+                         messages / producers + (p < messages % producers));
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+// Adds the latencies of the tasks run by 'proactor' to 'latency'.
+template <typename PROACTOR>
+void addLatencies(HistogramSnapshot& latency, const PROACTOR& proactor) {
+  for (const MetricsSnapshot& partition : proactor.snapshot()) {
+    latency += partition.latency;
+  }
+}
+
+void reportLatencies(benchmark::State& state,
+                     const HistogramSnapshot& latency) {
+  state.counters["p50_ns"] = latency.percentile(0.5);
+  state.counters["p99_ns"] = latency.percentile(0.99);
+  state.counters["p999_ns"] = latency.percentile(0.999);
+}
+
+// Reports the latencies of the tasks run by 'proactor', if its traits keep
+// metrics.
+template <typename TRAITS>
+void reportLatencies(benchmark::State& state,
+                     const WorkerProactor<TRAITS>& proactor) {
+  if constexpr (TRAITS::kMetrics) {
+    HistogramSnapshot latency;
+    addLatencies(latency, proactor);
+    reportLatencies(state, latency);
+  }
+}
+
+// 1, 2, 4, ... producers, up to the number of cores.
+void producerCounts(benchmark::internal::Benchmark* benchmark) {
+  const std::size_t cores =
+      std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+  for (std::size_t producers = 1; producers < cores; producers *= 2) {
+    benchmark->Arg(producers);
+  }
+  benchmark->Arg(cores);
+}
+
+template <typename TRAITS>
+void BM_SingleHop(benchmark::State& state) {
+  const std::size_t producers = state.range(0);
+  WorkerProactor<TRAITS> proactor(kQueueSize);
+  for (auto _ : state) {
+    produce(producers, kMessages, [&](std::size_t producer, std::size_t n) {
+      for (std::uint64_t i = 0; i < n; ++i) {
+        proactor.process(producer + i * producers, &Worker::add,
+                         [](std::uint64_t) {}, i);
+      }
+    });
+    proactor.drain();
+  }
+  state.SetItemsProcessed(state.iterations() * kMessages);
+  reportLatencies(state, proactor);
+}
+BENCHMARK_TEMPLATE(BM_SingleHop, ThroughputTraits)
+    ->Apply(producerCounts)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SingleHop, LatencyTraits)
+    ->Apply(producerCounts)
+    ->UseRealTime();
+
+// How the pipeline stages hand their work over: as the arguments of a
+// member function, or type-erased in a std::function, the way the
+// partitions used to store their tasks.
+struct InlineWork {
+  template <typename PROACTOR, typename Callback>
+  static void send(PROACTOR& proactor, std::uint64_t value,
+                   Callback callback) {
+    proactor.process(value, &Worker::add, callback, value);
+  }
+};
+
+struct FunctionWork {
+  template <typename PROACTOR, typename Callback>
+  static void send(PROACTOR& proactor, std::uint64_t value,
+                   Callback callback) {
+    proactor.process(
+        value, &Worker::apply, callback,
+        std::function<std::uint64_t(Worker&)>(
+            [func = &Worker::add, value](Worker& worker) {
+              return std::invoke(func, worker, value);
+            }));
+  }
+};
+
+// FunctionWork tasks hold a std::function next to their callback.
+struct FunctionTraits : ThroughputTraits {
+  static constexpr std::size_t kTaskCapacity = 64;
+};
+
+// Every message goes through 'stages' Proactors, each stage enqueuing into
+// the next one from its callback. Also reports the global allocations per
+// message.
+template <typename TRAITS, typename WORK = InlineWork>
+void BM_Pipeline(benchmark::State& state) {
+  const std::size_t stages = state.range(0);
+  std::vector<std::unique_ptr<WorkerProactor<TRAITS>>> pipeline;
+  for (std::size_t i = 0; i < stages; ++i) {
+    pipeline.push_back(std::make_unique<WorkerProactor<TRAITS>>(kQueueSize));
+  }
+  struct Hop {
+    std::vector<std::unique_ptr<WorkerProactor<TRAITS>>>* pipeline;
+    std::size_t stage;
+
+    void operator()(std::uint64_t value) const {
+      if (stage + 1 < pipeline->size()) {
+        WORK::send(*(*pipeline)[stage + 1], value, Hop{pipeline, stage + 1});
+      }
+    }
+  };
+  allocations.store(0);
+  counting.store(true);
+  for (auto _ : state) {
+    for (std::uint64_t i = 0; i < kMessages; ++i) {
+      WORK::send(*pipeline[0], i, Hop{&pipeline, 0});
+    }
+    // Callbacks run right after their task, so once a stage is drained,
+    // everything it forwarded is enqueued in the next one.
+    for (auto& stage : pipeline) {
+      stage->drain();
+    }
+  }
+  counting.store(false);
+  state.SetItemsProcessed(state.iterations() * kMessages * stages);
+  state.counters["allocs_per_message"] =
+      static_cast<double>(allocations.load()) /
+      static_cast<double>(state.iterations() * kMessages);
+  if constexpr (TRAITS::kMetrics) {
+    HistogramSnapshot latency;
+    for (auto& stage : pipeline) {
+      addLatencies(latency, *stage);
+    }
+    reportLatencies(state, latency);
+  }
+}
+BENCHMARK_TEMPLATE(BM_Pipeline, ThroughputTraits)
+    ->DenseRange(1, 4)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Pipeline, LatencyTraits)
+    ->DenseRange(1, 4)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Pipeline, FunctionTraits, FunctionWork)
+    ->DenseRange(1, 4)
+    ->UseRealTime();
+
+void BM_Broadcast(benchmark::State& state) {
+  constexpr std::size_t kBroadcasts = 4 * 1024;
+  WorkerProactor<ThroughputTraits> proactor(kQueueSize);
+  for (auto _ : state) {
+    for (std::uint64_t i = 0; i < kBroadcasts; ++i) {
+      proactor.process(&Worker::get, [](std::uint64_t) {});
+    }
+    proactor.drain();
+  }
+  // Broadcasts are not 'process()' tasks, so they have no latency.
+  state.SetItemsProcessed(state.iterations() * kBroadcasts * kPartitions);
+}
+BENCHMARK(BM_Broadcast)->UseRealTime();
+
+// Routing a key to its partition: the modulo of a partition count known at
+// compile time, against the jump consistent hashing of kDynamicPartitions.
+// 10 partitions, so that the modulo is not a mask.
+template <std::size_t N_PARTITIONS>
+void BM_Routing(benchmark::State& state) {
+  Proactor<std::uint64_t, Hash, N_PARTITIONS, Worker> proactor(
+      ProactorOptions{.capacity = 1024, .partitions = 10});
+  std::uint64_t key = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(proactor.partition_of(key++));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_Routing, 10);
+BENCHMARK_TEMPLATE(BM_Routing, kDynamicPartitions);
+
+template <typename QUEUE_POLICY>
+struct QueueTraits : ThroughputTraits {
+  using QueuePolicy = QUEUE_POLICY;
+};
+
+// Every producer sends to the same key, so they all contend on the queue of
+// one partition: a single MPMC queue, or one SPSC lane per producer.
+template <typename QUEUE_POLICY>
+void BM_HotPartition(benchmark::State& state) {
+  const std::size_t producers = state.range(0);
+  WorkerProactor<QueueTraits<QUEUE_POLICY>> proactor(kQueueSize);
+  for (auto _ : state) {
+    produce(producers, kMessages, [&](std::size_t, std::size_t n) {
+      for (std::uint64_t i = 0; i < n; ++i) {
+        proactor.process(std::uint64_t{0}, &Worker::add,
+                         [](std::uint64_t) {}, i);
+      }
+    });
+    proactor.drain();
+  }
+  state.SetItemsProcessed(state.iterations() * kMessages);
+}
+BENCHMARK_TEMPLATE(BM_HotPartition, MPMCQueuePolicy)
+    ->Apply(producerCounts)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_HotPartition, SPSCLanesQueuePolicy<>)
+    ->Apply(producerCounts)
+    ->UseRealTime();
+
+// Producers offer tasks with 'try_process()' to small queues that slow
+// partitions cannot keep up with. Reports the accepted and rejected rates.
+template <typename TRAITS>
+void BM_TryProcessSaturated(benchmark::State& state) {
+  const std::size_t producers = state.range(0);
+  WorkerProactor<TRAITS> proactor(256);
+  std::atomic<std::uint64_t> accepted{0};
+  std::atomic<std::uint64_t> rejected{0};
+  for (auto _ : state) {
+    produce(producers, kMessages, [&](std::size_t producer, std::size_t n) {
+      std::uint64_t ok = 0;
+      for (std::uint64_t i = 0; i < n; ++i) {
+        ok += proactor.try_process(producer + i * producers, &Worker::spin,
+                                   []() {}, 200);
+      }
+      accepted += ok;
+      rejected += n - ok;
+    });
+    proactor.drain();
+  }
+  state.SetItemsProcessed(accepted.load());
+  state.counters["accepted"] =
+      benchmark::Counter(accepted.load(), benchmark::Counter::kIsRate);
+  state.counters["rejected"] =
+      benchmark::Counter(rejected.load(), benchmark::Counter::kIsRate);
+  reportLatencies(state, proactor);
+}
+BENCHMARK_TEMPLATE(BM_TryProcessSaturated, ThroughputTraits)
+    ->Apply(producerCounts)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_TryProcessSaturated, LatencyTraits)
+    ->Apply(producerCounts)
+    ->UseRealTime();
+
+// 'count' keys drawn from a Zipf distribution with 'exponent' over 'keys'
+// keys; 0 is uniform.
+std::vector<std::uint64_t> zipfKeys(double exponent, std::size_t keys,
+                                    std::size_t count) {
+  std::vector<double> cdf(keys);
+  double total = 0;
+  for (std::size_t k = 0; k < keys; ++k) {
+    total += 1.0 / std::pow(k + 1, exponent);
+    cdf[k] = total;
+  }
+  std::mt19937_64 random(42);
+  std::uniform_real_distribution<double> uniform(0, total);
+  std::vector<std::uint64_t> drawn(count);
+  for (std::uint64_t& key : drawn) {
+    key = std::lower_bound(cdf.begin(), cdf.end(), uniform(random)) -
+          cdf.begin();
+    // Spread neighbouring ranks over the partitions.
+    key *= 0x9E3779B97F4A7C15ull;
+  }
+  return drawn;
+}
+
+// Keys drawn from a Zipf distribution with exponent range(0) / 100 over
+// 10000 keys; 0 is uniform.
+template <typename TRAITS>
+void BM_SkewedKeys(benchmark::State& state) {
+  const std::vector<std::uint64_t> keys =
+      zipfKeys(state.range(0) / 100.0, 10000, kMessages);
+  WorkerProactor<TRAITS> proactor(kQueueSize);
+  for (auto _ : state) {
+    for (const std::uint64_t key : keys) {
+      proactor.process(key, &Worker::spin, []() {}, 50);
+    }
+    proactor.drain();
+  }
+  state.SetItemsProcessed(state.iterations() * kMessages);
+  reportLatencies(state, proactor);
+}
+BENCHMARK_TEMPLATE(BM_SkewedKeys, ThroughputTraits)
+    ->Arg(0)
+    ->Arg(99)
+    ->Arg(120)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SkewedKeys, LatencyTraits)
+    ->Arg(0)
+    ->Arg(99)
+    ->Arg(120)
+    ->UseRealTime();
+
+struct RebalanceTraits : LatencyTraits {
+  static constexpr bool kHotKeyTracking = true;
+};
+
+// Zipf(1.1) keys over 1000 keys, calling 'rebalance()' every range(0)
+// messages, or never for 0. Tasks take 1us and a message is sent every
+// 400ns, so with hash routing the partition of the hottest key, which gets
+// about 35% of the messages, is busy about 90% of the time, and a balanced
+// Proactor about 80%. Both variants sample hot keys, so they only differ in
+// the key moves. Needs a core per partition and one for the producer.
+// Reports the moves and the latency percentiles.
+void BM_Rebalance(benchmark::State& state) {
+  const std::size_t every = state.range(0);
+  const std::vector<std::uint64_t> keys = zipfKeys(1.1, 1000, kMessages);
+  WorkerProactor<RebalanceTraits> proactor(1024);
+  std::uint64_t moves = 0;
+  for (auto _ : state) {
+    auto next = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      // Sends on a fixed schedule, catching up after a move blocked.
+      next += std::chrono::nanoseconds(400);
+      while (std::chrono::steady_clock::now() < next) {
+      }
+      proactor.process(keys[i], &Worker::spin, []() {}, 1000);
+      if (every != 0 && (i + 1) % every == 0) {
+        moves += proactor.rebalance();
+      }
+    }
+    proactor.drain();
+  }
+  state.SetItemsProcessed(state.iterations() * kMessages);
+  state.counters["moves"] = moves;
+  reportLatencies(state, proactor);
+}
+BENCHMARK(BM_Rebalance)->Arg(0)->Arg(16384)->UseRealTime();
+
+// Payloads above kTaskCapacity, and above the small buffer of
+// std::function, are boxed in the arena of the producing thread.
+template <typename TRAITS, std::size_t N>
+void BM_Payload(benchmark::State& state) {
+  WorkerProactor<BoxingTraits<TRAITS>> proactor(kQueueSize);
+  Payload<N> payload{};
+  for (auto _ : state) {
+    for (std::uint64_t i = 0; i < kMessages; ++i) {
+      proactor.process(i, &Worker::consume<N>, []() {}, payload);
+    }
+    proactor.drain();
+  }
+  state.SetItemsProcessed(state.iterations() * kMessages);
+  state.SetBytesProcessed(state.iterations() * kMessages * N);
+  reportLatencies(state, proactor);
+}
+BENCHMARK_TEMPLATE(BM_Payload, ThroughputTraits, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Payload, ThroughputTraits, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Payload, ThroughputTraits, 128)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Payload, ThroughputTraits, 512)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Payload, LatencyTraits, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Payload, LatencyTraits, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Payload, LatencyTraits, 128)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Payload, LatencyTraits, 512)->UseRealTime();
+
+template <typename WAIT_POLICY>
+struct WaitTraits : DefaultProactorTraits {
+  using WaitPolicy = WAIT_POLICY;
+};
+
+// The time from enqueuing a message into a partition that was idle for 5ms,
+// long enough to back off or park, to its callback. Reported as the
+// iteration time, with percentiles.
+template <typename WAIT_POLICY>
+void BM_IdleWakeup(benchmark::State& state) {
+  Proactor<std::uint64_t, Hash, 1, Worker, WaitTraits<WAIT_POLICY>> proactor(
+      16);
+  std::vector<double> latencies;
+  std::binary_semaphore done{0};
+  for (auto _ : state) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    std::chrono::steady_clock::time_point received;
+    const auto sent = std::chrono::steady_clock::now();
+    proactor.process(std::uint64_t{0}, &Worker::get, [&](std::uint64_t) {
+      received = std::chrono::steady_clock::now();
+      done.release();
+    });
+    done.acquire();
+    const std::chrono::duration<double> latency = received - sent;
+    state.SetIterationTime(latency.count());
+    latencies.push_back(latency.count() * 1e9);
+  }
+  std::sort(latencies.begin(), latencies.end());
+  state.counters["p50_ns"] = latencies[latencies.size() / 2];
+  state.counters["p99_ns"] = latencies[latencies.size() * 99 / 100];
+}
+BENCHMARK_TEMPLATE(BM_IdleWakeup, BusySpinWaitPolicy)
+    ->Iterations(100)
+    ->UseManualTime();
+BENCHMARK_TEMPLATE(BM_IdleWakeup, BackoffWaitPolicy)
+    ->Iterations(100)
+    ->UseManualTime();
+BENCHMARK_TEMPLATE(BM_IdleWakeup, FutexWaitPolicy<>)
+    ->Iterations(100)
+    ->UseManualTime();
+BENCHMARK_TEMPLATE(BM_IdleWakeup, AdaptiveWaitPolicy)
+    ->Iterations(100)
+    ->UseManualTime();
+
+// The CPU time used by 8 idle partitions, as idle_cores: the number of
+// cores they keep busy.
+template <typename WAIT_POLICY>
+void BM_IdleCpu(benchmark::State& state) {
+  constexpr auto kIdlePeriod = std::chrono::milliseconds(100);
+  Proactor<std::uint64_t, Hash, 8, Worker, WaitTraits<WAIT_POLICY>> proactor(
+      16);
+  // Let the partitions settle into their idle state first.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  std::clock_t cpu = 0;
+  for (auto _ : state) {
+    const std::clock_t start = std::clock();
+    std::this_thread::sleep_for(kIdlePeriod);
+    cpu += std::clock() - start;
+  }
+  const double idle_seconds =
+      std::chrono::duration<double>(kIdlePeriod).count() *
+      static_cast<double>(state.iterations());
+  state.counters["idle_cores"] =
+      static_cast<double>(cpu) / CLOCKS_PER_SEC / idle_seconds;
+}
+BENCHMARK_TEMPLATE(BM_IdleCpu, BusySpinWaitPolicy)
+    ->Iterations(5)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_IdleCpu, BackoffWaitPolicy)
+    ->Iterations(5)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_IdleCpu, FutexWaitPolicy<>)
+    ->Iterations(5)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_IdleCpu, AdaptiveWaitPolicy)
+    ->Iterations(5)
+    ->UseRealTime();
+
+// The queue behind MPMCQueuePolicy, between range(0) producers and one
+// consumer. Built with PROACTOR_WITH_FOLLY, folly::MPMCQueue runs next to
+// it, for comparison.
+template <typename QUEUE>
+void BM_QueueThroughput(benchmark::State& state) {
+  const std::size_t producers = state.range(0);
+  QUEUE queue(1024);
+  for (auto _ : state) {
+    std::vector<std::thread> threads;
+    for (std::size_t p = 0; p < producers; ++p) {
+      threads.emplace_back([&queue, p, producers]() {
+        for (std::uint64_t i = p; i < kMessages; i += producers) {
+          queue.blockingWrite(i);
+        }
+      });
+    }
+    std::uint64_t sum = 0;
+    std::uint64_t value;
+    for (std::size_t read = 0; read < kMessages;) {
+      if (queue.read(value)) {
+        sum += value;
+        ++read;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * kMessages);
+}
+BENCHMARK_TEMPLATE(BM_QueueThroughput, Queue<std::uint64_t>)
+    ->Apply(producerCounts)
+    ->UseRealTime();
+#ifdef PROACTOR_WITH_FOLLY
+BENCHMARK_TEMPLATE(BM_QueueThroughput, folly::MPMCQueue<std::uint64_t>)
+    ->Apply(producerCounts)
+    ->UseRealTime();
+#endif
+
+}  // namespace
+
+BENCHMARK_MAIN();
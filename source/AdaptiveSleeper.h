@@ -1,6 +1,7 @@
 #ifndef ADAPTIVESLEEPER_H
 #define ADAPTIVESLEEPER_H
 
+#include <algorithm>
 #include <chrono>
 #include <thread>
 
@@ -20,8 +21,25 @@ class AdaptiveSleeper {
     ++iteration_count_;
   }
 
+  /// Same as 'sleep()', but never sleeps past 'deadline'.
+  void sleep(std::chrono::steady_clock::time_point deadline) {
+    [[likely]] if (iteration_count_ < 10) {
+      std::this_thread::yield();
+    } else {
+      const auto remaining = deadline - std::chrono::steady_clock::now();
+      if (remaining > std::chrono::steady_clock::duration::zero()) {
+        std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(
+            calculateSleepTime(), remaining));
+      }
+    }
+    ++iteration_count_;
+  }
+
   void reset() { iteration_count_ = 0; }
 
+  /// Returns true once the sleeper reached its maximum sleep time.
+  bool isBackedOff() const { return iteration_count_ > 40; }
+
  private:
   std::chrono::microseconds calculateSleepTime() const {
     [[likely]] if (iteration_count_ <= 20) {
@@ -0,0 +1,192 @@
+#ifndef ADMISSIONPOLICY_H
+#define ADMISSIONPOLICY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "CacheLine.h"
+
+namespace mbucko {
+
+/// Admission policies decide whether a partition accepts the tasks offered
+/// with 'try_process()', 'try_process_batch()' and 'process_for()', so that
+/// an overloaded partition sheds load early instead of building up a deep
+/// queue. Blocking 'process()' and the priority lanes above Priority::kNormal
+/// always admit. Each partition owns one instance, used as follows:
+///
+/// - 'admit(depth)' is called by producers before every enqueue, or batch of
+///   enqueues, it governs. 'depth()' returns the number of tasks in the
+///   partition's queue; calling it costs two loads of contended cache lines,
+///   so a policy should only call it when it has to.
+/// - 'beginBatch()' and 'endBatch(count, depth)' are called by the partition
+///   thread around every batch of 'count' tasks, 'depth' being the number
+///   of tasks left in the queue.
+///
+/// 'kEnabled' tells whether the partition calls the policy at all.
+
+/// Admits every task. The default.
+struct AdmitAllPolicy {
+  static constexpr bool kEnabled = false;
+
+  template <typename Depth>
+  bool admit(const Depth&) const {
+    return true;
+  }
+
+  void beginBatch() {}
+
+  void endBatch(std::size_t, std::size_t) {}
+};
+
+/// Sheds load like CoDel: once the estimated sojourn time of the queue, its
+/// depth times the recent execution time per task, has stayed above
+/// TARGET_US for INTERVAL_US, tasks are rejected while the estimated
+/// sojourn time of the queue is above TARGET_US, until the partition
+/// catches up. The estimate is updated by the partition after every batch,
+/// and by producers on one admission in kSampleRate per thread, so that a
+/// partition stuck in a long batch starts shedding before the batch ends.
+/// While the partition keeps up, admission costs producers one relaxed load
+/// of a cache line that is only written on state changes, and a look at the
+/// depth of the queue when sampling.
+///
+/// \tparam TARGET_US The acceptable queueing delay, in microseconds.
+/// \tparam INTERVAL_US
+///     How long the delay may stay above TARGET_US before shedding starts,
+///     in microseconds, so that short bursts are absorbed.
+template <std::uint64_t TARGET_US = 5000, std::uint64_t INTERVAL_US = 100000>
+class SojournAdmissionPolicy {
+ public:
+  static constexpr bool kEnabled = true;
+
+  /// One admission in kSampleRate per producer thread updates the estimate.
+  static constexpr std::uint32_t kSampleRate = 16;
+
+  template <typename Depth>
+  bool admit(const Depth& depth) {
+    if (!shared_.dropping.load(std::memory_order_relaxed)) [[likely]] {
+      if (++sampled_ % kSampleRate != 0) [[likely]] {
+        return true;
+      }
+      return sampleDepth(depth());
+    }
+    return depth() * owner_.nanoseconds_per_task.load(
+                         std::memory_order_relaxed) <=
+           kTarget;
+  }
+
+  void beginBatch() { owner_.batch_start = Clock::now(); }
+
+  void endBatch(std::size_t count, std::size_t depth) {
+    const Clock::time_point now = Clock::now();
+    const auto busy = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            now - owner_.batch_start)
+            .count());
+    // An exponentially weighted moving average, over about 8 batches.
+    const std::uint64_t average =
+        owner_.nanoseconds_per_task.load(std::memory_order_relaxed);
+    const std::uint64_t sample = busy / (count == 0 ? 1 : count);
+    const std::uint64_t updated =
+        average == 0 ? sample : average - average / 8 + sample / 8;
+    owner_.nanoseconds_per_task.store(updated, std::memory_order_relaxed);
+
+    if (depth * updated <= kTarget) {
+      if (shared_.above_since.load(std::memory_order_relaxed) != 0) {
+        shared_.above_since.store(0, std::memory_order_relaxed);
+      }
+      setDropping(false);
+    } else {
+      stayAbove(now);
+    }
+  }
+
+  /// Whether tasks are currently being shed.
+  bool dropping() const {
+    return shared_.dropping.load(std::memory_order_relaxed);
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::uint64_t kTarget = TARGET_US * 1000;
+  static constexpr std::int64_t kInterval = INTERVAL_US * 1000;
+
+  // Samples the queue on behalf of a producer, returning whether to admit
+  // the task. Only the partition stops the shedding, at the end of a batch.
+  bool sampleDepth(std::size_t depth) {
+    if (depth * owner_.nanoseconds_per_task.load(std::memory_order_relaxed) <=
+        kTarget) {
+      return true;
+    }
+    return !stayAbove(Clock::now());
+  }
+
+  // Records that the estimated sojourn time is above the target at 'now',
+  // and returns whether tasks are to be shed.
+  bool stayAbove(Clock::time_point now) {
+    const std::int64_t ticks =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            now.time_since_epoch())
+            .count();
+    std::int64_t since = shared_.above_since.load(std::memory_order_relaxed);
+    if (since == 0) {
+      // Losing the race to another thread sets it just as well.
+      shared_.above_since.compare_exchange_strong(since, ticks,
+                                                  std::memory_order_relaxed);
+      return false;
+    }
+    if (ticks - since < kInterval) {
+      return false;
+    }
+    setDropping(true);
+    return true;
+  }
+
+  // Only stores on changes, so that producers keep the line cached.
+  void setDropping(bool dropping) {
+    if (shared_.dropping.load(std::memory_order_relaxed) != dropping) {
+      shared_.dropping.store(dropping, std::memory_order_relaxed);
+    }
+  }
+
+  struct alignas(kCacheLineSize) Owner {
+    Clock::time_point batch_start;
+    std::atomic<std::uint64_t> nanoseconds_per_task{0};
+  };
+
+  // Both only stored on changes.
+  struct alignas(kCacheLineSize) Shared {
+    std::atomic<bool> dropping{false};
+    // Since when, in steady clock nanoseconds, the estimated sojourn time
+    // has been above the target, or 0 if it is not.
+    std::atomic<std::int64_t> above_since{0};
+  };
+
+  // Per producer thread, shared by the instances.
+  static inline thread_local std::uint32_t sampled_ = 0;
+
+  Owner owner_;
+  Shared shared_;
+};
+
+/// Queue occupancy thresholds of the partitions, see
+/// ProactorOptions::watermarks. 'on_change(partition, true)' is called once
+/// the queues of a partition hold 'high' tasks or more, and then
+/// 'on_change(partition, false)' once they are back to 'low' tasks or fewer.
+/// Occupancy is checked by producers after every enqueue while below the
+/// high watermark, and by the partition thread after every batch. The
+/// thread seeing a crossing runs 'on_change', so it must neither block nor
+/// enqueue into the partition; calls for a partition never overlap. A
+/// 'high' of 0 disables watermarks.
+struct Watermarks {
+  std::size_t high = 0;
+  std::size_t low = 0;
+  std::function<void(std::size_t partition, bool high)> on_change;
+};
+
+}  // namespace mbucko
+
+#endif  // ADMISSIONPOLICY_H
@@ -0,0 +1,144 @@
+#ifndef ASYNCRESULT_H
+#define ASYNCRESULT_H
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstdint>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "Futex.h"
+
+namespace mbucko {
+
+/// Executor that resumes a coroutine on the thread completing the task, i.e.
+/// on the partition's worker thread.
+struct InlineExecutor {
+  void operator()(std::coroutine_handle<> handle) const { handle.resume(); }
+};
+
+/// The result of a task enqueued with Proactor::process_async(). It is both
+/// an awaitable and a one-shot future. The task is enqueued lazily, when the
+/// result is first awaited or 'get()' is called, and completes into a slot
+/// embedded in this object, so no mutex or shared state allocation is
+/// involved. This object must therefore stay alive, at the same address,
+/// until the task completes; a temporary in a 'co_await' expression or a
+/// local variable on which 'get()' is called satisfies this. A result is
+/// awaited or waited on once: the task is only ever enqueued by the first
+/// 'co_await' or 'get()', and later ones are a programming error. A task
+/// dropped by stopping the Proactor with DrainPolicy::kDiscard never
+/// completes its result, see DrainPolicy. It can be neither copied nor
+/// moved: 'process_async()' and 'via()' return it as a prvalue, which
+/// initializes the awaited temporary or the local variable in place.
+///
+/// \tparam RESULT
+///     The return type of the member function.
+/// \tparam LAUNCH
+///     A callable that enqueues the task, given the completion callback.
+/// \tparam EXECUTOR
+///     A callable, invoked with the awaiting coroutine's handle on the
+///     partition thread, that decides where the coroutine resumes.
+template <typename RESULT, typename LAUNCH, typename EXECUTOR = InlineExecutor>
+class AsyncResult {
+ private:
+  using Value = std::conditional_t<std::is_void_v<RESULT>, std::monostate,
+                                   std::remove_cvref_t<RESULT>>;
+
+ public:
+  AsyncResult(LAUNCH launch, EXECUTOR executor = EXECUTOR())
+      : launch_(std::move(launch)), executor_(std::move(executor)) {}
+
+  AsyncResult(AsyncResult&&) = delete;
+  AsyncResult(const AsyncResult&) = delete;
+  AsyncResult& operator=(const AsyncResult&) = delete;
+  AsyncResult& operator=(AsyncResult&&) = delete;
+
+  /// Returns an equivalent result whose awaiting coroutine is resumed through
+  /// 'executor' instead of inline on the partition thread. Must be called
+  /// before the task is enqueued.
+  template <typename Executor>
+  AsyncResult<RESULT, LAUNCH, Executor> via(Executor executor) && {
+    assert(!launched_ && "via() must be called before the task is enqueued");
+    return AsyncResult<RESULT, LAUNCH, Executor>(std::move(launch_),
+                                                 std::move(executor));
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> continuation) {
+    continuation_ = continuation;
+    launch();
+  }
+
+  RESULT await_resume() {
+    if constexpr (!std::is_void_v<RESULT>) {
+      return std::move(*value_);
+    }
+  }
+
+  /// Enqueues the task and blocks the calling thread until it completes.
+  RESULT get() {
+    launch();
+    // Returns once the completing thread is done with 'ready_', which this
+    // object's destruction would otherwise pull from under its wake-up.
+    uint32_t state;
+    while ((state = ready_.load(std::memory_order_acquire)) != kDone) {
+      if (state == kPending) {
+        futexWait(ready_, kPending);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    return await_resume();
+  }
+
+ private:
+  static constexpr uint32_t kPending = 0;
+  static constexpr uint32_t kReady = 1;
+  // The completing thread no longer touches this object.
+  static constexpr uint32_t kDone = 2;
+
+  void launch() {
+    assert(!launched_ && "AsyncResult is awaited or waited on only once");
+    if (launched_) {
+      return;
+    }
+    launched_ = true;
+    if constexpr (std::is_void_v<RESULT>) {
+      launch_([this]() { complete(Value()); });
+    } else {
+      launch_([this](Value value) { complete(std::move(value)); });
+    }
+  }
+
+  // Runs on the partition thread. Nothing may touch 'this' once the awaiter
+  // may observe completion, since it is then free to destroy this object.
+  void complete(Value&& value) {
+    value_.emplace(std::move(value));
+    if (continuation_) {
+      executor_(continuation_);
+      return;
+    }
+    ready_.store(kReady, std::memory_order_release);
+    // 'get()' keeps this object alive until kDone, since waking up a
+    // destroyed std::atomic, as futexWakeOne() does outside of Linux, is
+    // undefined behavior.
+    futexWakeOne(ready_);
+    ready_.store(kDone, std::memory_order_release);
+  }
+
+  LAUNCH launch_;
+  EXECUTOR executor_;
+  std::optional<Value> value_;
+  std::coroutine_handle<> continuation_;
+  bool launched_ = false;
+  std::atomic<uint32_t> ready_{kPending};
+};
+
+}  // namespace mbucko
+
+#endif  // ASYNCRESULT_H
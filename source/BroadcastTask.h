@@ -0,0 +1,157 @@
+#ifndef BROADCASTTASK_H
+#define BROADCASTTASK_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "CacheLine.h"
+#include "Partitions.h"
+
+namespace mbucko {
+
+namespace detail {
+
+/// The part shared by all tasks sent to several partitions at once: the
+/// member function, its arguments and a reference count. DERIVED provides
+/// 'finish()', called once the last reference is released, right before the
+/// task deletes itself.
+///
+/// Since partitions run concurrently, func must not modify the arguments.
+template <typename DERIVED, typename MemberFunc, typename... Args>
+class SharedInvocation {
+ public:
+  template <typename... A>
+  SharedInvocation(std::size_t references, MemberFunc func, A&&... args)
+      : references_(references), func_(func), args_(std::forward<A>(args)...) {}
+
+  SharedInvocation(const SharedInvocation&) = delete;
+  SharedInvocation& operator=(const SharedInvocation&) = delete;
+
+  /// Runs func on 'computable' with the shared arguments.
+  template <typename COMPUTABLE>
+  decltype(auto) invoke(COMPUTABLE* computable) const {
+    return std::apply(
+        [&](const Args&... args) -> decltype(auto) {
+          return std::invoke(func_, computable, args...);
+        },
+        args_);
+  }
+
+  /// Releases 'count' references, finishing and deleting the task when the
+  /// last one is released.
+  void release(std::size_t count) {
+    if (references_.fetch_sub(count, std::memory_order_acq_rel) == count) {
+      DERIVED* self = static_cast<DERIVED*>(this);
+      self->finish();
+      delete self;
+    }
+  }
+
+ protected:
+  ~SharedInvocation() = default;
+
+ private:
+  std::atomic<std::size_t> references_;
+  MemberFunc func_;
+  std::tuple<Args...> args_;
+};
+
+}  // namespace detail
+
+/// The payload of a task sent to several partitions at once. It is allocated
+/// once and shared by reference count: every partition runs func on its own
+/// COMPUTABLE with the same (const) arguments and calls the shared callback
+/// with its result. Once the last reference is released, 'done' is called
+/// and the payload deletes itself.
+///
+/// The callback is invoked concurrently through a const reference.
+template <typename MemberFunc, typename Callback, typename Done,
+          typename... Args>
+class BroadcastTask
+    : public detail::SharedInvocation<
+          BroadcastTask<MemberFunc, Callback, Done, Args...>, MemberFunc,
+          Args...> {
+ public:
+  template <typename C, typename D, typename... A>
+  BroadcastTask(std::size_t references, MemberFunc func, C&& callback,
+                D&& done, A&&... args)
+      : BroadcastTask::SharedInvocation(references, func,
+                                        std::forward<A>(args)...),
+        callback_(std::forward<C>(callback)),
+        done_(std::forward<D>(done)) {}
+
+  /// Calls the callback with the result of one partition, then releases
+  /// that partition's reference.
+  template <typename... Result>
+  void complete(std::size_t /*partition*/, Result&&... result) {
+    std::as_const(callback_)(std::forward<Result>(result)...);
+    this->release(1);
+  }
+
+  void finish() { done_(); }
+
+ private:
+  Callback callback_;
+  Done done_;
+};
+
+/// The payload of a map-reduce over N_PARTITIONS partitions. Every partition
+/// stores the result of func into its own cache line aligned slot, so
+/// partitions never contend with each other. Whoever releases the last
+/// reference folds the slots in partition order with the reducer and passes
+/// the reduced value to 'done'.
+///
+/// \tparam RESULT
+///     The result type of func, which is also the type the reducer combines.
+/// \tparam N_PARTITIONS
+///     The number of partitions, and thus of slots, or kDynamicPartitions.
+template <typename RESULT, std::size_t N_PARTITIONS, typename MemberFunc,
+          typename Reducer, typename Done, typename... Args>
+class MapReduceTask
+    : public detail::SharedInvocation<
+          MapReduceTask<RESULT, N_PARTITIONS, MemberFunc, Reducer, Done,
+                        Args...>,
+          MemberFunc, Args...> {
+ public:
+  template <typename R, typename D, typename... A>
+  MapReduceTask(std::size_t partitions, MemberFunc func, R&& reducer,
+                D&& done, A&&... args)
+      : MapReduceTask::SharedInvocation(partitions, func,
+                                        std::forward<A>(args)...),
+        slots_(makePerPartition<N_PARTITIONS, Slot>(partitions)),
+        reducer_(std::forward<R>(reducer)),
+        done_(std::forward<D>(done)) {}
+
+  /// Stores the result of 'partition', then releases its reference.
+  template <typename Result>
+  void complete(std::size_t partition, Result&& result) {
+    slots_[partition].value.emplace(std::forward<Result>(result));
+    this->release(1);
+  }
+
+  void finish() {
+    RESULT reduced = std::move(*slots_[0].value);
+    for (std::size_t i = 1; i < slots_.size(); ++i) {
+      reduced = reducer_(std::move(reduced), std::move(*slots_[i].value));
+    }
+    done_(std::move(reduced));
+  }
+
+ private:
+  struct alignas(kCacheLineSize) Slot {
+    std::optional<RESULT> value;
+  };
+
+  PerPartition<N_PARTITIONS, Slot> slots_;
+  Reducer reducer_;
+  Done done_;
+};
+
+}  // namespace mbucko
+
+#endif  // BROADCASTTASK_H
@@ -0,0 +1,14 @@
+#ifndef CACHELINE_H
+#define CACHELINE_H
+
+#include <cstddef>
+
+namespace mbucko {
+
+/// Size used to pad data written by different threads onto separate cache
+/// lines, avoiding false sharing.
+inline constexpr std::size_t kCacheLineSize = 64;
+
+}  // namespace mbucko
+
+#endif  // CACHELINE_H
@@ -0,0 +1,107 @@
+#ifndef CHASELEVDEQUE_H
+#define CHASELEVDEQUE_H
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+#include "CacheLine.h"
+
+namespace mbucko {
+
+/// A bounded Chase-Lev work-stealing deque. The owner thread pushes and pops
+/// at the bottom (LIFO), while any number of thief threads steal from the top
+/// (FIFO). Follows "Correct and Efficient Work-Stealing for Weak Memory
+/// Models" (Lê et al., PPoPP 2013), without the growable buffer.
+///
+/// \tparam T The element type. Must be trivially copyable, e.g. a pointer.
+template <typename T>
+class ChaseLevDeque {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "ChaseLevDeque elements must be trivially copyable");
+
+ public:
+  /// Creates a deque holding at least 'capacity' elements. The capacity is
+  /// rounded up to a power of two.
+  explicit ChaseLevDeque(std::size_t capacity)
+      : mask_(std::bit_ceil(capacity < 2 ? 2 : capacity) - 1),
+        buffer_(std::make_unique<std::atomic<T>[]>(mask_ + 1)) {}
+
+  ChaseLevDeque(const ChaseLevDeque&) = delete;
+  ChaseLevDeque& operator=(const ChaseLevDeque&) = delete;
+
+  /// Pushes 'value' at the bottom. Returns false if the deque is full. Must
+  /// only be called from the owner thread.
+  bool push(T value) {
+    const std::int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    const std::int64_t top = top_.load(std::memory_order_acquire);
+    if (bottom - top > static_cast<std::int64_t>(mask_)) {
+      return false;
+    }
+    buffer_[bottom & mask_].store(value, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /// Pops the most recently pushed element into 'value'. Returns false if
+  /// the deque is empty, or if a thief took the last element. Must only be
+  /// called from the owner thread.
+  bool pop(T& value) {
+    const std::int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t top = top_.load(std::memory_order_relaxed);
+    if (top > bottom) {
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return false;
+    }
+    value = buffer_[bottom & mask_].load(std::memory_order_relaxed);
+    if (top == bottom) {
+      // Last element: race the thieves for it.
+      const bool won = top_.compare_exchange_strong(
+          top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  /// Steals the least recently pushed element into 'value'. Returns false if
+  /// the deque is empty or another thread won the race for the element. Can
+  /// be called from any thread.
+  bool steal(T& value) {
+    std::int64_t top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const std::int64_t bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom) {
+      return false;
+    }
+    value = buffer_[top & mask_].load(std::memory_order_relaxed);
+    return top_.compare_exchange_strong(
+        top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+  }
+
+  /// Returns the number of elements, which may be stale by the time it is
+  /// used.
+  std::size_t sizeGuess() const {
+    const std::int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    const std::int64_t top = top_.load(std::memory_order_relaxed);
+    return bottom > top ? static_cast<std::size_t>(bottom - top) : 0;
+  }
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+ private:
+  const std::size_t mask_;
+  const std::unique_ptr<std::atomic<T>[]> buffer_;
+  alignas(kCacheLineSize) std::atomic<std::int64_t> top_{0};
+  alignas(kCacheLineSize) std::atomic<std::int64_t> bottom_{0};
+};
+
+}  // namespace mbucko
+
+#endif  // CHASELEVDEQUE_H
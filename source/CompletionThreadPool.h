@@ -0,0 +1,80 @@
+#ifndef COMPLETIONTHREADPOOL_H
+#define COMPLETIONTHREADPOOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "AdaptiveSleeper.h"
+
+namespace mbucko {
+
+/// A set of threads running the deferred completion callbacks of a Proactor
+/// configured with CompletionMode::kDeferred, by calling
+/// 'poll_completions()' in a loop. Idle threads back off with an
+/// AdaptiveSleeper, then park until a partition hands completions over, see
+/// 'Proactor::wait_completions()'.
+///
+/// \tparam PROACTOR The Proactor type whose completions are run.
+template <typename PROACTOR>
+class CompletionThreadPool {
+ public:
+  /// Starts 'threads' threads polling 'proactor', which must outlive this
+  /// pool.
+  CompletionThreadPool(PROACTOR& proactor, std::size_t threads)
+      : proactor_(proactor), running_(true) {
+    threads_.reserve(threads);
+    for (std::size_t i = 0; i < threads; ++i) {
+      threads_.emplace_back(&CompletionThreadPool::run, this);
+    }
+  }
+
+  ~CompletionThreadPool() { stop(); }
+
+  /// Runs the remaining completions and stops all threads. Stop the Proactor
+  /// first to make sure no further completions are produced.
+  void stop() noexcept {
+    if (running_.exchange(false)) {
+      proactor_.wake_completion_pollers();
+      for (auto& thread : threads_) {
+        if (thread.joinable()) {
+          try {
+            thread.join();
+          } catch (...) {
+            std::cerr << "Error: Failed to join completion thread."
+                      << std::endl;
+          }
+        }
+      }
+    }
+  }
+
+ private:
+  static constexpr std::size_t kPollBatch = 256;
+
+  void run() {
+    AdaptiveSleeper sleeper;
+    while (running_.load(std::memory_order_relaxed)) {
+      if (proactor_.poll_completions(kPollBatch) != 0) {
+        sleeper.reset();
+      } else if (sleeper.isBackedOff()) {
+        proactor_.wait_completions(
+            [this]() { return !running_.load(std::memory_order_relaxed); });
+      } else {
+        sleeper.sleep();
+      }
+    }
+    while (proactor_.poll_completions(kPollBatch) != 0) {
+    }
+  }
+
+  PROACTOR& proactor_;
+  std::atomic<bool> running_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace mbucko
+
+#endif  // COMPLETIONTHREADPOOL_H
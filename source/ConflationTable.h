@@ -0,0 +1,87 @@
+#ifndef CONFLATIONTABLE_H
+#define CONFLATIONTABLE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "CacheLine.h"
+
+namespace mbucko {
+
+/// The conflated updates of one partition, see 'Proactor::process_latest()':
+/// at most one pending TASK per key. Keys are spread over kStripes stripes,
+/// each a mutex-guarded map, so producers updating different keys rarely
+/// contend, and each lock is held for a single map lookup and task move.
+/// Slots are kept once created, so the table grows with the number of
+/// distinct keys ever updated, and a key's slot never moves.
+///
+/// \tparam KEY The key type, which must be equality comparable.
+/// \tparam HASH_POLICY The hash functor of KEY.
+/// \tparam TASK The move-only type of the pending tasks.
+template <typename KEY, typename HASH_POLICY, typename TASK>
+class ConflationTable {
+ public:
+  static constexpr std::size_t kStripes = 64;
+
+  /// The pending task of one key, and whether a task taking it is queued.
+  struct Slot {
+    TASK pending;
+    bool queued = false;
+    std::mutex* mutex = nullptr;
+  };
+
+  /// Calls 'update(pending)' on the pending task of 'key', under the lock of
+  /// its stripe; 'pending' is empty if the key has no pending task. Returns
+  /// the slot of 'key' if the caller must now enqueue a task calling
+  /// 'take()' on it, or nullptr if such a task is already queued.
+  ///
+  /// \param[in] key The key to update.
+  /// \param[in] hash The HASH_POLICY hash of 'key'.
+  /// \param[in] update Replaces or merges into the pending task.
+  template <typename Update>
+  Slot* update(const KEY& key, std::size_t hash, Update&& update) {
+    Stripe& stripe = stripes_[stripeOf(hash)];
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    Slot& slot = stripe.slots.try_emplace(key).first->second;
+    slot.mutex = &stripe.mutex;
+    update(slot.pending);
+    if (slot.queued) {
+      return nullptr;
+    }
+    slot.queued = true;
+    return &slot;
+  }
+
+  /// Takes the pending task out of a slot returned by 'update()', so that
+  /// the next update of its key starts a new pending task.
+  static TASK take(Slot& slot) {
+    std::lock_guard<std::mutex> lock(*slot.mutex);
+    slot.queued = false;
+    return std::move(slot.pending);
+  }
+
+ private:
+  // The keys of a partition share their hash modulo the partition count, so
+  // the stripe is picked from the high bits of a multiplicative hash.
+  static std::size_t stripeOf(std::size_t hash) {
+    return static_cast<std::size_t>(
+        (static_cast<std::uint64_t>(hash) * 0x9E3779B97F4A7C15ull) >> 58);
+  }
+
+  static_assert(kStripes == 64, "stripeOf() takes the top 6 bits");
+
+  struct alignas(kCacheLineSize) Stripe {
+    std::mutex mutex;
+    std::unordered_map<KEY, Slot, HASH_POLICY> slots;
+  };
+
+  std::array<Stripe, kStripes> stripes_;
+};
+
+}  // namespace mbucko
+
+#endif  // CONFLATIONTABLE_H
@@ -0,0 +1,69 @@
+#include "Futex.h"
+
+#include <algorithm>
+#include <climits>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace mbucko {
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "futex word must be a plain 32-bit integer");
+
+void futexWait(std::atomic<uint32_t>& word, uint32_t expected) {
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE,
+          expected, nullptr, nullptr, 0);
+#else
+  word.wait(expected, std::memory_order_acquire);
+#endif
+}
+
+void futexWaitFor(std::atomic<uint32_t>& word, uint32_t expected,
+                  std::chrono::nanoseconds timeout) {
+  if (timeout <= std::chrono::nanoseconds::zero()) {
+    return;
+  }
+#ifdef __linux__
+  const auto seconds =
+      std::chrono::duration_cast<std::chrono::seconds>(timeout);
+  timespec relative{};
+  relative.tv_sec = seconds.count();
+  relative.tv_nsec = (timeout - seconds).count();
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE,
+          expected, &relative, nullptr, 0);
+#else
+  // std::atomic::wait has no timeout: sleep in short steps instead, which
+  // callers see as spurious wake-ups.
+  if (word.load(std::memory_order_acquire) == expected) {
+    std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(
+        timeout, std::chrono::microseconds(100)));
+  }
+#endif
+}
+
+void futexWakeOne(std::atomic<uint32_t>& word) {
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, 1,
+          nullptr, nullptr, 0);
+#else
+  word.notify_one();
+#endif
+}
+
+void futexWakeAll(std::atomic<uint32_t>& word) {
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE,
+          INT_MAX, nullptr, nullptr, 0);
+#else
+  word.notify_all();
+#endif
+}
+
+}  // namespace mbucko
@@ -0,0 +1,27 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace mbucko {
+
+/// Blocks the calling thread while 'word' holds 'expected'. May return
+/// spuriously, so callers must re-check their condition. Uses a futex on
+/// Linux and std::atomic::wait elsewhere.
+void futexWait(std::atomic<uint32_t>& word, uint32_t expected);
+
+/// Same as futexWait(), but returns after at most 'timeout'.
+void futexWaitFor(std::atomic<uint32_t>& word, uint32_t expected,
+                  std::chrono::nanoseconds timeout);
+
+/// Wakes up one thread blocked in futexWait() on 'word'.
+void futexWakeOne(std::atomic<uint32_t>& word);
+
+/// Wakes up all threads blocked in futexWait() on 'word'.
+void futexWakeAll(std::atomic<uint32_t>& word);
+
+}  // namespace mbucko
+
+#endif  // FUTEX_H
@@ -0,0 +1,203 @@
+#ifndef INLINETASK_H
+#define INLINETASK_H
+
+#include <cstddef>
+#include <functional>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "PartitionArena.h"
+
+namespace mbucko {
+
+template <typename Signature, std::size_t CAPACITY, bool HEAP_FALLBACK = false>
+class InlineTask;
+
+/// A move-only, type-erased callable with fixed-size inline storage. It plays
+/// the role of std::function for tasks passed between threads, but it never
+/// allocates: the callable is constructed directly inside the task object,
+/// which in turn is constructed directly inside a queue slot.
+///
+/// A callable larger than CAPACITY bytes (or over-aligned, or not nothrow
+/// move constructible) is rejected at compile time. Setting HEAP_FALLBACK
+/// explicitly opts into boxing such callables on the heap instead: in the
+/// PartitionArena of the calling thread if it has one, so that a partition
+/// creating tasks allocates without contention, and with new otherwise. A
+/// boxed task holds a reference on its arena until it is destroyed.
+///
+/// \tparam R
+///     The return type of the call operator.
+/// \tparam Args
+///     The parameter types of the call operator.
+/// \tparam CAPACITY
+///     The number of bytes of inline storage available to the callable.
+/// \tparam HEAP_FALLBACK
+///     Whether callables that do not fit inline may be heap allocated.
+template <typename R, typename... Args, std::size_t CAPACITY,
+          bool HEAP_FALLBACK>
+class InlineTask<R(Args...), CAPACITY, HEAP_FALLBACK> {
+ public:
+  static constexpr std::size_t kCapacity = CAPACITY;
+  static constexpr std::size_t kAlignment = alignof(std::max_align_t);
+
+  /// True if a callable of type F is stored inline, without allocation.
+  template <typename F>
+  static constexpr bool fitsInline = sizeof(F) <= CAPACITY &&
+                                     alignof(F) <= kAlignment &&
+                                     std::is_nothrow_move_constructible_v<F>;
+
+  InlineTask() noexcept : vtable_(nullptr) {}
+
+  template <typename F>
+    requires(!std::is_same_v<std::decay_t<F>, InlineTask>)
+  InlineTask(F&& f) {
+    using Callable = std::decay_t<F>;
+    static_assert(std::is_invocable_r_v<R, Callable&, Args...>,
+                  "Callable does not match the InlineTask signature");
+    if constexpr (fitsInline<Callable>) {
+      new (storage_) Callable(std::forward<F>(f));
+      vtable_ = &kInlineVTable<Callable>;
+    } else {
+      static_assert(HEAP_FALLBACK,
+                    "Callable does not fit into InlineTask storage. Increase "
+                    "the task capacity or explicitly enable heap fallback");
+      PartitionArena* arena = PartitionArena::local();
+      std::pmr::memory_resource* resource =
+          arena != nullptr ? arena : std::pmr::new_delete_resource();
+      using Box = Boxed<Callable>;
+      void* memory = resource->allocate(sizeof(Box), alignof(Box));
+      try {
+        new (storage_)
+            Box*(new (memory) Box{Callable(std::forward<F>(f)), arena});
+      } catch (...) {
+        resource->deallocate(memory, sizeof(Box), alignof(Box));
+        throw;
+      }
+      if (arena != nullptr) {
+        arena->retain();
+      }
+      vtable_ = &kHeapVTable<Callable>;
+    }
+  }
+
+  InlineTask(InlineTask&& other) noexcept : vtable_(other.vtable_) {
+    if (vtable_ != nullptr) {
+      vtable_->relocate(storage_, other.storage_);
+      other.vtable_ = nullptr;
+    }
+  }
+
+  InlineTask& operator=(InlineTask&& other) noexcept {
+    if (this != &other) {
+      reset();
+      if (other.vtable_ != nullptr) {
+        other.vtable_->relocate(storage_, other.storage_);
+        vtable_ = other.vtable_;
+        other.vtable_ = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  InlineTask(const InlineTask&) = delete;
+  InlineTask& operator=(const InlineTask&) = delete;
+
+  ~InlineTask() { reset(); }
+
+  /// Invokes the stored callable. Calling an empty task is undefined
+  /// behavior.
+  R operator()(Args... args) {
+    return vtable_->invoke(storage_, std::forward<Args>(args)...);
+  }
+
+  explicit operator bool() const noexcept { return vtable_ != nullptr; }
+
+  /// Returns the stored callable if it is of type F, nullptr otherwise, like
+  /// std::function::target().
+  template <typename F>
+  F* target() noexcept {
+    if (vtable_ == &kInlineVTable<F>) {
+      return std::launder(reinterpret_cast<F*>(storage_));
+    }
+    if constexpr (HEAP_FALLBACK) {
+      if (vtable_ == &kHeapVTable<F>) {
+        return &(*std::launder(reinterpret_cast<Boxed<F>**>(storage_)))
+                    ->callable;
+      }
+    }
+    return nullptr;
+  }
+
+  /// Destroys the stored callable, leaving the task empty.
+  void reset() noexcept {
+    if (vtable_ != nullptr) {
+      vtable_->destroy(storage_);
+      vtable_ = nullptr;
+    }
+  }
+
+ private:
+  struct VTable {
+    R (*invoke)(void* storage, Args&&... args);
+    // Move-constructs the callable into 'dst' and destroys it in 'src'.
+    void (*relocate)(void* dst, void* src) noexcept;
+    void (*destroy)(void* storage) noexcept;
+  };
+
+  template <typename Callable>
+  static constexpr VTable kInlineVTable = {
+      [](void* storage, Args&&... args) -> R {
+        return std::invoke(*static_cast<Callable*>(storage),
+                           std::forward<Args>(args)...);
+      },
+      [](void* dst, void* src) noexcept {
+        Callable* source = static_cast<Callable*>(src);
+        new (dst) Callable(std::move(*source));
+        source->~Callable();
+      },
+      [](void* storage) noexcept {
+        static_cast<Callable*>(storage)->~Callable();
+      }};
+
+  // A callable on the heap, and the arena its memory returns to, which may
+  // belong to another thread, or nullptr if it was allocated with new. The
+  // box holds a reference on the arena, since the task may outlive the
+  // partition that created it, e.g. in another Proactor's queue.
+  template <typename Callable>
+  struct Boxed {
+    Callable callable;
+    PartitionArena* arena;
+  };
+
+  template <typename Callable>
+  static constexpr VTable kHeapVTable = {
+      [](void* storage, Args&&... args) -> R {
+        return std::invoke((*static_cast<Boxed<Callable>**>(storage))->callable,
+                           std::forward<Args>(args)...);
+      },
+      [](void* dst, void* src) noexcept {
+        new (dst) Boxed<Callable>*(*static_cast<Boxed<Callable>**>(src));
+      },
+      [](void* storage) noexcept {
+        Boxed<Callable>* box = *static_cast<Boxed<Callable>**>(storage);
+        PartitionArena* arena = box->arena;
+        box->~Boxed();
+        if (arena == nullptr) {
+          std::pmr::new_delete_resource()->deallocate(
+              box, sizeof(Boxed<Callable>), alignof(Boxed<Callable>));
+          return;
+        }
+        arena->deallocate(box, sizeof(Boxed<Callable>),
+                          alignof(Boxed<Callable>));
+        arena->release();
+      }};
+
+  const VTable* vtable_;
+  alignas(kAlignment) unsigned char storage_[CAPACITY];
+};
+
+}  // namespace mbucko
+
+#endif  // INLINETASK_H
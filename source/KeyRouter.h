@@ -0,0 +1,331 @@
+#ifndef KEYROUTER_H
+#define KEYROUTER_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "CacheLine.h"
+#include "Partitions.h"
+#include "ProducerSlot.h"
+
+namespace mbucko {
+
+/// A key and an estimate of how often it was sampled. 'count' overestimates
+/// the samples of the key by at most 'error'.
+template <typename KEY>
+struct HotKey {
+  KEY key;
+  std::uint64_t count;
+  std::uint64_t error = 0;
+};
+
+/// A space-saving heavy-hitter sketch: it tracks at most CAPACITY keys, and
+/// a key that is not tracked replaces the least frequent one, inheriting its
+/// count, which becomes the error of its count. Every key occurring more
+/// than 1/CAPACITY of the time is tracked, and counts are overestimated by
+/// at most their error, itself at most the smallest tracked count.
+///
+/// Recording never blocks: a thread finding the sketch busy drops its
+/// sample, which is fine for sampled statistics.
+template <typename KEY, std::size_t CAPACITY>
+class SpaceSavingSketch {
+ public:
+  /// Records one occurrence of 'key', unless another thread is using the
+  /// sketch. Returns whether the occurrence was recorded.
+  bool tryRecord(const KEY& key) {
+    if (busy_.test_and_set(std::memory_order_acquire)) {
+      return false;
+    }
+    Entry* victim = &entries_[0];
+    for (Entry& entry : entries_) {
+      if (entry.key && *entry.key == key) {
+        ++entry.count;
+        busy_.clear(std::memory_order_release);
+        return true;
+      }
+      if (entry.count < victim->count) {
+        victim = &entry;
+      }
+    }
+    victim->key = key;
+    victim->error = victim->count;
+    ++victim->count;
+    busy_.clear(std::memory_order_release);
+    return true;
+  }
+
+  /// Returns the tracked keys, most frequent first.
+  std::vector<HotKey<KEY>> top() const {
+    lock();
+    std::vector<HotKey<KEY>> keys;
+    for (const Entry& entry : entries_) {
+      if (entry.key) {
+        keys.push_back({*entry.key, entry.count, entry.error});
+      }
+    }
+    busy_.clear(std::memory_order_release);
+    std::sort(keys.begin(), keys.end(),
+              [](const HotKey<KEY>& a, const HotKey<KEY>& b) {
+                return a.count > b.count;
+              });
+    return keys;
+  }
+
+  void clear() {
+    lock();
+    entries_ = {};
+    busy_.clear(std::memory_order_release);
+  }
+
+ private:
+  struct Entry {
+    std::optional<KEY> key;
+    std::uint64_t count = 0;
+    std::uint64_t error = 0;
+  };
+
+  void lock() const {
+    while (busy_.test_and_set(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+
+  mutable std::atomic_flag busy_;
+  std::array<Entry, CAPACITY> entries_;
+};
+
+/// The key routing state of a Proactor with TRAITS::kHotKeyTracking. It
+/// samples the keys producers enqueue, to estimate per-partition load and
+/// find hot keys, and holds the routes of keys moved away from their hash
+/// partition.
+///
+/// Routes are an immutable table published through an atomic pointer and
+/// replaced on every move. To move a key without reordering its tasks, the
+/// mover must know when no producer can still enqueue the key on its old
+/// partition: every producer announces, in a per-thread slot, the table
+/// generation it routed with and the partition it is enqueuing into, and
+/// 'reroute()' waits for the producers still enqueuing into the old
+/// partition with the previous table.
+template <typename KEY, typename HASH_POLICY, std::size_t N_PARTITIONS,
+          typename TRAITS>
+class KeyRouter {
+ private:
+  struct Routes {
+    std::uint32_t generation;
+    std::unordered_map<KEY, std::size_t, HASH_POLICY> overrides;
+  };
+
+  // Per-producer slot values: idle, between reading the routes and knowing
+  // the target partition, or the generation and target partition in use.
+  static constexpr std::uint64_t kIdle = 0;
+  static constexpr std::uint64_t kRouting = 1;
+
+  static constexpr std::uint64_t encode(std::uint32_t generation,
+                                        std::size_t partition, bool batch) {
+    return (std::uint64_t{generation} << 32) | (partition << 1) | batch;
+  }
+
+  struct alignas(kCacheLineSize) ProducerState {
+    std::atomic<std::uint64_t> value{kIdle};
+  };
+
+  // Producer states are allocated lazily, one chunk of slots at a time.
+  static constexpr std::size_t kSlotsPerChunk = 64;
+  static constexpr std::size_t kMaxChunks = 1024;
+
+  struct Chunk {
+    std::array<ProducerState, kSlotsPerChunk> states;
+  };
+
+  struct alignas(kCacheLineSize) Load {
+    std::atomic<std::uint64_t> samples{0};
+  };
+
+ public:
+  /// Marks the calling thread as routing keys for as long as it lives. The
+  /// thread routes with 'route()', then announces each partition it
+  /// enqueues into with 'target()'; routes must not be read after that.
+  class Guard {
+   public:
+    explicit Guard(KeyRouter& router) : state_(router.producerState()) {
+      // Pairs with the fence in 'reroute()': either the router sees this
+      // thread routing, or this thread reads the new routes.
+      state_.store(kRouting, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      routes_ = router.routes_.load(std::memory_order_acquire);
+    }
+
+    ~Guard() { state_.store(kIdle, std::memory_order_release); }
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+    /// Returns the partition 'key' was moved to, or 'home' otherwise.
+    std::size_t route(const KEY& key, std::size_t home) const {
+      if (routes_->overrides.empty()) {
+        return home;
+      }
+      const auto it = routes_->overrides.find(key);
+      return it == routes_->overrides.end() ? home : it->second;
+    }
+
+    /// Announces that the thread is about to enqueue into 'partition'. A
+    /// batch enqueues into several partitions, in increasing order.
+    void target(std::size_t partition, bool batch = false) {
+      state_.store(encode(routes_->generation, partition, batch),
+                   std::memory_order_release);
+    }
+
+   private:
+    std::atomic<std::uint64_t>& state_;
+    const Routes* routes_;
+  };
+
+  explicit KeyRouter(std::size_t partitions)
+      : routes_(new Routes{1, {}}),
+        loads_(makePerPartition<N_PARTITIONS, Load>(partitions)) {}
+
+  ~KeyRouter() {
+    delete routes_.load(std::memory_order_relaxed);
+    for (auto& chunk : chunks_) {
+      delete chunk.load(std::memory_order_relaxed);
+    }
+  }
+
+  KeyRouter(const KeyRouter&) = delete;
+  KeyRouter& operator=(const KeyRouter&) = delete;
+
+  /// Counts one keyed enqueue in TRAITS::kHotKeySampleRate, per thread.
+  void sample(const KEY& key, std::size_t partition) {
+    thread_local std::size_t countdown = 0;
+    if (countdown-- != 0) {
+      return;
+    }
+    countdown = TRAITS::kHotKeySampleRate - 1;
+    loads_[partition].samples.fetch_add(1, std::memory_order_relaxed);
+    sketch_.tryRecord(key);
+  }
+
+  /// The sampled enqueues of a partition since the last 'clear()'.
+  std::uint64_t load(std::size_t partition) const {
+    return loads_[partition].samples.load(std::memory_order_relaxed);
+  }
+
+  std::vector<HotKey<KEY>> hotKeys() const { return sketch_.top(); }
+
+  void clear() {
+    for (Load& load : loads_) {
+      load.samples.store(0, std::memory_order_relaxed);
+    }
+    sketch_.clear();
+  }
+
+  /// Serializes moves.
+  std::mutex& moveMutex() { return move_mutex_; }
+
+  /// Routes 'key' to 'partition' from now on, then waits until no producer
+  /// can still enqueue it into 'source', its previous partition. 'home' is
+  /// the hash partition of the key. Must be called with 'moveMutex()' held.
+  void reroute(const KEY& key, std::size_t home, std::size_t partition,
+               std::size_t source) {
+    const Routes* previous = routes_.load(std::memory_order_relaxed);
+    Routes* next = new Routes{previous->generation + 1, previous->overrides};
+    if (partition == home) {
+      next->overrides.erase(key);
+    } else {
+      next->overrides.insert_or_assign(key, partition);
+    }
+    routes_.store(next, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // Once a producer announced its target, it no longer reads the routes,
+    // so waiting for producers still routing also retires 'previous'.
+    for (auto& chunk : chunks_) {
+      const Chunk* states = chunk.load(std::memory_order_acquire);
+      if (states == nullptr) {
+        continue;
+      }
+      for (const ProducerState& state : states->states) {
+        while (mayEnqueueInto(state.value.load(std::memory_order_acquire),
+                              source, next->generation)) {
+          std::this_thread::yield();
+        }
+      }
+    }
+    delete previous;
+  }
+
+ private:
+  static bool mayEnqueueInto(std::uint64_t state, std::size_t source,
+                             std::uint32_t generation) {
+    if (state == kIdle) {
+      return false;
+    }
+    if (state == kRouting) {
+      return true;
+    }
+    if ((state >> 32) == generation) {
+      return false;
+    }
+    const std::size_t partition = (state & 0xFFFFFFFF) >> 1;
+    const bool batch = state & 1;
+    return batch ? partition <= source : partition == source;
+  }
+
+  std::atomic<std::uint64_t>& producerState() {
+    const std::size_t slot = producerSlot();
+    assert(slot < kMaxChunks * kSlotsPerChunk &&
+           "too many concurrent producer threads");
+    std::atomic<Chunk*>& chunk = chunks_[slot / kSlotsPerChunk];
+    Chunk* states = chunk.load(std::memory_order_acquire);
+    if (states == nullptr) {
+      Chunk* allocated = new Chunk();
+      if (chunk.compare_exchange_strong(states, allocated,
+                                        std::memory_order_acq_rel)) {
+        states = allocated;
+      } else {
+        delete allocated;
+      }
+    }
+    return states->states[slot % kSlotsPerChunk].value;
+  }
+
+  std::atomic<const Routes*> routes_;
+  std::array<std::atomic<Chunk*>, kMaxChunks> chunks_{};
+  PerPartition<N_PARTITIONS, Load> loads_;
+  SpaceSavingSketch<KEY, TRAITS::kHotKeyCapacity> sketch_;
+  std::mutex move_mutex_;
+};
+
+/// Stands in for KeyRouter without TRAITS::kHotKeyTracking: keys always go
+/// to their hash partition and nothing is sampled.
+struct NoKeyRouter {
+  struct Guard {
+    explicit Guard(NoKeyRouter&) {}
+
+    template <typename KEY>
+    std::size_t route(const KEY&, std::size_t home) const {
+      return home;
+    }
+
+    void target(std::size_t, bool = false) {}
+  };
+
+  explicit NoKeyRouter(std::size_t) {}
+
+  template <typename KEY>
+  void sample(const KEY&, std::size_t) {}
+};
+
+}  // namespace mbucko
+
+#endif  // KEYROUTER_H
@@ -0,0 +1,230 @@
+#ifndef LANEQUEUE_H
+#define LANEQUEUE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "CacheLine.h"
+#include "ProducerSlot.h"
+#include "SPSCQueue.h"
+
+namespace mbucko {
+
+/// A multi-producer/single-consumer queue built from one SPSCQueue ("lane")
+/// per producer thread. A producer only ever touches its own lane, so there is
+/// no contention between producers; the consumer round-robins across lanes.
+///
+/// Producers are registered implicitly: a lane is allocated the first time a
+/// thread writes to the queue, indexed by producerSlot(). Threads whose slot
+/// is MAX_LANES or higher share a single mutex-guarded overflow lane. A slot,
+/// and with it its lane, is only recycled when its thread exits: a thread
+/// that wrote once keeps its dedicated lane for as long as it lives, even if
+/// it never writes again, so many long-lived threads that each write rarely
+/// can push newer producers into the overflow lane.
+///
+/// Ordering is FIFO per producer thread. Items written by different threads
+/// are interleaved in lane order.
+///
+/// \tparam T The element type. Must be nothrow move constructible.
+/// \tparam MAX_LANES The maximum number of dedicated producer lanes.
+template <typename T, std::size_t MAX_LANES>
+class LaneQueue {
+ public:
+  /// The smallest number of elements a lane can hold.
+  static constexpr std::size_t kMinLaneCapacity = 64;
+
+  /// Creates a queue whose 'capacity' is split evenly across MAX_LANES lanes.
+  /// Each lane, the overflow lane included, holds at least kMinLaneCapacity
+  /// elements, rounded up to a power of two. Memory is therefore bounded by
+  /// MAX_LANES + 1 such lanes however many producers register: about
+  /// 'capacity' elements for large capacities, but up to
+  /// (MAX_LANES + 1) * kMinLaneCapacity elements for small ones.
+  explicit LaneQueue(std::size_t capacity)
+      : lane_capacity_(std::max(capacity / MAX_LANES, kMinLaneCapacity)),
+        lane_count_(0),
+        overflow_(lane_capacity_) {
+    for (auto& lane : lanes_) {
+      lane.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  ~LaneQueue() {
+    for (auto& lane : lanes_) {
+      delete lane.load(std::memory_order_relaxed);
+    }
+  }
+
+  LaneQueue(const LaneQueue&) = delete;
+  LaneQueue& operator=(const LaneQueue&) = delete;
+
+  /// Constructs an element at the tail of the calling thread's lane, waiting
+  /// for space if the lane is full.
+  template <typename... Args>
+  void blockingWrite(Args&&... args) {
+    while (!writeIfNotFull(std::forward<Args>(args)...)) {
+      std::this_thread::yield();
+    }
+  }
+
+  /// Same as 'blockingWrite()', but gives up once 'when' has passed while
+  /// the lane is full. Returns whether the element was written.
+  template <typename Clock, typename... Args>
+  bool tryWriteUntil(const std::chrono::time_point<Clock>& when,
+                     Args&&... args) {
+    while (!writeIfNotFull(std::forward<Args>(args)...)) {
+      if (Clock::now() >= when) {
+        return false;
+      }
+      std::this_thread::yield();
+    }
+    return true;
+  }
+
+  /// Constructs an element at the tail of the calling thread's lane if the
+  /// lane is not full. Arguments are left untouched on failure.
+  template <typename... Args>
+  bool writeIfNotFull(Args&&... args) {
+    const std::size_t slot = producerSlot();
+    [[unlikely]] if (slot >= MAX_LANES) {
+      std::lock_guard<std::mutex> lock(overflow_mutex_);
+      return overflow_.write(std::forward<Args>(args)...);
+    }
+    SPSCQueue<T>* lane = lanes_[slot].load(std::memory_order_relaxed);
+    [[unlikely]] if (lane == nullptr) { lane = createLane(slot); }
+    return lane->write(std::forward<Args>(args)...);
+  }
+
+  /// Constructs up to 'count' elements in the calling thread's lane, the i-th
+  /// one from 'generator(i)', and returns how many were written.
+  template <typename Generator>
+  std::size_t writeBatch(std::size_t count, Generator&& generator) {
+    const std::size_t slot = producerSlot();
+    [[unlikely]] if (slot >= MAX_LANES) {
+      std::lock_guard<std::mutex> lock(overflow_mutex_);
+      return overflow_.writeBatch(count, std::forward<Generator>(generator));
+    }
+    SPSCQueue<T>* lane = lanes_[slot].load(std::memory_order_relaxed);
+    [[unlikely]] if (lane == nullptr) { lane = createLane(slot); }
+    return lane->writeBatch(count, std::forward<Generator>(generator));
+  }
+
+  /// Reads one element, starting from the lane after the one that was read
+  /// last. Returns false if all lanes are empty. Consumer thread only.
+  bool read(T& item) {
+    const std::size_t lanes = lane_count_.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < lanes; ++i) {
+      std::size_t index = next_lane_ + i;
+      if (index >= lanes) {
+        index -= lanes;
+      }
+      SPSCQueue<T>* lane = lanes_[index].load(std::memory_order_acquire);
+      if (lane != nullptr && lane->read(item)) {
+        next_lane_ = index + 1 < lanes ? index + 1 : 0;
+        return true;
+      }
+    }
+    return overflow_.read(item);
+  }
+
+  /// Reads up to 'max' elements into 'items' and returns how many were read.
+  /// Drains lanes in round-robin order, taking as many elements from each
+  /// lane as are available before moving on. Consumer thread only.
+  std::size_t readBatch(T* items, std::size_t max) {
+    std::size_t count = 0;
+    const std::size_t lanes = lane_count_.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < lanes && count < max; ++i) {
+      std::size_t index = next_lane_ + i;
+      if (index >= lanes) {
+        index -= lanes;
+      }
+      if (SPSCQueue<T>* lane = lanes_[index].load(std::memory_order_acquire)) {
+        count += lane->readBatch(items + count, max - count);
+      }
+    }
+    if (lanes != 0 && ++next_lane_ >= lanes) {
+      next_lane_ = 0;
+    }
+    if (count < max) {
+      count += overflow_.readBatch(items + count, max - count);
+    }
+    return count;
+  }
+
+  /// Returns an estimate of the number of elements across all lanes.
+  std::size_t sizeGuess() const noexcept {
+    std::size_t size = overflow_.sizeGuess();
+    const std::size_t lanes = lane_count_.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < lanes; ++i) {
+      if (SPSCQueue<T>* lane = lanes_[i].load(std::memory_order_acquire)) {
+        size += lane->sizeGuess();
+      }
+    }
+    return size;
+  }
+
+  bool isEmpty() const noexcept { return sizeGuess() == 0; }
+
+  /// The write positions of every lane, the overflow lane last.
+  using WriteMark = std::array<std::size_t, MAX_LANES + 1>;
+
+  /// Returns the current write positions of all lanes. Since lanes are only
+  /// FIFO individually, a single count could not tell whether the elements
+  /// written before a given point were all read, see 'readPast()'.
+  WriteMark writeMark() const noexcept {
+    WriteMark mark{};
+    const std::size_t lanes = lane_count_.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < lanes; ++i) {
+      if (SPSCQueue<T>* lane = lanes_[i].load(std::memory_order_acquire)) {
+        mark[i] = lane->writeCount();
+      }
+    }
+    mark[MAX_LANES] = overflow_.writeCount();
+    return mark;
+  }
+
+  /// Returns whether every element written before 'mark' was taken has been
+  /// read.
+  bool readPast(const WriteMark& mark) const noexcept {
+    for (std::size_t i = 0; i < MAX_LANES; ++i) {
+      if (mark[i] != 0 &&
+          lanes_[i].load(std::memory_order_acquire)->readCount() < mark[i]) {
+        return false;
+      }
+    }
+    return overflow_.readCount() >= mark[MAX_LANES];
+  }
+
+ private:
+  SPSCQueue<T>* createLane(std::size_t slot) {
+    auto* lane = new SPSCQueue<T>(lane_capacity_);
+    lanes_[slot].store(lane, std::memory_order_release);
+    std::size_t count = lane_count_.load(std::memory_order_relaxed);
+    while (count <= slot &&
+           !lane_count_.compare_exchange_weak(count, slot + 1,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+    }
+    return lane;
+  }
+
+  const std::size_t lane_capacity_;
+  // Lanes are never freed before the queue is destroyed. A slot released by
+  // an exiting thread is reused, together with its lane, by the next thread
+  // that acquires that slot.
+  std::atomic<SPSCQueue<T>*> lanes_[MAX_LANES];
+  alignas(kCacheLineSize) std::atomic<std::size_t> lane_count_;
+  alignas(kCacheLineSize) std::size_t next_lane_ = 0;
+  std::mutex overflow_mutex_;
+  SPSCQueue<T> overflow_;
+};
+
+}  // namespace mbucko
+
+#endif  // LANEQUEUE_H
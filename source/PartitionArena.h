@@ -0,0 +1,191 @@
+#ifndef PARTITIONARENA_H
+#define PARTITIONARENA_H
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+#include "CacheLine.h"
+
+namespace mbucko {
+
+/// The memory resource of a partition. Blocks of up to kMaxBlockSize bytes
+/// come from per-size-class free lists, refilled from chunks carved out of
+/// the upstream resource, so that allocating is thread-local and never
+/// locks. Larger or over-aligned blocks go to the upstream resource.
+///
+/// Only the owner thread allocates: the partition thread, or the thread
+/// constructing the partition before the partition thread starts. Any
+/// thread may deallocate. A block freed by another thread, e.g. a task
+/// payload or a result that crossed partitions, is pushed onto a lock-free
+/// remote-free list, which the owner takes over in one exchange once the
+/// size class runs out of local blocks.
+///
+/// The arena returns its chunks to the upstream resource when destroyed,
+/// releasing the blocks still allocated, so it must outlive every use of
+/// them, remote frees included. An arena made by 'create()' is reference
+/// counted instead, see 'retain()', so that a block whose lifetime the owner
+/// cannot bound, such as a task sitting in another Proactor's queue, keeps
+/// it alive.
+class PartitionArena : public std::pmr::memory_resource {
+ public:
+  static constexpr std::size_t kMinBlockSize = 16;
+  static constexpr std::size_t kMaxBlockSize = 2048;
+  static constexpr std::size_t kChunkSize = 64 * 1024;
+
+  struct Release {
+    void operator()(PartitionArena* arena) const noexcept {
+      arena->release();
+    }
+  };
+
+  /// Holds the owner's reference to an arena made by 'create()'.
+  using Ptr = std::unique_ptr<PartitionArena, Release>;
+
+  /// Creates an arena on the heap, destroyed once its owner and every
+  /// 'retain()' released it.
+  static Ptr create(
+      std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()) {
+    return Ptr(new PartitionArena(upstream));
+  }
+
+  explicit PartitionArena(
+      std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+      : upstream_(upstream) {}
+
+  ~PartitionArena() override {
+    for (void* chunk : chunks_) {
+      upstream_->deallocate(chunk, kChunkSize, kCacheLineSize);
+    }
+    if (local_ == this) {
+      local_ = nullptr;
+    }
+  }
+
+  PartitionArena(const PartitionArena&) = delete;
+  PartitionArena& operator=(const PartitionArena&) = delete;
+
+  /// Returns the arena owned by the calling thread, or nullptr.
+  static PartitionArena* local() { return local_; }
+
+  /// Makes 'arena' the arena owned by the calling thread, or none if
+  /// nullptr.
+  static void setLocal(PartitionArena* arena) { local_ = arena; }
+
+  std::pmr::memory_resource* upstream() const { return upstream_; }
+
+  /// Takes a reference on the arena, released with 'release()'. Any thread.
+  /// Only an arena made by 'create()' is kept alive by references.
+  void retain() noexcept { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+  /// Drops a reference taken by 'create()' or 'retain()', destroying the
+  /// arena with the last one. Any thread.
+  void release() noexcept {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+
+ protected:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+    const std::size_t size_class = sizeClass(bytes, alignment);
+    if (size_class == kClasses) [[unlikely]] {
+      return upstream_->allocate(bytes, alignment);
+    }
+    FreeBlock* block = free_[size_class];
+    if (block == nullptr) {
+      block = remote_.free[size_class].exchange(nullptr,
+                                                std::memory_order_acquire);
+      if (block == nullptr) {
+        return carve(kMinBlockSize << size_class);
+      }
+    }
+    free_[size_class] = block->next;
+    return block;
+  }
+
+  void do_deallocate(void* pointer, std::size_t bytes,
+                     std::size_t alignment) override {
+    const std::size_t size_class = sizeClass(bytes, alignment);
+    if (size_class == kClasses) [[unlikely]] {
+      upstream_->deallocate(pointer, bytes, alignment);
+      return;
+    }
+    FreeBlock* block = static_cast<FreeBlock*>(pointer);
+    if (local_ == this) {
+      block->next = free_[size_class];
+      free_[size_class] = block;
+      return;
+    }
+    // Only the owner pops, and it takes the whole list at once, so pushing
+    // is not subject to ABA.
+    std::atomic<FreeBlock*>& head = remote_.free[size_class];
+    block->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(block->next, block,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+    }
+  }
+
+  bool do_is_equal(const memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+ private:
+  static constexpr std::size_t kClasses =
+      std::countr_zero(kMaxBlockSize / kMinBlockSize) + 1;
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  // Returns the size class of a block, or kClasses if the upstream resource
+  // serves it.
+  static std::size_t sizeClass(std::size_t bytes, std::size_t alignment) {
+    if (bytes > kMaxBlockSize || alignment > kMinBlockSize) {
+      return kClasses;
+    }
+    return std::countr_zero(std::bit_ceil(bytes < kMinBlockSize
+                                              ? kMinBlockSize
+                                              : bytes)) -
+           std::countr_zero(kMinBlockSize);
+  }
+
+  void* carve(std::size_t size) {
+    if (static_cast<std::size_t>(chunk_end_ - chunk_next_) < size) {
+      // The rest of the previous chunk is abandoned, at most one block of
+      // the largest class.
+      chunk_next_ = static_cast<std::byte*>(
+          upstream_->allocate(kChunkSize, kCacheLineSize));
+      chunk_end_ = chunk_next_ + kChunkSize;
+      chunks_.push_back(chunk_next_);
+    }
+    void* block = chunk_next_;
+    chunk_next_ += size;
+    return block;
+  }
+
+  // Written by other threads, so kept off the owner's cache lines.
+  struct alignas(kCacheLineSize) RemoteFrees {
+    std::array<std::atomic<FreeBlock*>, kClasses> free{};
+  };
+
+  std::pmr::memory_resource* const upstream_;
+  std::array<FreeBlock*, kClasses> free_{};
+  std::byte* chunk_next_ = nullptr;
+  std::byte* chunk_end_ = nullptr;
+  std::vector<void*> chunks_;
+  RemoteFrees remote_;
+  // The owner's reference, plus one per 'retain()'.
+  std::atomic<std::size_t> refs_{1};
+
+  static inline thread_local PartitionArena* local_ = nullptr;
+};
+
+}  // namespace mbucko
+
+#endif  // PARTITIONARENA_H
@@ -0,0 +1,256 @@
+#ifndef PARTITIONMETRICS_H
+#define PARTITIONMETRICS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "CacheLine.h"
+
+namespace mbucko {
+
+/// A copy of a LatencyHistogram, taken while it kept being written to.
+struct HistogramSnapshot {
+  /// The number of values per bucket, see LatencyHistogram.
+  std::vector<std::uint64_t> counts;
+  std::uint64_t count = 0;
+  std::uint64_t sum = 0;
+  std::uint64_t max = 0;
+
+  std::uint64_t mean() const { return count == 0 ? 0 : sum / count; }
+
+  /// Adds the values of 'other', e.g. to combine the partitions of a
+  /// Proactor.
+  HistogramSnapshot& operator+=(const HistogramSnapshot& other) {
+    counts.resize(std::max(counts.size(), other.counts.size()));
+    for (std::size_t i = 0; i < other.counts.size(); ++i) {
+      counts[i] += other.counts[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    max = std::max(max, other.max);
+    return *this;
+  }
+
+  /// Returns an upper bound of the value below which a fraction 'quantile'
+  /// of the values fall, within the precision of the buckets, e.g. 0.99 for
+  /// the 99th percentile.
+  std::uint64_t percentile(double quantile) const;
+};
+
+/// A log-linear histogram of nanosecond durations, as in HdrHistogram:
+/// values below 2^kSubBucketBits have their own bucket, and every larger
+/// power of two is split into 2^kSubBucketBits buckets, which bounds the
+/// relative error by 2^-kSubBucketBits over the whole 64-bit range.
+///
+/// Only one thread records; any thread may take a snapshot concurrently.
+/// Recording is a few relaxed loads and stores, without any atomic
+/// read-modify-write.
+class LatencyHistogram {
+ public:
+  static constexpr unsigned kSubBucketBits = 3;
+  static constexpr std::size_t kSubBuckets = std::size_t{1} << kSubBucketBits;
+  static constexpr std::size_t kBuckets =
+      (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  static std::size_t bucketOf(std::uint64_t value) {
+    if (value < kSubBuckets) {
+      return value;
+    }
+    const unsigned shift = std::bit_width(value) - 1 - kSubBucketBits;
+    return (shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets);
+  }
+
+  /// The largest value of a bucket.
+  static std::uint64_t bucketUpperBound(std::size_t bucket) {
+    if (bucket < kSubBuckets) {
+      return bucket;
+    }
+    const unsigned shift = bucket / kSubBuckets - 1;
+    const std::uint64_t lowest = (kSubBuckets + bucket % kSubBuckets)
+                                 << shift;
+    return lowest + ((std::uint64_t{1} << shift) - 1);
+  }
+
+  void record(std::uint64_t value) {
+    increment(counts_[bucketOf(value)], 1);
+    increment(count_, 1);
+    increment(sum_, value);
+    if (value > max_.load(std::memory_order_relaxed)) {
+      max_.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  HistogramSnapshot snapshot() const {
+    HistogramSnapshot snapshot;
+    snapshot.counts.resize(kBuckets);
+    for (std::size_t i = 0; i < kBuckets; ++i) {
+      snapshot.counts[i] = counts_[i].load(std::memory_order_relaxed);
+    }
+    snapshot.count = count_.load(std::memory_order_relaxed);
+    snapshot.sum = sum_.load(std::memory_order_relaxed);
+    snapshot.max = max_.load(std::memory_order_relaxed);
+    return snapshot;
+  }
+
+ private:
+  // Single writer: a plain load and store is enough, and cheaper than an
+  // atomic add.
+  static void increment(std::atomic<std::uint64_t>& counter,
+                        std::uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+
+  std::array<std::atomic<std::uint64_t>, kBuckets> counts_{};
+  std::atomic<std::uint64_t> count_{0};
+  std::atomic<std::uint64_t> sum_{0};
+  std::atomic<std::uint64_t> max_{0};
+};
+
+inline std::uint64_t HistogramSnapshot::percentile(double quantile) const {
+  std::uint64_t total = 0;
+  for (const std::uint64_t bucket_count : counts) {
+    total += bucket_count;
+  }
+  if (total == 0) {
+    return 0;
+  }
+  const auto rank = static_cast<std::uint64_t>(
+      std::clamp(quantile, 0.0, 1.0) * static_cast<double>(total - 1));
+  std::uint64_t seen = 0;
+  for (std::size_t bucket = 0; bucket < counts.size(); ++bucket) {
+    seen += counts[bucket];
+    if (seen > rank) {
+      return std::min(LatencyHistogram::bucketUpperBound(bucket), max);
+    }
+  }
+  return max;
+}
+
+/// The metrics of one partition at some point in time, see
+/// 'Proactor::snapshot()'. Rates follow from the difference between two
+/// snapshots.
+struct MetricsSnapshot {
+  /// The tasks waiting in the queues, over all priority lanes.
+  std::size_t queue_depth = 0;
+  /// The tasks dequeued and run.
+  std::uint64_t executed = 0;
+  /// The batches the tasks were dequeued in.
+  std::uint64_t batches = 0;
+  /// The blocking writes that found the queue full, and the time producers
+  /// spent waiting in them.
+  std::uint64_t blocked_writes = 0;
+  std::chrono::nanoseconds blocked_time{0};
+  /// The time the partition thread spent running tasks, and waiting for
+  /// work in its WaitPolicy.
+  std::chrono::nanoseconds busy_time{0};
+  std::chrono::nanoseconds idle_time{0};
+  /// The execution time of every task, in nanoseconds.
+  HistogramSnapshot execution;
+  /// The time from enqueuing a task with 'process()', 'try_process()' or
+  /// their batch variants to the start of its execution, in nanoseconds.
+  HistogramSnapshot latency;
+
+  /// The tasks enqueued, assuming none was enqueued while the snapshot was
+  /// taken.
+  std::uint64_t enqueued() const { return executed + queue_depth; }
+};
+
+/// The metrics a partition keeps with TRAITS::kMetrics. The partition
+/// thread writes its counters and histograms without atomic
+/// read-modify-writes; producers only touch their own cache line, and only
+/// when a queue is full.
+class PartitionMetrics {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static std::uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               Clock::now().time_since_epoch())
+        .count();
+  }
+
+  /// Called by producers after waiting for space in a queue.
+  void recordBlocked(std::uint64_t nanoseconds) {
+    producers_.blocked_writes.fetch_add(1, std::memory_order_relaxed);
+    producers_.blocked_time.fetch_add(nanoseconds, std::memory_order_relaxed);
+  }
+
+  // The remaining functions must only be called by the partition thread.
+
+  /// Marks the start of a task, see 'recordLatency()'.
+  void startTask(std::uint64_t start) { owner_.task_start = start; }
+
+  /// Records the latency of the current task, enqueued at 'enqueued'.
+  void recordLatency(std::uint64_t enqueued) {
+    const std::uint64_t start = owner_.task_start;
+    latency_.record(start > enqueued ? start - enqueued : 0);
+  }
+
+  void recordExecution(std::uint64_t nanoseconds) {
+    execution_.record(nanoseconds);
+  }
+
+  void recordBatch(std::size_t tasks) {
+    increment(owner_.batches, 1);
+    increment(owner_.executed, tasks);
+  }
+
+  void recordIdle(std::uint64_t nanoseconds) {
+    increment(owner_.idle_time, nanoseconds);
+  }
+
+  /// Can be called from any thread. Leaves 'queue_depth' to the caller.
+  MetricsSnapshot snapshot() const {
+    MetricsSnapshot snapshot;
+    snapshot.executed = owner_.executed.load(std::memory_order_relaxed);
+    snapshot.batches = owner_.batches.load(std::memory_order_relaxed);
+    snapshot.blocked_writes =
+        producers_.blocked_writes.load(std::memory_order_relaxed);
+    snapshot.blocked_time = std::chrono::nanoseconds(
+        producers_.blocked_time.load(std::memory_order_relaxed));
+    snapshot.idle_time = std::chrono::nanoseconds(
+        owner_.idle_time.load(std::memory_order_relaxed));
+    snapshot.execution = execution_.snapshot();
+    snapshot.latency = latency_.snapshot();
+    snapshot.busy_time = std::chrono::nanoseconds(snapshot.execution.sum);
+    return snapshot;
+  }
+
+ private:
+  static void increment(std::atomic<std::uint64_t>& counter,
+                        std::uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+
+  struct alignas(kCacheLineSize) Owner {
+    std::uint64_t task_start = 0;
+    std::atomic<std::uint64_t> executed{0};
+    std::atomic<std::uint64_t> batches{0};
+    std::atomic<std::uint64_t> idle_time{0};
+  };
+
+  struct alignas(kCacheLineSize) Producers {
+    std::atomic<std::uint64_t> blocked_writes{0};
+    std::atomic<std::uint64_t> blocked_time{0};
+  };
+
+  Owner owner_;
+  alignas(kCacheLineSize) LatencyHistogram execution_;
+  alignas(kCacheLineSize) LatencyHistogram latency_;
+  Producers producers_;
+};
+
+/// Stands in for PartitionMetrics without TRAITS::kMetrics.
+struct NoMetrics {};
+
+}  // namespace mbucko
+
+#endif  // PARTITIONMETRICS_H
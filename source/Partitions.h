@@ -0,0 +1,141 @@
+#ifndef PARTITIONS_H
+#define PARTITIONS_H
+
+#include <array>
+#include <bit>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+namespace mbucko {
+
+/// The N_PARTITIONS of a Proactor whose number of partitions is chosen at
+/// construction rather than at compile time.
+inline constexpr std::size_t kDynamicPartitions =
+    std::numeric_limits<std::size_t>::max();
+
+/// A set of partitions whose size is only known at runtime. It offers the
+/// subset of the std::bitset interface used for partition masks.
+class DynamicBitset {
+ public:
+  DynamicBitset() = default;
+
+  explicit DynamicBitset(std::size_t size)
+      : size_(size), words_((size + kWordBits - 1) / kWordBits, 0) {}
+
+  std::size_t size() const { return size_; }
+
+  bool test(std::size_t i) const {
+    return (words_[i / kWordBits] >> (i % kWordBits)) & 1;
+  }
+
+  bool operator[](std::size_t i) const { return test(i); }
+
+  DynamicBitset& set() {
+    for (std::size_t i = 0; i < words_.size(); ++i) {
+      words_[i] = ~std::uint64_t{0};
+    }
+    clearTail();
+    return *this;
+  }
+
+  DynamicBitset& set(std::size_t i, bool value = true) {
+    const std::uint64_t bit = std::uint64_t{1} << (i % kWordBits);
+    if (value) {
+      words_[i / kWordBits] |= bit;
+    } else {
+      words_[i / kWordBits] &= ~bit;
+    }
+    return *this;
+  }
+
+  DynamicBitset& reset(std::size_t i) { return set(i, false); }
+
+  std::size_t count() const {
+    std::size_t count = 0;
+    for (std::uint64_t word : words_) {
+      count += std::popcount(word);
+    }
+    return count;
+  }
+
+  bool all() const { return count() == size_; }
+
+  bool any() const { return count() != 0; }
+
+  bool none() const { return count() == 0; }
+
+ private:
+  static constexpr std::size_t kWordBits = 64;
+
+  void clearTail() {
+    if (size_ % kWordBits != 0) {
+      words_.back() &= (std::uint64_t{1} << (size_ % kWordBits)) - 1;
+    }
+  }
+
+  std::size_t size_ = 0;
+  std::vector<std::uint64_t> words_;
+};
+
+/// One T per partition: a std::array for a compile-time number of
+/// partitions, a std::vector for kDynamicPartitions.
+template <std::size_t N_PARTITIONS, typename T>
+using PerPartition =
+    std::conditional_t<N_PARTITIONS == kDynamicPartitions, std::vector<T>,
+                       std::array<T, N_PARTITIONS>>;
+
+/// A set of partitions: a std::bitset for a compile-time number of
+/// partitions, a DynamicBitset for kDynamicPartitions.
+template <std::size_t N_PARTITIONS>
+using PartitionSet =
+    std::conditional_t<N_PARTITIONS == kDynamicPartitions, DynamicBitset,
+                       std::bitset<N_PARTITIONS>>;
+
+/// Returns value-initialized PerPartition storage for 'partitions'
+/// partitions.
+template <std::size_t N_PARTITIONS, typename T>
+PerPartition<N_PARTITIONS, T> makePerPartition(std::size_t partitions) {
+  if constexpr (N_PARTITIONS == kDynamicPartitions) {
+    return std::vector<T>(partitions);
+  } else {
+    return {};
+  }
+}
+
+/// Returns an empty PartitionSet for 'partitions' partitions.
+template <std::size_t N_PARTITIONS>
+PartitionSet<N_PARTITIONS> makePartitionSet(std::size_t partitions) {
+  if constexpr (N_PARTITIONS == kDynamicPartitions) {
+    return DynamicBitset(partitions);
+  } else {
+    return {};
+  }
+}
+
+/// Maps a hash to one of 'buckets' buckets with jump consistent hashing
+/// (Lamping and Veach). When the number of buckets changes from n to n + 1,
+/// only 1/(n + 1) of the hashes move, all of them to the new bucket, whereas
+/// modulo remaps almost every hash. It runs in O(log(buckets)) without any
+/// table.
+inline std::size_t jumpConsistentHash(std::uint64_t hash,
+                                      std::size_t buckets) {
+  std::int64_t bucket = -1;
+  std::int64_t next = 0;
+  while (next < static_cast<std::int64_t>(buckets)) {
+    bucket = next;
+    hash = hash * 2862933555777941757ULL + 1;
+    next = static_cast<std::int64_t>(
+        static_cast<double>(bucket + 1) *
+        (static_cast<double>(std::int64_t{1} << 31) /
+         static_cast<double>((hash >> 33) + 1)));
+  }
+  return static_cast<std::size_t>(bucket);
+}
+
+}  // namespace mbucko
+
+#endif  // PARTITIONS_H
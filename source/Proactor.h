@@ -1,21 +1,62 @@
 #ifndef PROACTOR_H
 #define PROACTOR_H
 
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cassert>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <semaphore>
+#include <ranges>
+#include <thread>
+#include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
+#include "AsyncResult.h"
+#include "BroadcastTask.h"
+#include "KeyRouter.h"
+#include "PartitionMetrics.h"
+#include "Partitions.h"
 #include "ProactorPartition.h"
+#include "ProactorTraits.h"
+#include "ProducerSlot.h"
+#include "ThreadAffinity.h"
+#include "TimerWheel.h"
 
 namespace mbucko {
 
+/// Construction options of a Proactor.
+struct ProactorOptions {
+  /// The maximum number of tasks each partition's queue can hold.
+  std::size_t capacity = 0;
+  /// The number of partitions of a Proactor with kDynamicPartitions, or 0 for
+  /// one partition per core reported by getCoreInfo(). Must be 0 or equal to
+  /// N_PARTITIONS otherwise.
+  std::size_t partitions = 0;
+  /// The CPUs the partition threads are pinned to.
+  ThreadPlacement placement{};
+  /// The queue occupancy thresholds reported for every partition.
+  Watermarks watermarks{};
+};
+
 /// The Proactor class implements a partitioned, multi-threaded, asynchronous
 /// task processing framework. It distributes tasks across multiple partitions
 /// based on a key and a hash policy, allowing for concurrent execution of
 /// tasks on different COMPUTABLE objects. The class statically allocates
 /// N_PARTITIONS partitions and uses a lock-free queue for efficient data
-/// passing between threads.
+/// passing between threads. With N_PARTITIONS set to kDynamicPartitions, the
+/// number of partitions is chosen at construction instead, and keys are
+/// routed with jump consistent hashing rather than modulo.
 ///
 /// \tparam KEY
 ///     The type used as a key for task distribution. Must be hashable.
@@ -24,10 +65,14 @@ namespace mbucko {
 ///     Must have an operator() that takes a KEY and returns a std::size_t.
 /// \tparam N_PARTITIONS
 ///     The number of partitions (and thus, the number of worker threads).
-///     Must be greater than 0.
+///     Must be greater than 0, or kDynamicPartitions to choose it at
+///     construction.
 /// \tparam COMPUTABLE
 ///     The type of object on which tasks will be executed. Each partition
 ///     contains one instance of this type.
+/// \tparam TRAITS
+///     Compile-time configuration of the partitions, see
+///     DefaultProactorTraits.
 ///
 /// Example usage:
 /// \code
@@ -64,42 +109,145 @@ namespace mbucko {
 /// \endcode
 ///
 template <typename KEY, typename HASH_POLICY, std::size_t N_PARTITIONS,
-          typename COMPUTABLE>
+          typename COMPUTABLE, typename TRAITS = DefaultProactorTraits>
 class Proactor {
  private:
-  using Partition = ProactorPartition<COMPUTABLE>;
+  using Partition = ProactorPartition<COMPUTABLE, TRAITS>;
+  static constexpr bool kDynamic = N_PARTITIONS == kDynamicPartitions;
+  static constexpr bool kHotKeys = TRAITS::kHotKeyTracking;
+  static constexpr bool kWorkStealing = TRAITS::kWorkStealing;
+  using Router =
+      std::conditional_t<kHotKeys,
+                         KeyRouter<KEY, HASH_POLICY, N_PARTITIONS, TRAITS>,
+                         NoKeyRouter>;
+  struct NoConflation {};
+  using ConflationTables = std::conditional_t<
+      TRAITS::kConflation,
+      std::unique_ptr<
+          typename Partition::template Conflation<KEY, HASH_POLICY>[]>,
+      NoConflation>;
 
  public:
-  /// Creates an instance of Proactor class.
+  /// Per-partition counts, indexed by partition.
+  using PartitionCounts = PerPartition<N_PARTITIONS, std::size_t>;
+  /// A set of partitions, indexed by partition.
+  using PartitionMask = PartitionSet<N_PARTITIONS>;
+
+  /// Creates an instance of Proactor class. With kDynamicPartitions, one
+  /// partition is created per core reported by getCoreInfo().
   ///
   /// \param[in] capacity The maximum number of tasks the queue can hold.
   /// \param[in] args Arguments to be forwarded to the COMPUTABLE constructor.
   template <typename... Args>
-  Proactor(std::size_t capacity, const Args&... args) : hash_policy() {
-    static_assert(
-        std::is_constructible_v<Partition, std::size_t, std::size_t, Args...>,
-        "Arguments do not match Partition constructor");
-    for (std::size_t i = 0; i < N_PARTITIONS; ++i) {
-      new (&partitions_[i]) Partition(capacity, i, args...);
+  Proactor(std::size_t capacity, const Args&... args)
+      : Proactor(ProactorOptions{.capacity = capacity}, args...) {}
+
+  /// Creates an instance of Proactor class with options.partitions
+  /// partitions. With kDynamicPartitions, 0 partitions means one partition
+  /// per core reported by getCoreInfo().
+  ///
+  /// \param[in] options
+  ///     The queue capacity, the number of partitions, the CPUs the
+  ///     partition threads are pinned to and the watermarks reported for
+  ///     every partition, see ProactorOptions.
+  /// \param[in] args Arguments to be forwarded to the COMPUTABLE constructor.
+  template <typename... Args>
+  Proactor(const ProactorOptions& options, const Args&... args)
+      : hash_policy(),
+        partition_count_(partitionCount(options)),
+        router_(partition_count_),
+        conflation_(makeConflationTables(partition_count_)),
+        partitions_(makeStorage(partition_count_)) {
+    static_assert(std::is_constructible_v<Partition, std::size_t,
+                                          std::size_t, int, const Watermarks&,
+                                          EventCount&, Args...>,
+                  "Arguments do not match Partition constructor");
+    const CpuTopology topology = discoverTopology();
+    const std::vector<int> cpus =
+        placeThreads(topology, options.placement, partition_count());
+    for (std::size_t i = 0; i < partition_count(); ++i) {
+      auto construct = [&] {
+        // Left uninitialized, so that no page is touched before the
+        // constructor runs.
+        void* memory = ::operator new(sizeof(Partition),
+                                      std::align_val_t{alignof(Partition)});
+        try {
+          partitions_[i] =
+              new (memory) Partition(options.capacity, i, cpus[i],
+                                     options.watermarks, completion_signal_,
+                                     args...);
+        } catch (...) {
+          ::operator delete(memory, std::align_val_t{alignof(Partition)});
+          throw;
+        }
+      };
+      // On NUMA machines, allocate and construct each partition on its own
+      // CPU, so that the partition itself, its COMPUTABLE, its queues and
+      // whatever COMPUTABLE allocates are first touched, and thus allocated,
+      // on the node of its thread. Each partition has its own allocation, so
+      // partitions on different nodes never share a page through it.
+      if (cpus[i] >= 0 && topology.nodes() > 1) {
+        runOnCpu(cpus[i], construct);
+      } else {
+        construct();
+      }
+    }
+    if constexpr (kWorkStealing) {
+      for (std::size_t i = 0; i < partition_count(); ++i) {
+        partition(i).setSiblings(&partitions_[0], partition_count());
+      }
     }
   }
 
-  /// Destructor. Stops the processing thread.
+  /// Destructor. Stops the processing threads with DrainPolicy::kDrain and
+  /// destroys the partitions, including their COMPUTABLE objects.
   ~Proactor() {
-    for (std::size_t i = 0; i < N_PARTITIONS; ++i) {
-      const auto computable = reinterpret_cast<COMPUTABLE*>(&partitions_[i]);
-      if (computable != nullptr) {
-        reinterpret_cast<COMPUTABLE*>(&partitions_[i])->~COMPUTABLE();
-      }
+    // With work stealing, a partition's thread touches its siblings, so all
+    // threads must be stopped before any partition is destroyed.
+    stop();
+    for (std::size_t i = 0; i < partition_count(); ++i) {
+      partitions_[i]->~Partition();
+      ::operator delete(partitions_[i], std::align_val_t{alignof(Partition)});
+    }
+  }
+
+  /// Returns the number of partitions.
+  std::size_t partition_count() const {
+    if constexpr (kDynamic) {
+      return partition_count_;
+    } else {
+      return N_PARTITIONS;
     }
   }
 
+  /// Returns the index of the partition associated to the key.
+  std::size_t partition_of(const KEY& key) {
+    typename Router::Guard guard(router_);
+    return guard.route(key, partitionIndex(key));
+  }
+
+  /// Returns the metrics of every partition, indexed by partition: queue
+  /// depth, tasks run, time blocked in full queues, busy and idle time, and
+  /// task execution and enqueue-to-execute latency histograms. Never locks
+  /// and never slows the partitions down, so it can be called periodically
+  /// from a monitoring thread. Requires TRAITS::kMetrics.
+  PerPartition<N_PARTITIONS, MetricsSnapshot> snapshot() const {
+    static_assert(TRAITS::kMetrics, "snapshot() requires TRAITS::kMetrics");
+    auto snapshots =
+        makePerPartition<N_PARTITIONS, MetricsSnapshot>(partition_count());
+    for (std::size_t i = 0; i < partition_count(); ++i) {
+      snapshots[i] = partition(i).metrics();
+    }
+    return snapshots;
+  }
+
   /// Enqueues a task to be processed asynchronously. Uses the provided key
   /// and HASH_POLICY to determine the partition on which to enqueue the task.
   /// It will block until space in the queue becomes available. This function
   /// is thread-safe and can be called concurrently from multiple threads.
-  /// Calling this function after calling 'stop()' results in undefined
-  /// behavior.
+  /// Called from the thread of the target partition itself, the task may
+  /// bypass the queue, see TRAITS::kSelfDispatch. Calling this function after
+  /// calling 'stop()' results in undefined behavior.
   ///
   /// \param[in] key
   ///     The key used to determine the target partition.
@@ -113,19 +261,42 @@ class Proactor {
   template <typename MemberFunc, typename Callback, typename... Args>
   void process(const KEY& key, MemberFunc func, Callback&& callback,
                Args&&... args) {
-    const std::size_t index = hash_policy(key) % N_PARTITIONS;
-    Partition* partition = reinterpret_cast<Partition*>(&partitions_[index]);
-    partition->process(func, std::forward<Callback>(callback),
-                       std::forward<Args>(args)...);
+    routeKey(key, [&](Partition& partition) {
+      partition.process(func, std::forward<Callback>(callback),
+                        std::forward<Args>(args)...);
+    });
   }
 
-  /// Enqueues a task to be processed asynchronously on each partition. This
-  /// function will block until space in the queue becomes available. If one
-  /// partition's queue is full, the function will block, potentially delaying
-  /// task distribution to subsequent partitions. This function is thread-safe
-  /// and can be called concurrently from multiple threads. Calling this
-  /// function after calling 'stop()' is undefined behavior.
+  /// Same as 'process(key, func, callback, args...)', in the priority lane
+  /// of 'priority': the task runs before any task of a lower priority still
+  /// waiting in the partition, subject to TRAITS::kPriorityBudget. Tasks are
+  /// only FIFO among tasks of the same priority, see
+  /// TRAITS::kPriorityLanes.
+  template <typename MemberFunc, typename Callback, typename... Args>
+  void process(const KEY& key, Priority priority, MemberFunc func,
+               Callback&& callback, Args&&... args) {
+    routeKey(key, [&](Partition& partition) {
+      partition.process(priority, func, std::forward<Callback>(callback),
+                        std::forward<Args>(args)...);
+    });
+  }
+
+  /// Enqueues a conflated update: if an update of the key is still pending
+  /// on its partition, this one replaces it in place, so that only the
+  /// latest update of each key runs, and the queue holds at most one task
+  /// per distinct key, however fast the updates arrive. Meant for updates
+  /// that supersede each other, like market data. The update runs in place
+  /// of the first update conflated into it, which keeps its order relative
+  /// to the other tasks of the partition. Blocks until space in the queue
+  /// becomes available when a task has to be enqueued. Every update locks
+  /// the mutex of one of the ConflationTable stripes of the partition, for
+  /// a map lookup and a task move, so producers of keys hashing to the same
+  /// stripe serialize. Requires TRAITS::kConflation, and an equality
+  /// comparable KEY.
   ///
+  /// \param[in] key
+  ///     The key used to determine the target partition, and the update it
+  ///     replaces.
   /// \param[in] func
   ///     A member function pointer of COMPUTABLE to be executed
   ///     asynchronously on a partition.
@@ -133,20 +304,318 @@ class Proactor {
   ///     A function to be called with the result of func (if any).
   /// \param[in] args
   ///     Arguments to be passed to func.
+  template <typename MemberFunc, typename Callback, typename... Args>
+    requires std::is_member_function_pointer_v<MemberFunc>
+  void process_latest(const KEY& key, MemberFunc func, Callback&& callback,
+                      Args&&... args) {
+    process_latest(key, nullptr, func, std::forward<Callback>(callback),
+                   std::forward<Args>(args)...);
+  }
+
+  /// Same as 'process_latest(key, func, callback, args...)', but merges the
+  /// update into the pending update of the key by calling
+  /// combine(pending_args..., args...), e.g. to accumulate deltas, as long
+  /// as the pending update was made with the same func, callback and
+  /// argument types. 'args' are passed to 'combine' as rvalues of their
+  /// decayed types, so it may take them by value, const reference or
+  /// rvalue reference. The merged update keeps the callback of the pending
+  /// one.
+  ///
+  /// \code
+  /// proactor.process_latest(
+  ///     symbol, [](Quote& pending, Quote&& quote) { pending.merge(quote); },
+  ///     &Book::apply, [] {}, quote);
+  /// \endcode
+  template <typename Combine, typename MemberFunc, typename Callback,
+            typename... Args>
+    requires(!std::is_member_function_pointer_v<std::decay_t<Combine>>)
+  void process_latest(const KEY& key, Combine&& combine, MemberFunc func,
+                      Callback&& callback, Args&&... args) {
+    static_assert(TRAITS::kConflation,
+                  "process_latest() requires TRAITS::kConflation");
+    const std::size_t hash = hash_policy(key);
+    routeKey(key, [&](Partition& partition) {
+      partition.process_latest(conflation_[partition.index()], key, hash,
+                               std::forward<Combine>(combine), func,
+                               std::forward<Callback>(callback),
+                               std::forward<Args>(args)...);
+    });
+  }
+
+  /// Enqueues a task to be processed once 'delay' has elapsed, on the
+  /// partition associated to the key. The timer lives on that partition's
+  /// timing wheel and fires on its thread, without any extra hop or lock;
+  /// arming it from another thread takes one enqueue, which blocks until
+  /// space in the queue becomes available. Timers stay on the partition the
+  /// key was routed to when they were armed. While all TRAITS::kTimerCapacity
+  /// timers of the partition are in use, blocks, or returns an invalid
+  /// handle when called from that partition's own thread, which would
+  /// otherwise wait for itself. Requires TRAITS::kTimers.
+  ///
+  /// \param[in] key
+  ///     The key used to determine the target partition.
+  /// \param[in] delay
+  ///     The time to wait, rounded up to TRAITS::kTimerResolution.
+  /// \param[in] func
+  ///     A member function pointer of COMPUTABLE to be executed.
+  /// \param[in] callback
+  ///     A function to be called with the result of func (if any).
+  /// \param[in] args
+  ///     Arguments to be passed to func.
+  /// \return
+  ///     A handle to cancel the timer with 'cancel_timer()', or an invalid
+  ///     one, see TimerHandle::valid(), if the timer could not be armed.
+  template <typename Rep, typename Period, typename MemberFunc,
+            typename Callback, typename... Args>
+  TimerHandle process_after(const KEY& key,
+                            std::chrono::duration<Rep, Period> delay,
+                            MemberFunc func, Callback&& callback,
+                            Args&&... args) {
+    return routeKey(key, [&](Partition& partition) {
+      return partition.process_after(
+          std::chrono::ceil<std::chrono::nanoseconds>(delay), func,
+          std::forward<Callback>(callback), std::forward<Args>(args)...);
+    });
+  }
+
+  /// Same as 'process_after()', but processes the task every 'period' until
+  /// the timer is cancelled, the first time one period from now. The
+  /// callback and arguments are copied for every run.
+  template <typename Rep, typename Period, typename MemberFunc,
+            typename Callback, typename... Args>
+  TimerHandle process_every(const KEY& key,
+                            std::chrono::duration<Rep, Period> period,
+                            MemberFunc func, Callback&& callback,
+                            Args&&... args) {
+    return routeKey(key, [&](Partition& partition) {
+      return partition.process_every(
+          std::chrono::ceil<std::chrono::nanoseconds>(period), func,
+          std::forward<Callback>(callback), std::forward<Args>(args)...);
+    });
+  }
+
+  /// Cancels a timer armed with 'process_after()' or 'process_every()', in
+  /// O(1). This function is thread-safe. Returns false if the timer already
+  /// fired (for a one-shot timer) or was already cancelled.
+  bool cancel_timer(const TimerHandle& handle) {
+    return partition(handle.partition).cancel_timer(handle);
+  }
+
+  /// Returns an awaitable/future for the result of func executed on the
+  /// partition associated to the key. The task is enqueued, blocking until
+  /// space in the queue becomes available, when the result is first awaited
+  /// with 'co_await' or when 'get()' is called on it. An awaiting coroutine is
+  /// resumed on the partition thread, or through the executor passed to
+  /// 'via()'. No allocation is involved: the result is delivered into the
+  /// returned object, which must outlive the task (see AsyncResult).
+  ///
+  /// \code
+  /// uint32_t sum = co_await proactor.process_async(key, &Adder::get);
+  /// co_await proactor.process_async(key, &Adder::add, 1u).via(executor);
+  /// \endcode
+  ///
+  /// \param[in] key
+  ///     The key used to determine the target partition.
+  /// \param[in] func
+  ///     A member function pointer of COMPUTABLE to be executed
+  ///     asynchronously on a partition.
+  /// \param[in] args
+  ///     Arguments to be passed to func. They are copied into the result.
+  /// \return
+  ///     An AsyncResult yielding the return value of func.
+  template <typename MemberFunc, typename... Args>
+  auto process_async(const KEY& key, MemberFunc func, Args&&... args) {
+    using Result = std::invoke_result_t<MemberFunc, COMPUTABLE*, Args...>;
+    auto launch = [this, key, func,
+                   ... capturedArgs = std::forward<Args>(args)](
+                      auto&& callback) {
+      routeKey(key, [&](Partition& partition) {
+        partition.process(func, std::forward<decltype(callback)>(callback),
+                          capturedArgs...);
+      });
+    };
+    return AsyncResult<Result, decltype(launch)>(std::move(launch));
+  }
+
+  /// Same as 'process_async(key, func, args...)', in the priority lane of
+  /// 'priority', see 'process(key, priority, func, callback, args...)'.
+  template <typename MemberFunc, typename... Args>
+  auto process_async(const KEY& key, Priority priority, MemberFunc func,
+                     Args&&... args) {
+    using Result = std::invoke_result_t<MemberFunc, COMPUTABLE*, Args...>;
+    auto launch = [this, key, priority, func,
+                   ... capturedArgs = std::forward<Args>(args)](
+                      auto&& callback) {
+      routeKey(key, [&](Partition& partition) {
+        partition.process(priority, func,
+                          std::forward<decltype(callback)>(callback),
+                          capturedArgs...);
+      });
+    };
+    return AsyncResult<Result, decltype(launch)>(std::move(launch));
+  }
+
+  /// Enqueues a task to be processed asynchronously on each partition. This
+  /// function will block until every partition has accepted the task, but a
+  /// full queue on one partition does not delay the distribution to the
+  /// others. This function is thread-safe and can be called concurrently from
+  /// multiple threads. Calling this function after calling 'stop()' is
+  /// undefined behavior. See 'broadcast()' for how the task is shared.
+  ///
+  /// \param[in] func
+  ///     A member function pointer of COMPUTABLE to be executed
+  ///     asynchronously on a partition.
+  /// \param[in] callback
+  ///     A function to be called with the result of func (if any), once per
+  ///     partition.
+  /// \param[in] args
+  ///     Arguments to be passed to func.
   template <typename MemberFunc, typename Callback, typename... Args>
   void process(MemberFunc func, Callback&& callback, Args&&... args) {
-    for (int i = 0; i < N_PARTITIONS; ++i) {
-      Partition* partition = reinterpret_cast<Partition*>(&partitions_[i]);
-      partition->process(func, std::forward<Callback>(callback),
-                         std::forward<Args>(args)...);
+    broadcast(func, std::forward<Callback>(callback), [] {},
+              std::forward<Args>(args)...);
+  }
+
+  /// Enqueues a task to be processed asynchronously on each partition and
+  /// calls 'done' once every partition has processed it and its callback has
+  /// returned. The callback, the arguments and 'done' are stored once in a
+  /// single reference counted allocation shared by all partitions, rather
+  /// than copied per partition. Since partitions run concurrently, func
+  /// receives the arguments by const reference and the callback is invoked
+  /// concurrently through a const reference, so both must be safe to share.
+  ///
+  /// The task is offered to all partitions in turn, and partitions whose
+  /// queue is full are retried on the next pass, so one slow partition only
+  /// delays itself. This function blocks until every partition has accepted
+  /// the task. It is thread-safe and can be called concurrently from
+  /// multiple threads. Calling this function after calling 'stop()' is
+  /// undefined behavior.
+  ///
+  /// \param[in] func
+  ///     A member function pointer of COMPUTABLE to be executed
+  ///     asynchronously on a partition.
+  /// \param[in] callback
+  ///     A function to be called with the result of func (if any), once per
+  ///     partition.
+  /// \param[in] done
+  ///     A function without arguments, called once after the last callback.
+  /// \param[in] args
+  ///     Arguments to be passed to func.
+  template <typename MemberFunc, typename Callback, typename Done,
+            typename... Args>
+  void broadcast(MemberFunc func, Callback&& callback, Done&& done,
+                 Args&&... args) {
+    publish(makeBroadcast(func, std::forward<Callback>(callback),
+                          std::forward<Done>(done),
+                          std::forward<Args>(args)...));
+  }
+
+  /// Same as 'broadcast(func, callback, done, args...)', in the priority
+  /// lane of 'priority' of every partition, e.g. for a control message that
+  /// must overtake the backlog of normal tasks.
+  template <typename MemberFunc, typename Callback, typename Done,
+            typename... Args>
+  void broadcast(Priority priority, MemberFunc func, Callback&& callback,
+                 Done&& done, Args&&... args) {
+    publish(makeBroadcast(func, std::forward<Callback>(callback),
+                          std::forward<Done>(done),
+                          std::forward<Args>(args)...),
+            priority);
+  }
+
+  /// Runs func on every partition's COMPUTABLE, combines the results with
+  /// 'reducer' and calls 'done' once with the reduced value. Every partition
+  /// stores its result into its own slot of a single shared allocation, and
+  /// the partition finishing last folds the slots in partition order, i.e.
+  /// reducer(reducer(r0, r1), r2)..., so the reducer does not need to be
+  /// commutative. 'done' runs on that partition's thread, or on the thread
+  /// polling completions in CompletionMode::kDeferred. This function blocks
+  /// like 'broadcast()', and func receives the arguments by const reference.
+  ///
+  /// \param[in] func
+  ///     A member function pointer of COMPUTABLE to be executed
+  ///     asynchronously on every partition. It must return a value.
+  /// \param[in] reducer
+  ///     A function combining two results into one.
+  /// \param[in] done
+  ///     A function called once with the reduced value.
+  /// \param[in] args
+  ///     Arguments to be passed to func.
+  template <typename MemberFunc, typename Reducer, typename Done,
+            typename... Args>
+  void map_reduce(MemberFunc func, Reducer&& reducer, Done&& done,
+                  Args&&... args) {
+    map_reduce(Priority::kNormal, func, std::forward<Reducer>(reducer),
+               std::forward<Done>(done), std::forward<Args>(args)...);
+  }
+
+  /// Same as 'map_reduce(func, reducer, done, args...)', in the priority
+  /// lane of 'priority' of every partition.
+  template <typename MemberFunc, typename Reducer, typename Done,
+            typename... Args>
+  void map_reduce(Priority priority, MemberFunc func, Reducer&& reducer,
+                  Done&& done, Args&&... args) {
+    using Result = std::decay_t<std::invoke_result_t<
+        MemberFunc, COMPUTABLE*, const std::decay_t<Args>&...>>;
+    static_assert(!std::is_void_v<Result>, "func must return a value");
+    static_assert(
+        std::is_convertible_v<std::invoke_result_t<Reducer&, Result, Result>,
+                              Result>,
+        "reducer must combine two results into one");
+    using Task = MapReduceTask<Result, N_PARTITIONS, MemberFunc,
+                               std::decay_t<Reducer>, std::decay_t<Done>,
+                               std::decay_t<Args>...>;
+    publish(new Task(partition_count(), func, std::forward<Reducer>(reducer),
+                     std::forward<Done>(done), std::forward<Args>(args)...),
+            priority);
+  }
+
+  /// Like 'broadcast()', but never blocks: the task is only enqueued on the
+  /// partitions whose queue is not full. 'done' is called once every
+  /// accepting partition has processed the task, or right away on the
+  /// calling thread if no partition accepted it.
+  ///
+  /// \param[in] func
+  ///     A member function pointer of COMPUTABLE to be executed
+  ///     asynchronously on a partition.
+  /// \param[in] callback
+  ///     A function to be called with the result of func (if any), once per
+  ///     accepting partition.
+  /// \param[in] done
+  ///     A function without arguments, called once after the last callback.
+  /// \param[in] args
+  ///     Arguments to be passed to func.
+  /// \return
+  ///     The set of partitions that accepted the task.
+  template <typename MemberFunc, typename Callback, typename Done,
+            typename... Args>
+  PartitionMask try_broadcast(MemberFunc func, Callback&& callback,
+                              Done&& done, Args&&... args) {
+    auto* task = makeBroadcast(func, std::forward<Callback>(callback),
+                               std::forward<Done>(done),
+                               std::forward<Args>(args)...);
+    // The references of rejecting partitions are released together at the
+    // end, which keeps the task alive until every partition has been offered
+    // the task.
+    PartitionMask accepted =
+        makePartitionSet<N_PARTITIONS>(partition_count());
+    for (std::size_t i = 0; i < partition_count(); ++i) {
+      accepted.set(i, partition(i).try_process_broadcast(task));
     }
+    const std::size_t rejected = partition_count() - accepted.count();
+    if (rejected > 0) {
+      task->release(rejected);
+    }
+    return accepted;
   }
 
   /// If queue is not full, enqueues a task to be processed asynchronously and
-  /// return true, otherwise return false. Uses the provided key and HASH_POLICY
-  /// to determine the partition on which to enqueue the task. This function is
-  /// thread-safe and can be called concurrently from multiple threads. Calling
-  /// this function after calling 'stop()' results in undefined behavior.
+  /// return true, otherwise return false. Also returns false if the
+  /// AdmissionPolicy of the partition rejects the task. Uses the provided key
+  /// and HASH_POLICY to determine the partition on which to enqueue the task.
+  /// This function is thread-safe and can be called concurrently from
+  /// multiple threads. Calling this function after calling 'stop()' results
+  /// in undefined behavior.
   ///
   /// \param[in] key
   ///     The key used to determine the target partition.
@@ -162,18 +631,22 @@ class Proactor {
   template <typename MemberFunc, typename Callback, typename... Args>
   bool try_process(const KEY& key, MemberFunc func, Callback&& callback,
                    Args&&... args) {
-    const std::size_t index = hash_policy(key) % N_PARTITIONS;
-    Partition* partition = reinterpret_cast<Partition*>(&partitions_[index]);
-    return partition->try_process(func, std::forward<Callback>(callback),
-                                  std::forward<Args>(args)...);
+    return routeKey(key, [&](Partition& partition) {
+      return partition.try_process(func, std::forward<Callback>(callback),
+                                   std::forward<Args>(args)...);
+    });
   }
 
-  /// Enqueues a task to be processed asynchronously on each partition. This
-  /// function will return true if enqueuing succeeds for all parttitions,
-  /// otherwise returns false. This function is thread-safe and can be called
+  /// Same as 'process()', but waits at most 'timeout' for space in the
+  /// queue, and rejects the task right away if the AdmissionPolicy of the
+  /// partition does. This function is thread-safe and can be called
   /// concurrently from multiple threads. Calling this function after calling
-  /// 'stop()' is undefined behavior.
+  /// 'stop()' results in undefined behavior.
   ///
+  /// \param[in] key
+  ///     The key used to determine the target partition.
+  /// \param[in] timeout
+  ///     How long to wait for space in a full queue.
   /// \param[in] func
   ///     A member function pointer of COMPUTABLE to be executed
   ///     asynchronously on a partition.
@@ -182,40 +655,541 @@ class Proactor {
   /// \param[in] args
   ///     Arguments to be passed to func.
   /// \return
+  ///     Return true if the task was enqueued, false otherwise.
+  template <typename MemberFunc, typename Callback, typename... Args>
+  bool process_for(const KEY& key, std::chrono::nanoseconds timeout,
+                   MemberFunc func, Callback&& callback, Args&&... args) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    return routeKey(key, [&](Partition& partition) {
+      return partition.process_until(deadline, func,
+                                     std::forward<Callback>(callback),
+                                     std::forward<Args>(args)...);
+    });
+  }
+
+  /// Same as 'try_process(key, func, callback, args...)', in the priority
+  /// lane of 'priority'.
+  template <typename MemberFunc, typename Callback, typename... Args>
+  bool try_process(const KEY& key, Priority priority, MemberFunc func,
+                   Callback&& callback, Args&&... args) {
+    return routeKey(key, [&](Partition& partition) {
+      return partition.try_process(priority, func,
+                                   std::forward<Callback>(callback),
+                                   std::forward<Args>(args)...);
+    });
+  }
+
+  /// Enqueues a task to be processed asynchronously on each partition whose
+  /// queue is not full. This function never blocks. It is thread-safe and
+  /// can be called concurrently from multiple threads. Calling this function
+  /// after calling 'stop()' is undefined behavior. Use 'try_broadcast()' to
+  /// find out which partitions accepted the task.
+  ///
+  /// \param[in] func
+  ///     A member function pointer of COMPUTABLE to be executed
+  ///     asynchronously on a partition.
+  /// \param[in] callback
+  ///     A function to be called with the result of func (if any), once per
+  ///     accepting partition.
+  /// \param[in] args
+  ///     Arguments to be passed to func.
+  /// \return
   ///     Return true if the task was successfully enqueued for all partitions,
   ///     false otherwise.
   template <typename MemberFunc, typename Callback, typename... Args>
   bool try_process(MemberFunc func, Callback&& callback, Args&&... args) {
-    bool success = true;
-    for (int i = 0; i < N_PARTITIONS; ++i) {
-      Partition* partition = reinterpret_cast<Partition*>(&partitions_[i]);
-      success &= partition->try_process(func, std::forward<Callback>(callback),
-                                        std::forward<Args>(args)...);
+    return try_broadcast(func, std::forward<Callback>(callback), [] {},
+                         std::forward<Args>(args)...)
+        .all();
+  }
+
+  /// Enqueues one task per item of 'items', a random access range of
+  /// tuple-like (key, args...) items such as std::pair<KEY, Arg> or
+  /// std::tuple<KEY, Args...>. Each task calls func with the item's args on
+  /// the partition associated to the item's key. All items are routed with a
+  /// single hashing pass, and the items of each partition are enqueued
+  /// together, reserving their queue slots at once when the queue supports
+  /// it. Items with the same key are processed in their order within
+  /// 'items'. This function blocks until all items are enqueued. It is
+  /// thread-safe and can be called concurrently from multiple threads.
+  /// Calling this function after calling 'stop()' is undefined behavior.
+  ///
+  /// \param[in] items
+  ///     The (key, args...) items to be processed.
+  /// \param[in] func
+  ///     A member function pointer of COMPUTABLE to be executed
+  ///     asynchronously on a partition.
+  /// \param[in] callback
+  ///     A function to be called with the result of func (if any), once per
+  ///     item.
+  template <typename Items, typename MemberFunc, typename Callback>
+  void process_batch(const Items& items, MemberFunc func,
+                     const Callback& callback) {
+    typename Router::Guard guard(router_);
+    const BatchPlan& plan = planBatch(items, guard);
+    for (std::size_t i = 0; i < partition_count(); ++i) {
+      const std::size_t count = plan.offsets[i + 1] - plan.offsets[i];
+      if (count != 0) {
+        guard.target(i, /*batch=*/true);
+        partition(i).process_batch(func, callback, items,
+                                   plan.order.data() + plan.offsets[i], count);
+      }
+    }
+  }
+
+  /// Like process_batch(), but never blocks: for each partition, enqueues as
+  /// many of its items as currently fit into its queue, or none if its
+  /// AdmissionPolicy rejects them. Returns the number of items accepted by
+  /// each partition. The accepted items of partition i are
+  /// the first counts[i] items of 'items' that are routed to partition i.
+  ///
+  /// \param[in] items
+  ///     The (key, args...) items to be processed.
+  /// \param[in] func
+  ///     A member function pointer of COMPUTABLE to be executed
+  ///     asynchronously on a partition.
+  /// \param[in] callback
+  ///     A function to be called with the result of func (if any), once per
+  ///     accepted item.
+  /// \return
+  ///     The number of items accepted per partition.
+  template <typename Items, typename MemberFunc, typename Callback>
+  PartitionCounts try_process_batch(const Items& items, MemberFunc func,
+                                    const Callback& callback) {
+    typename Router::Guard guard(router_);
+    const BatchPlan& plan = planBatch(items, guard);
+    PartitionCounts accepted =
+        makePerPartition<N_PARTITIONS, std::size_t>(partition_count());
+    for (std::size_t i = 0; i < partition_count(); ++i) {
+      const std::size_t count = plan.offsets[i + 1] - plan.offsets[i];
+      if (count != 0) {
+        guard.target(i, /*batch=*/true);
+        accepted[i] = partition(i).try_process_batch(
+            func, callback, items, plan.order.data() + plan.offsets[i], count);
+      }
+    }
+    return accepted;
+  }
+
+  /// Returns the hot keys among the sampled keyed enqueues, most frequent
+  /// first, with their sampled counts. Only available with
+  /// TRAITS::kHotKeyTracking.
+  std::vector<HotKey<KEY>> hot_keys() const {
+    static_assert(kHotKeys, "hot_keys() requires TRAITS::kHotKeyTracking");
+    return router_.hotKeys();
+  }
+
+  /// Returns the number of sampled keyed enqueues of each partition since
+  /// the last rebalance. Only available with TRAITS::kHotKeyTracking.
+  PartitionCounts partition_loads() const {
+    static_assert(kHotKeys,
+                  "partition_loads() requires TRAITS::kHotKeyTracking");
+    PartitionCounts loads =
+        makePerPartition<N_PARTITIONS, std::size_t>(partition_count());
+    for (std::size_t i = 0; i < partition_count(); ++i) {
+      loads[i] = router_.load(i);
+    }
+    return loads;
+  }
+
+  /// Moves 'key', and its state, to partition 'target'. Tasks for the key
+  /// keep running in the order they were enqueued: 'target' first waits for
+  /// the key's state, which its current partition exports once it has run
+  /// every task enqueued before the move. In the meantime 'target' does not
+  /// run any task. The state is handed over with COMPUTABLE's hooks:
+  ///
+  /// \code
+  /// State exportKey(const KEY& key);
+  /// void importKey(const KEY& key, State&& state);
+  /// \endcode
+  ///
+  /// This function blocks until the state has been imported. It is
+  /// thread-safe, but must not be called from a partition thread, nor while
+  /// tasks of this Proactor block on enqueuing into this Proactor. Only
+  /// available with TRAITS::kHotKeyTracking, a queue that is FIFO across
+  /// producers and a single priority lane.
+  ///
+  /// \param[in] key
+  ///     The key to be moved.
+  /// \param[in] target
+  ///     The index of the partition the key is moved to.
+  void migrate_key(const KEY& key, std::size_t target) {
+    static_assert(kHotKeys, "migrate_key() requires TRAITS::kHotKeyTracking");
+    static_assert(TRAITS::QueuePolicy::kFifoAcrossProducers,
+                  "migrate_key() requires a queue that is FIFO across "
+                  "producers");
+    static_assert(TRAITS::kPriorityLanes == 1,
+                  "migrate_key() requires a single priority lane");
+    static_assert(
+        requires(COMPUTABLE& computable, const KEY& k) {
+          computable.importKey(k, computable.exportKey(k));
+        },
+        "COMPUTABLE must provide exportKey(key) and importKey(key, state)");
+    using State =
+        std::decay_t<decltype(std::declval<COMPUTABLE&>().exportKey(key))>;
+    struct Migration {
+      const KEY& key;
+      std::optional<State> state{};
+      std::binary_semaphore exported{0};
+      std::binary_semaphore imported{0};
+    };
+
+    assert(target < partition_count());
+    std::lock_guard<std::mutex> lock(router_.moveMutex());
+    const std::size_t home = partitionIndex(key);
+    const std::size_t source = partition_of(key);
+    if (source == target) {
+      return;
+    }
+    Migration migration{key};
+    // Enqueued before the route changes, so that it runs before any task
+    // routed to 'target' afterwards.
+    partition(target).process_task([&migration](COMPUTABLE& computable) {
+      migration.exported.acquire();
+      computable.importKey(migration.key, std::move(*migration.state));
+      migration.imported.release();
+    });
+    router_.reroute(key, home, target, source);
+    // Enqueued once no producer can enqueue the key into 'source' anymore,
+    // so that it runs after every task routed to 'source'.
+    partition(source).process_task([&migration](COMPUTABLE& computable) {
+      migration.state.emplace(computable.exportKey(migration.key));
+      migration.exported.release();
+    });
+    migration.imported.acquire();
+  }
+
+  /// Moves one hot key of the most loaded partition to the least loaded
+  /// partition, based on the samples taken since the last rebalance, then
+  /// starts sampling afresh. The key moved is the one lowering the load of
+  /// the most loaded partition the most, counting only the samples a key
+  /// surely got. Moves lowering it by less than the sampling noise of the
+  /// two loads are not made: they would mostly move keys back and forth,
+  /// and every move stalls the least loaded partition until the most loaded
+  /// one ran its queued tasks. Returns whether a key was moved. See
+  /// 'migrate_key()' for the requirements.
+  bool rebalance() {
+    const PartitionCounts loads = partition_loads();
+    const auto [least, most] = std::minmax_element(loads.begin(), loads.end());
+    const std::size_t source = most - loads.begin();
+    const std::uint64_t gap = *most - *least;
+    // About the standard deviation of the difference of two sampled loads.
+    std::uint64_t bestGain = static_cast<std::uint64_t>(
+        std::sqrt(static_cast<double>(*most + *least)));
+    std::optional<KEY> best;
+    for (const HotKey<KEY>& hot : hot_keys()) {
+      const std::uint64_t count = hot.count - hot.error;
+      if (count >= gap || partition_of(hot.key) != source) {
+        continue;
+      }
+      const std::uint64_t gain = std::min(count, gap - count);
+      if (gain > bestGain) {
+        bestGain = gain;
+        best = hot.key;
+      }
+    }
+    if (best) {
+      migrate_key(*best, least - loads.begin());
+    }
+    router_.clear();
+    return best.has_value();
+  }
+
+  /// Runs an unkeyed job on whichever partition gets to it first, then calls
+  /// 'callback' with its result. Jobs are spread over the partitions, and
+  /// idle partitions steal the jobs of busy ones, so unkeyed jobs have no
+  /// ordering guarantees, while keyed tasks keep their per-partition order.
+  /// Called from a partition thread, e.g. by a task spawning sub-jobs, the
+  /// job is pushed onto that partition's own work-stealing deque. Otherwise,
+  /// blocks until space in the chosen partition becomes available. Requires
+  /// TRAITS::kWorkStealing.
+  ///
+  /// \param[in] func
+  ///     A callable taking no arguments. It must not rely on running on a
+  ///     particular partition, and should not touch COMPUTABLE.
+  /// \param[in] callback
+  ///     A callback function to be invoked with the result of func, or
+  ///     without arguments if func returns void.
+  template <typename Func, typename Callback>
+  void submit(Func&& func, Callback&& callback) {
+    static_assert(kWorkStealing, "submit() requires TRAITS::kWorkStealing");
+    Partition* target = Partition::current();
+    if (target == nullptr || !owns(target)) {
+      thread_local std::size_t next = producerSlot();
+      target = &partition(next++ % partition_count());
+    }
+    target->submit(std::forward<Func>(func), std::forward<Callback>(callback));
+  }
+
+  /// Runs up to 'max' pending completion callbacks on the calling thread and
+  /// returns how many were run. Partitions are polled in turn; a partition
+  /// that is being polled by another thread is skipped. This function is
+  /// thread-safe and is only available with CompletionMode::kDeferred, see
+  /// CompletionThreadPool for a dedicated set of polling threads.
+  ///
+  /// \param[in] max
+  ///     The maximum number of callbacks to run.
+  /// \return
+  ///     The number of callbacks run.
+  std::size_t poll_completions(
+      std::size_t max = std::numeric_limits<std::size_t>::max()) {
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < partition_count() && count < max; ++i) {
+      count += partition(i).poll_completions(max - count);
     }
-    return true;
+    return count;
   }
 
-  /// Stops all processing threads and prevents further task enqueuing.
-  /// This function is thread-safe and can be called multiple times safely.
-  /// After calling this function, calling any other function on this object
-  /// results in undefined behavior.
-  void stop() noexcept {
-    for (std::size_t i = 0; i < N_PARTITIONS; ++i) {
-      reinterpret_cast<Partition*>(&partitions_[i])->stop();
+  /// Parks the calling thread until a partition hands completions over to
+  /// 'poll_completions()', or until 'done()' returns true, which only wakes
+  /// the thread up through 'wake_completion_pollers()'. May return
+  /// spuriously. Partitions signal once per batch, and only issue a system
+  /// call while a thread is parked. Only available with
+  /// CompletionMode::kDeferred.
+  ///
+  /// \param[in] done
+  ///     Called with no arguments, returns whether to stop waiting.
+  template <typename Done>
+  void wait_completions(Done&& done) {
+    completion_signal_.wait([&]() {
+      if (done()) {
+        return true;
+      }
+      for (std::size_t i = 0; i < partition_count(); ++i) {
+        if (partition(i).has_completions()) {
+          return true;
+        }
+      }
+      return false;
+    });
+  }
+
+  /// Wakes up the threads parked in 'wait_completions()', e.g. after
+  /// changing what their 'done()' returns.
+  void wake_completion_pollers() { completion_signal_.notify(); }
+
+  /// Waits until every task enqueued before the call has run, with its
+  /// callback when callbacks run inline. Enqueues nothing: the write
+  /// positions of all queues are taken at the call, and each partition is
+  /// waited for until it ran past them, so a busy Proactor keeps running at
+  /// full speed. Tasks enqueued meanwhile, including by the tasks waited
+  /// for, are not waited for, see 'quiesce()'. Neither are timers, unkeyed
+  /// jobs and deferred callbacks. Must not be called from a partition
+  /// thread.
+  void drain() {
+    assert(!owns(Partition::current()));
+    waitDrained(drainMarks());
+  }
+
+  /// Waits until the Proactor is quiescent: every task has run, including
+  /// the tasks enqueued by tasks and inline callbacks into this Proactor,
+  /// and the queues are empty. Only returns once producers outside the
+  /// Proactor stop enqueuing. Must not be called from a partition thread.
+  void quiesce() {
+    assert(!owns(Partition::current()));
+    auto marks = drainMarks();
+    while (true) {
+      waitDrained(marks);
+      auto next = drainMarks();
+      if (next == marks) {
+        return;
+      }
+      marks = std::move(next);
+    }
+  }
+
+  /// Stops all processing threads and prevents further task enqueuing. The
+  /// partitions drain their queues according to 'policy', all at once, and
+  /// this function returns once all threads have exited. This function is
+  /// thread-safe and can be called multiple times safely; concurrent calls
+  /// all return once the threads have exited. After calling this function,
+  /// calling any other function on this object results in undefined
+  /// behavior.
+  ///
+  /// \param[in] policy Which queued tasks still run, see DrainPolicy.
+  void stop(DrainPolicy policy = DrainPolicy::kDrain) noexcept {
+    if (policy == DrainPolicy::kQuiesce) {
+      quiesce();
+    }
+    for (std::size_t i = 0; i < partition_count(); ++i) {
+      partition(i).requestStop(policy);
+    }
+    for (std::size_t i = 0; i < partition_count(); ++i) {
+      partition(i).join();
     }
   }
 
  private:
-  HASH_POLICY hash_policy;
-  // Use 'char' array for raw storage to allow placement new initialization.
-  // This approach avoids potential issues with Partition's possible lack of a
-  // default constructor, while still enabling proper alignment and efficient
-  // memory usage.
-  alignas(Partition) char partitions_[N_PARTITIONS][sizeof(Partition)];
-  Partition& partition(int i) {
-    return *reinterpret_cast<Partition*>(&partitions_[i]);
+  // Item indices of a batch grouped by partition: the items of partition i
+  // are order[offsets[i]] .. order[offsets[i + 1] - 1], in input order.
+  struct BatchPlan {
+    std::vector<std::uint32_t> partitions;
+    std::vector<std::uint32_t> order;
+    std::vector<std::size_t> offsets;
+    std::vector<std::size_t> next;
+  };
+
+  // Offers a task holding one reference per partition to all partitions in
+  // turn, in the lane of 'priority', until every partition has accepted it.
+  template <typename Broadcast>
+  void publish(Broadcast* task, Priority priority = Priority::kNormal) {
+    PartitionMask pending =
+        makePartitionSet<N_PARTITIONS>(partition_count());
+    pending.set();
+    // The task may be deleted as soon as the last partition accepted it, so
+    // it must not be touched once 'pending' is empty.
+    while (true) {
+      for (std::size_t i = 0; i < partition_count(); ++i) {
+        if (pending.test(i) &&
+            partition(i).try_process_broadcast(task, priority)) {
+          pending.reset(i);
+        }
+      }
+      if (pending.none()) {
+        return;
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  // Allocates the payload of a broadcast, holding one reference per
+  // partition.
+  template <typename MemberFunc, typename Callback, typename Done,
+            typename... Args>
+  auto* makeBroadcast(MemberFunc func, Callback&& callback, Done&& done,
+                      Args&&... args) {
+    static_assert(std::is_invocable_v<MemberFunc, COMPUTABLE*,
+                                      const std::decay_t<Args>&...>,
+                  "func must be callable with const arguments");
+    using Task = BroadcastTask<MemberFunc, std::decay_t<Callback>,
+                               std::decay_t<Done>, std::decay_t<Args>...>;
+    return new Task(partition_count(), func, std::forward<Callback>(callback),
+                    std::forward<Done>(done), std::forward<Args>(args)...);
+  }
+
+  // Calls 'enqueue' with the partition of 'key'. With kHotKeyTracking, the
+  // key is sampled, and moving the key waits for 'enqueue' to return.
+  template <typename Enqueue>
+  decltype(auto) routeKey(const KEY& key, Enqueue&& enqueue) {
+    typename Router::Guard guard(router_);
+    const std::size_t index = guard.route(key, partitionIndex(key));
+    guard.target(index);
+    router_.sample(key, index);
+    return enqueue(partition(index));
+  }
+
+  // The hash partition of 'key', ignoring moves.
+  std::size_t partitionIndex(const KEY& key) {
+    if constexpr (kDynamic) {
+      return jumpConsistentHash(hash_policy(key), partition_count_);
+    } else {
+      return hash_policy(key) % N_PARTITIONS;
+    }
   }
 
+  // Groups the items of a batch by partition with a counting sort. The plan
+  // is thread-local so that its buffers are reused across batches.
+  template <typename Items>
+  const BatchPlan& planBatch(const Items& items,
+                             const typename Router::Guard& guard) {
+    static_assert(std::ranges::random_access_range<const Items>,
+                  "items must be a random access range");
+    thread_local BatchPlan plan;
+    const std::size_t size = std::ranges::size(items);
+    plan.partitions.resize(size);
+    plan.order.resize(size);
+    plan.offsets.assign(partition_count() + 1, 0);
+    for (std::size_t i = 0; i < size; ++i) {
+      const auto& key = std::get<0>(items[i]);
+      const std::size_t index = guard.route(key, partitionIndex(key));
+      router_.sample(key, index);
+      plan.partitions[i] = static_cast<std::uint32_t>(index);
+      ++plan.offsets[index + 1];
+    }
+    for (std::size_t i = 0; i < partition_count(); ++i) {
+      plan.offsets[i + 1] += plan.offsets[i];
+    }
+    plan.next.assign(plan.offsets.begin(), plan.offsets.end() - 1);
+    for (std::size_t i = 0; i < size; ++i) {
+      plan.order[plan.next[plan.partitions[i]]++] =
+          static_cast<std::uint32_t>(i);
+    }
+    return plan;
+  }
+
+  // Every partition is allocated on its own, by the thread constructing it,
+  // see the constructor. The pointers are stored inline, or in a heap array
+  // whose size is chosen at construction with kDynamicPartitions.
+  using Storage =
+      std::conditional_t<kDynamic, std::unique_ptr<Partition*[]>,
+                         std::array<Partition*, N_PARTITIONS>>;
+
+  static std::size_t partitionCount(const ProactorOptions& options) {
+    if constexpr (kDynamic) {
+      if (options.partitions != 0) {
+        return options.partitions;
+      }
+      const CoreInfo cores = getCoreInfo();
+      return std::max(cores.performanceCores + cores.efficiencyCores, 1);
+    } else {
+      assert(options.partitions == 0 || options.partitions == N_PARTITIONS);
+      return N_PARTITIONS;
+    }
+  }
+
+  static Storage makeStorage(std::size_t partitions) {
+    if constexpr (kDynamic) {
+      return std::make_unique<Partition*[]>(partitions);
+    } else {
+      return {};
+    }
+  }
+
+  static ConflationTables makeConflationTables(std::size_t partitions) {
+    if constexpr (TRAITS::kConflation) {
+      return std::make_unique<
+          typename Partition::template Conflation<KEY, HASH_POLICY>[]>(
+          partitions);
+    } else {
+      return {};
+    }
+  }
+
+  Partition& partition(std::size_t i) { return *partitions_[i]; }
+
+  const Partition& partition(std::size_t i) const { return *partitions_[i]; }
+
+  PerPartition<N_PARTITIONS, typename Partition::DrainMark> drainMarks() {
+    auto marks = makePerPartition<N_PARTITIONS, typename Partition::DrainMark>(
+        partition_count());
+    for (std::size_t i = 0; i < partition_count(); ++i) {
+      marks[i] = partition(i).drainMark();
+    }
+    return marks;
+  }
+
+  void waitDrained(
+      const PerPartition<N_PARTITIONS, typename Partition::DrainMark>& marks) {
+    for (std::size_t i = 0; i < partition_count(); ++i) {
+      partition(i).waitDrained(marks[i]);
+    }
+  }
+
+  bool owns(const Partition* partition) {
+    return partition->index() < partition_count() &&
+           partitions_[partition->index()] == partition;
+  }
+
+  HASH_POLICY hash_policy;
+  // Only read with kDynamicPartitions, see 'partition_count()'.
+  const std::size_t partition_count_;
+  [[no_unique_address]] Router router_;
+  // The pending updates of 'process_latest()', indexed by partition.
+  [[no_unique_address]] ConflationTables conflation_;
+  // Wakes up the threads parked in 'wait_completions()'.
+  EventCount completion_signal_;
+  Storage partitions_;
+
   static_assert(N_PARTITIONS > 0, "N_PARTITIONS must be greater than 0");
   static_assert(std::is_invocable_v<HASH_POLICY, KEY>,
                 "HASH_POLICY must be callable with KEY");
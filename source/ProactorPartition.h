@@ -1,122 +1,1807 @@
 #ifndef PROACTORPARTITION_H
 #define PROACTORPARTITION_H
 
-#include <folly/MPMCQueue.h>
-
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <deque>
 #include <functional>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
 #include <sstream>
+#include <string>
 #include <thread>
+#include <tuple>
 #include <utility>
 
-#include "AdaptiveSleeper.h"
+#include "CacheLine.h"
+#include "ChaseLevDeque.h"
+#include "ConflationTable.h"
+#include "InlineTask.h"
+#include "PartitionArena.h"
+#include "PartitionMetrics.h"
+#include "ProactorTraits.h"
+#include "SPSCQueue.h"
 #include "ThreadAffinity.h"
+#include "TimerWheel.h"
+#include "Tracing.h"
+#include "WaitPolicy.h"
 
 namespace mbucko {
 
-template <typename COMPUTABLE>
+template <typename COMPUTABLE, typename TRAITS = DefaultProactorTraits>
 class ProactorPartition {
  private:
-  using Function = std::function<void(COMPUTABLE*)>;
+  using Task = InlineTask<void(ProactorPartition&), TRAITS::kTaskCapacity,
+                          TRAITS::kTaskHeapFallback>;
+  using Completion = InlineTask<void(), TRAITS::kCompletionCapacity,
+                                TRAITS::kTaskHeapFallback>;
+
+  static constexpr bool kDeferredCompletions =
+      TRAITS::kCompletionMode == CompletionMode::kDeferred;
+
+  // Completions of a partition in CompletionMode::kDeferred. Only the
+  // partition thread writes to the ring; pollers take turns reading it. When
+  // the ring is full, completions wait in 'overflow', which only the
+  // partition thread touches, so that the partition never blocks.
+  struct DeferredCompletions {
+    DeferredCompletions(std::size_t capacity, EventCount& signal)
+        : ring(capacity), signal(signal) {}
+
+    SPSCQueue<Completion> ring;
+    // Shared by all partitions of the Proactor: wakes up the pollers parked
+    // in 'Proactor::wait_completions()'.
+    EventCount& signal;
+    // The number of completions written to 'ring' when 'signal' was last
+    // notified. Only touched by the partition thread.
+    std::size_t signalled = 0;
+    std::deque<Completion> overflow;
+    std::atomic_flag polling;
+    // Whether 'overflow' holds completions, so that pollers wake up the
+    // partition, parked while the ring is full, once they made room.
+    std::atomic<bool> overflowing{false};
+  };
+
+  struct NoCompletions {
+    NoCompletions(std::size_t, EventCount&) {}
+  };
+
+  using Queue = typename TRAITS::QueuePolicy::template Queue<Task>;
+
+  // The position of 'queue' at some point, see 'drainMark()': a write count
+  // for queues that are FIFO across producers, or whatever position the
+  // queue defines otherwise.
+  static auto writeMark(const Queue& queue) {
+    if constexpr (requires { queue.writeMark(); }) {
+      return queue.writeMark();
+    } else {
+      return queue.writeCount();
+    }
+  }
+
+  // Whether every task written to 'queue' before 'mark' was taken has been
+  // read.
+  template <typename Mark>
+  static bool readPast(const Queue& queue, const Mark& mark) {
+    if constexpr (requires { queue.readPast(mark); }) {
+      return queue.readPast(mark);
+    } else {
+      return queue.readCount() >= mark;
+    }
+  }
+
+  static constexpr std::size_t kPriorityLanes = TRAITS::kPriorityLanes;
+  static_assert(kPriorityLanes >= 1 && kPriorityLanes <= 4,
+                "kPriorityLanes must be between 1 and 4");
+
+  // The lanes above Priority::kNormal, whose tasks are in 'queue_', and the
+  // state of the anti-starvation budget. Only the partition thread touches
+  // 'streak' and 'turn'.
+  struct PriorityLanes {
+    template <std::size_t... I>
+    PriorityLanes(std::size_t capacity, std::index_sequence<I...>)
+        : queues{Queue((static_cast<void>(I), capacity))...} {}
+
+    explicit PriorityLanes(std::size_t capacity)
+        : PriorityLanes(capacity,
+                        std::make_index_sequence<kPriorityLanes - 1>()) {}
+
+    std::array<Queue, kPriorityLanes - 1> queues;
+    std::size_t streak = 0;
+    std::size_t turn = 0;
+    // The lane the running batch was read from.
+    std::size_t current = 0;
+  };
+
+  struct NoPriorityLanes {
+    explicit NoPriorityLanes(std::size_t) {}
+  };
+
+  static constexpr bool kWorkStealing = TRAITS::kWorkStealing;
+
+  // An unkeyed job in a slot owned by the partition it was submitted to.
+  // Once run, a slot returns to its owner: directly, or through the owner's
+  // 'returned' list if it was stolen.
+  struct JobSlot {
+    Task job;
+    JobSlot* next = nullptr;
+    ProactorPartition* owner = nullptr;
+  };
+
+  // Unkeyed jobs of a partition with TRAITS::kWorkStealing. Jobs submitted
+  // by other threads arrive through 'inject'. The partition moves them into
+  // free slots and pushes the slots onto 'deque', from which it pops them
+  // and idle siblings steal them. Only the partition thread touches 'free'
+  // and the 'next_*' cursors.
+  struct Jobs {
+    Jobs(std::size_t capacity, ProactorPartition* owner)
+        : inject(capacity),
+          deque(TRAITS::kStealCapacity),
+          slots(std::make_unique<JobSlot[]>(deque.capacity())) {
+      for (std::size_t i = 0; i < deque.capacity(); ++i) {
+        slots[i].owner = owner;
+        slots[i].next = free;
+        free = &slots[i];
+      }
+    }
+
+    Queue inject;
+    ChaseLevDeque<JobSlot*> deque;
+    std::unique_ptr<JobSlot[]> slots;
+    JobSlot* free = nullptr;
+    alignas(kCacheLineSize) std::atomic<JobSlot*> returned{nullptr};
+    std::atomic<ProactorPartition* const*> siblings{nullptr};
+    std::size_t sibling_count = 0;
+    std::size_t next_victim = 0;
+    std::size_t next_wake = 0;
+  };
+
+  struct NoJobs {
+    NoJobs(std::size_t, ProactorPartition*) {}
+  };
+
+  static constexpr bool kTimers = TRAITS::kTimers;
+  static constexpr bool kMetrics = TRAITS::kMetrics;
+  static constexpr bool kTracing = TRAITS::kTracing;
+  static constexpr bool kAdmission = TRAITS::AdmissionPolicy::kEnabled;
+  static constexpr SelfDispatch kSelfDispatch = TRAITS::kSelfDispatch;
+  static constexpr bool kLocalTasks = kSelfDispatch == SelfDispatch::kLocal;
+  using Clock = std::chrono::steady_clock;
+
+  // Timer slot states: the generation of the slot, bumped every time the
+  // slot is freed, and its status. Producers allocate a slot (pending), the
+  // partition schedules it (armed), then it either fires or gets cancelled
+  // by any thread (done).
+  static constexpr std::uint64_t kTimerFree = 0;
+  static constexpr std::uint64_t kTimerPending = 1;
+  static constexpr std::uint64_t kTimerArmed = 2;
+  static constexpr std::uint64_t kTimerDone = 3;
+  static constexpr std::uint64_t kTimerStatusMask = 3;
+
+  struct TimerSlot : TimerNode {
+    Task task;
+    std::uint64_t period = 0;
+    std::atomic<std::uint64_t> state{kTimerFree};
+    std::atomic<std::uint32_t> next_free{0};
+    TimerSlot* next_cancelled = nullptr;
+  };
+
+  // Timers of a partition with TRAITS::kTimers. Producers take slots from
+  // 'free_head', a lock-free stack of slot indices plus one, tagged against
+  // ABA in the upper 32 bits, which only the partition pushes to. Cancelled
+  // armed timers are pushed onto 'cancelled' for the partition to unlink.
+  // Only the partition thread touches the wheel.
+  struct Timers {
+    Timers()
+        : slots(std::make_unique<TimerSlot[]>(TRAITS::kTimerCapacity)),
+          free_head(TRAITS::kTimerCapacity == 0 ? 0 : 1) {
+      for (std::size_t i = 0; i + 1 < TRAITS::kTimerCapacity; ++i) {
+        slots[i].next_free.store(static_cast<std::uint32_t>(i + 2),
+                                 std::memory_order_relaxed);
+      }
+    }
+
+    std::unique_ptr<TimerSlot[]> slots;
+    TimerWheel wheel;
+    const Clock::time_point epoch = Clock::now();
+    alignas(kCacheLineSize) std::atomic<std::uint64_t> free_head;
+    alignas(kCacheLineSize) std::atomic<TimerSlot*> cancelled{nullptr};
+  };
+
+  struct NoTimers {};
+
+  struct NoLocalTasks {};
 
  public:
+  /// Creates a partition whose thread is pinned to 'cpu', or not pinned if
+  /// 'cpu' is negative, and which reports the crossings of 'watermarks'.
   template <typename... Args>
-  ProactorPartition(std::size_t capacity, std::size_t partition_index,
+  ProactorPartition(std::size_t capacity, std::size_t partition_index, int cpu,
+                    const Watermarks& watermarks, EventCount& completion_signal,
                     const Args&... args)
       : partition_index_(partition_index),
-        computable_(args...),
+        computable_(makeComputable(args...)),
         queue_(capacity),
+        lanes_(capacity),
+        completions_(capacity, completion_signal),
+        jobs_(capacity, this),
+        watermarks_(watermarks),
         running_(true),
         thread_(&ProactorPartition::processQueue, this) {
-    setThreadAffinity(thread_, partition_index_);
+    if (cpu >= 0) {
+      setThreadAffinity(thread_, cpu);
+    }
   }
 
   ~ProactorPartition() { stop(); }
 
+  /// The positions of all lanes' queues at some point, see 'drainMark()'.
+  using DrainMark =
+      std::array<decltype(writeMark(std::declval<const Queue&>())),
+                 kPriorityLanes>;
+
+  /// Enqueues a task calling callback(func(args...)), blocking until space in
+  /// the queue becomes available. Called from this partition's own thread,
+  /// the task is taken as TRAITS::kSelfDispatch says, here and in the other
+  /// 'process()', 'try_process()' and 'process_until()' overloads.
   template <typename MemberFunc, typename Callback, typename... Args>
   void process(MemberFunc func, Callback&& callback, Args&&... args) {
+    if (dispatchesLocally()) {
+      dispatchLocally(makeTask(func, std::forward<Callback>(callback),
+                               std::forward<Args>(args)...));
+      return;
+    }
+    enqueue(queue_,
+            traced(timed(makeTask(func, std::forward<Callback>(callback),
+                                  std::forward<Args>(args)...))));
+    enqueued();
+  }
+
+  template <typename MemberFunc, typename Callback, typename... Args>
+  bool try_process(MemberFunc func, Callback&& callback, Args&&... args) {
+    if (dispatchesLocally()) {
+      dispatchLocally(makeTask(func, std::forward<Callback>(callback),
+                               std::forward<Args>(args)...));
+      return true;
+    }
+    if (!admit() ||
+        !queue_.writeIfNotFull(
+            traced(timed(makeTask(func, std::forward<Callback>(callback),
+                                  std::forward<Args>(args)...))))) {
+      return false;
+    }
+    enqueued();
+    return true;
+  }
+
+  /// Same as 'process()', in the lane of 'priority'.
+  template <typename MemberFunc, typename Callback, typename... Args>
+  void process(Priority priority, MemberFunc func, Callback&& callback,
+               Args&&... args) {
+    if (dispatchesLocally()) {
+      dispatchLocally(makeTask(func, std::forward<Callback>(callback),
+                               std::forward<Args>(args)...));
+      return;
+    }
+    enqueue(lane(priority),
+            traced(timed(makeTask(func, std::forward<Callback>(callback),
+                                  std::forward<Args>(args)...))));
+    enqueued();
+  }
+
+  /// Same as 'try_process()', in the lane of 'priority'. Only the lane of
+  /// Priority::kNormal is subject to the AdmissionPolicy.
+  template <typename MemberFunc, typename Callback, typename... Args>
+  bool try_process(Priority priority, MemberFunc func, Callback&& callback,
+                   Args&&... args) {
+    if (dispatchesLocally()) {
+      dispatchLocally(makeTask(func, std::forward<Callback>(callback),
+                               std::forward<Args>(args)...));
+      return true;
+    }
+    Queue& queue = lane(priority);
+    if ((&queue == &queue_ && !admit()) ||
+        !queue.writeIfNotFull(
+            traced(timed(makeTask(func, std::forward<Callback>(callback),
+                                  std::forward<Args>(args)...))))) {
+      return false;
+    }
+    enqueued();
+    return true;
+  }
+
+  /// Same as 'process()', but gives up once 'deadline' has passed while the
+  /// queue is full, or right away if the AdmissionPolicy rejects the task.
+  /// Returns whether the task was enqueued.
+  template <typename MemberFunc, typename Callback, typename... Args>
+  bool process_until(Clock::time_point deadline, MemberFunc func,
+                     Callback&& callback, Args&&... args) {
+    if (dispatchesLocally()) {
+      dispatchLocally(makeTask(func, std::forward<Callback>(callback),
+                               std::forward<Args>(args)...));
+      return true;
+    }
+    if (!admit() ||
+        !enqueueUntil(deadline,
+                      traced(timed(makeTask(func,
+                                            std::forward<Callback>(callback),
+                                            std::forward<Args>(args)...))))) {
+      return false;
+    }
+    enqueued();
+    return true;
+  }
+
+  /// The conflated updates of a partition, keyed by KEY.
+  template <typename KEY, typename HASH_POLICY>
+  using Conflation = ConflationTable<KEY, HASH_POLICY, Task>;
+
+  /// Makes a task calling callback(func(args...)) the pending update of
+  /// 'key' in 'table', and enqueues a task running it unless one is already
+  /// queued for 'key', blocking until space in the queue becomes available.
+  /// A pending update made by the same func, callback and argument types is
+  /// merged into with combine(pending_args..., args...), 'args' being passed
+  /// as rvalues of their decayed types, and keeps its callback, unless
+  /// 'combine' is nullptr; any other pending update is replaced. See
+  /// 'Proactor::process_latest()'.
+  template <typename Table, typename Key, typename Combine,
+            typename MemberFunc, typename Callback, typename... Args>
+  void process_latest(Table& table, const Key& key, std::size_t hash,
+                      Combine&& combine, MemberFunc func, Callback&& callback,
+                      Args&&... args) {
+    using Pending =
+        Update<MemberFunc, std::decay_t<Callback>, std::decay_t<Args>...>;
+    typename Table::Slot* slot = table.update(key, hash, [&](Task& task) {
+      if constexpr (!std::is_null_pointer_v<std::decay_t<Combine>>) {
+        if (Pending* pending = task.template target<Pending>()) {
+          std::apply(
+              [&](auto&... pending_args) {
+                // Decayed copies, so that 'combine' may take them as
+                // rvalues whatever the caller passed.
+                combine(pending_args...,
+                        std::decay_t<Args>(std::forward<Args>(args))...);
+              },
+              pending->args);
+          return;
+        }
+      }
+      task = Pending{func, std::forward<Callback>(callback),
+                     {std::forward<Args>(args)...}};
+    });
+    if (slot == nullptr) {
+      return;
+    }
+    auto run = [slot](ProactorPartition& partition) {
+      Table::take(*slot)(partition);
+    };
+    if (dispatchesLocally()) {
+      dispatchLocally(run);
+      return;
+    }
+    enqueue(queue_, traced(timed(run)));
+    enqueued();
+  }
+
+  /// Calls callback(func(args...)) on this partition's thread once 'delay'
+  /// has elapsed, with no locking when it fires. Called from another
+  /// thread, arming the timer takes one hop through the queue, and blocks
+  /// until space in the queue becomes available. Blocks while all
+  /// TRAITS::kTimerCapacity timers are in use, except on this partition's
+  /// own thread, where it returns an invalid handle instead. Requires
+  /// TRAITS::kTimers.
+  template <typename MemberFunc, typename Callback, typename... Args>
+  TimerHandle process_after(std::chrono::nanoseconds delay, MemberFunc func,
+                            Callback&& callback, Args&&... args) {
+    return armTimer(delay, std::chrono::nanoseconds::zero(),
+                    makeTask(func, std::forward<Callback>(callback),
+                             std::forward<Args>(args)...));
+  }
+
+  /// Same as 'process_after()', but calls callback(func(args...)) every
+  /// 'period' until cancelled, starting one period from now. The callback
+  /// and arguments are copied for every call. Periods are measured from
+  /// the previous deadline, so they do not drift.
+  template <typename MemberFunc, typename Callback, typename... Args>
+  TimerHandle process_every(std::chrono::nanoseconds period, MemberFunc func,
+                            Callback&& callback, Args&&... args) {
+    return armTimer(period, period,
+                    makeRepeatingTask(func, std::forward<Callback>(callback),
+                                      std::forward<Args>(args)...));
+  }
+
+  /// Cancels a timer of this partition in O(1), from any thread. Returns
+  /// false if the timer already fired, was already cancelled, or if it is a
+  /// one-shot timer whose callback is running.
+  bool cancel_timer(const TimerHandle& handle) {
+    static_assert(kTimers, "timers require TRAITS::kTimers");
+    if (!handle.valid()) {
+      return false;
+    }
+    TimerSlot& slot = timers_.slots[handle.slot];
+    std::uint64_t state = slot.state.load(std::memory_order_acquire);
+    while (timerGeneration(state) == handle.generation) {
+      const std::uint64_t status = state & kTimerStatusMask;
+      if (status != kTimerPending && status != kTimerArmed) {
+        return false;
+      }
+      if (slot.state.compare_exchange_weak(
+              state, timerState(handle.generation, kTimerDone),
+              std::memory_order_acq_rel, std::memory_order_acquire)) {
+        // A pending timer is freed by the partition when it gets to
+        // schedule it; an armed one must be unlinked from the wheel.
+        if (status == kTimerArmed) {
+          slot.next_cancelled =
+              timers_.cancelled.load(std::memory_order_relaxed);
+          while (!timers_.cancelled.compare_exchange_weak(
+              slot.next_cancelled, &slot, std::memory_order_release,
+              std::memory_order_relaxed)) {
+          }
+          wait_policy_.notify();
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Returns the current write positions of the partition's queues, for
+  /// 'waitDrained()'. Never blocks, and enqueues nothing.
+  DrainMark drainMark() const {
+    DrainMark mark;
+    mark[0] = writeMark(queue_);
+    if constexpr (kPriorityLanes > 1) {
+      for (std::size_t i = 1; i < kPriorityLanes; ++i) {
+        mark[i] = writeMark(lanes_.queues[i - 1]);
+      }
+    }
+    return mark;
+  }
+
+  /// Waits until the partition ran every task that was in its queues when
+  /// 'mark' was taken, or until its thread exited. Must not be called from
+  /// the partition thread.
+  void waitDrained(const DrainMark& mark) const {
+    const auto exited = [this]() {
+      return worker_exited_.load(std::memory_order_acquire);
+    };
+    while (!readPastAll(mark)) {
+      if (exited()) {
+        return;
+      }
+      epoch_closed_.wait([&]() { return readPastAll(mark) || exited(); });
+    }
+    // The tasks were read while the epoch was odd, at this value or
+    // earlier, see 'readEpochBatch()'. They ran once it moves on.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const std::uint64_t epoch = epoch_.load(std::memory_order_acquire);
+    if (epoch % 2 == 1) {
+      const auto moved_on = [&]() {
+        return epoch_.load(std::memory_order_acquire) != epoch || exited();
+      };
+      while (!moved_on()) {
+        epoch_closed_.wait(moved_on);
+      }
+    }
+  }
+
+  /// Returns the partition whose worker thread is the calling thread, or
+  /// nullptr if the calling thread is not a partition thread.
+  static ProactorPartition* current() { return current_; }
+
+  /// Returns the index of the partition in its Proactor.
+  std::size_t index() const { return partition_index_; }
+
+  /// Returns the memory resource of the partition, which only the partition
+  /// thread may allocate from, see PartitionArena. A COMPUTABLE that uses
+  /// a std::pmr::polymorphic_allocator (it defines 'allocator_type') is
+  /// constructed with it, following the uses-allocator convention.
+  PartitionArena& arena() { return *arena_; }
+
+  /// Returns the current metrics of the partition, without locking.
+  /// Requires TRAITS::kMetrics.
+  MetricsSnapshot metrics() const {
+    static_assert(kMetrics, "metrics() requires TRAITS::kMetrics");
+    MetricsSnapshot snapshot = metrics_.snapshot();
+    snapshot.queue_depth = queueDepth();
+    return snapshot;
+  }
+
+  /// Makes the partitions *siblings[0] .. *siblings[count - 1], which
+  /// include this one, steal jobs from each other. The array must outlive
+  /// the partition. Requires TRAITS::kWorkStealing.
+  void setSiblings(ProactorPartition* const* siblings, std::size_t count) {
+    jobs_.sibling_count = count;
+    jobs_.siblings.store(siblings, std::memory_order_release);
+  }
+
+  /// Enqueues an unkeyed job calling callback(func()), which this partition
+  /// or an idle sibling runs. Called from this partition's own thread, the
+  /// job goes straight onto the partition's work-stealing deque, and runs
+  /// inline if the deque and the inject queue are full. Otherwise, blocks
+  /// until space in the inject queue becomes available. Requires
+  /// TRAITS::kWorkStealing.
+  template <typename Func, typename Callback>
+  void submit(Func&& func, Callback&& callback) {
+    static_assert(kWorkStealing, "submit() requires TRAITS::kWorkStealing");
+    auto job =
+        makeJob(std::forward<Func>(func), std::forward<Callback>(callback));
+    if (current_ != this) {
+      enqueue(jobs_.inject, std::move(job));
+      wait_policy_.notify();
+      return;
+    }
+    reclaimJobSlots();
+    if (JobSlot* slot = jobs_.free) {
+      jobs_.free = slot->next;
+      slot->job = std::move(job);
+      jobs_.deque.push(slot);
+      wakeThief();
+    } else if (!jobs_.inject.writeIfNotFull(std::move(job))) {
+      job(*this);
+    }
+  }
+
+  /// Enqueues a closure to be called with this partition's COMPUTABLE,
+  /// blocking until space in the queue becomes available.
+  template <typename Closure>
+  void process_task(Closure&& closure) {
+    auto task = [closure = std::forward<Closure>(closure)](
+                    ProactorPartition& partition) mutable {
+      closure(partition.computable_);
+    };
+    if (dispatchesLocally()) {
+      dispatchLocally(std::move(task));
+      return;
+    }
+    enqueue(queue_, std::move(task));
+    enqueued();
+  }
+
+  /// Enqueues this partition's share of a broadcast if the queue of the lane
+  /// of 'priority' is not full. On success, the partition owns one reference
+  /// to 'task', which is released by 'task->complete(partition_index,
+  /// result...)'.
+  template <typename Broadcast>
+  bool try_process_broadcast(Broadcast* task,
+                             Priority priority = Priority::kNormal) {
+    auto closure = [task](ProactorPartition& partition) {
+      auto finish = [task, index = partition.partition_index_](
+                        auto&&... result) {
+        task->complete(index, std::forward<decltype(result)>(result)...);
+      };
+      if constexpr (std::is_void_v<decltype(task->invoke(
+                        &partition.computable_))>) {
+        task->invoke(&partition.computable_);
+        partition.complete(finish);
+      } else {
+        auto result = task->invoke(&partition.computable_);
+        partition.complete(finish, std::move(result));
+      }
+    };
+    if (dispatchesLocally()) {
+      dispatchLocally(std::move(closure));
+      return true;
+    }
+    if (!lane(priority).writeIfNotFull(std::move(closure))) {
+      return false;
+    }
+    enqueued();
+    return true;
+  }
+
+  /// Enqueues one task per entry of 'indices', each calling func with the
+  /// arguments of items[indices[i]], where every item is a tuple-like
+  /// (key, args...) whose key is ignored. Blocks until all tasks are
+  /// enqueued.
+  template <typename MemberFunc, typename Callback, typename Items>
+  void process_batch(MemberFunc func, const Callback& callback,
+                     const Items& items, const std::uint32_t* indices,
+                     std::size_t count) {
+    if (dispatchesLocally()) {
+      dispatchItemsLocally(func, callback, items, indices, count);
+      return;
+    }
+    auto generator = [&](std::size_t i) {
+      return makeItemTask(func, callback, items[indices[i]]);
+    };
+    if constexpr (requires { queue_.writeBatch(count, generator); }) {
+      std::size_t written = queue_.writeBatch(count, generator);
+      while (written < count) {
+        wait_policy_.notify();
+        std::this_thread::yield();
+        written += queue_.writeBatch(count - written, [&](std::size_t i) {
+          return generator(written + i);
+        });
+      }
+    } else {
+      for (std::size_t i = 0; i < count; ++i) {
+        enqueue(queue_, generator(i));
+      }
+    }
+    enqueued();
+  }
+
+  /// Like process_batch(), but enqueues only as many tasks as currently fit
+  /// and returns that number, or 0 if the AdmissionPolicy rejects the batch.
+  /// The tasks accepted are always a prefix of 'indices'.
+  template <typename MemberFunc, typename Callback, typename Items>
+  std::size_t try_process_batch(MemberFunc func, const Callback& callback,
+                                const Items& items,
+                                const std::uint32_t* indices,
+                                std::size_t count) {
+    if (dispatchesLocally()) {
+      dispatchItemsLocally(func, callback, items, indices, count);
+      return count;
+    }
+    auto generator = [&](std::size_t i) {
+      return makeItemTask(func, callback, items[indices[i]]);
+    };
+    if (!admit()) {
+      return 0;
+    }
+    std::size_t written = 0;
+    if constexpr (requires { queue_.writeBatch(count, generator); }) {
+      written = queue_.writeBatch(count, generator);
+    } else {
+      while (written < count && queue_.writeIfNotFull(generator(written))) {
+        ++written;
+      }
+    }
+    if (written != 0) {
+      enqueued();
+    }
+    return written;
+  }
+
+  /// Runs up to 'max' completion callbacks of this partition on the calling
+  /// thread and returns how many were run. Returns 0 without waiting if
+  /// another thread is polling this partition. CompletionMode::kDeferred
+  /// only.
+  std::size_t poll_completions(std::size_t max) {
+    static_assert(kDeferredCompletions,
+                  "poll_completions() requires CompletionMode::kDeferred");
+    if (completions_.polling.test_and_set(std::memory_order_acquire)) {
+      return 0;
+    }
+    std::size_t count = 0;
+    Completion completion;
+    while (count < max && completions_.ring.read(completion)) {
+      completion();
+      completion.reset();
+      ++count;
+    }
+    if (count != 0) {
+      // Pairs with the fence in the partition's 'idle()': either the
+      // partition sees the room made, or this sees it overflowing.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (completions_.overflowing.load(std::memory_order_relaxed)) {
+        wait_policy_.notify();
+      }
+    }
+    // Once the worker has exited, nothing else drains the overflow.
+    if (worker_exited_.load(std::memory_order_acquire)) {
+      while (count < max && !completions_.overflow.empty()) {
+        completions_.overflow.front()();
+        completions_.overflow.pop_front();
+        ++count;
+      }
+    }
+    completions_.polling.clear(std::memory_order_release);
+    return count;
+  }
+
+  /// Whether completions are ready for 'poll_completions()'.
+  /// CompletionMode::kDeferred only.
+  bool has_completions() const { return !completions_.ring.isEmpty(); }
+
+  void processQueue() {
+    current_ = this;
+    PartitionArena::setLocal(arena_.get());
+    if constexpr (kTracing) {
+      setTraceThreadName("partition " + std::to_string(partition_index_));
+    }
+    Task batch[kBatchSize];
+    while (true) {
+      std::size_t count;
+      while (!discarding() && (count = readEpochBatch(batch)) != 0)
+          [[likely]] {
+        if constexpr (kTracing) {
+          dequeued_ = traceTimestamp();
+        }
+        runBatch(batch, count);
+        // Within the epoch, so that 'waitDrained()' covers the local tasks
+        // of the batch.
+        runLocalTasks(batch);
+        closeEpochUnlessLocalTasks();
+        runJobs();
+        runTimers();
+        flushCompletions();
+        wait_policy_.reset();
+      }
+
+      if (discarding()) [[unlikely]] {
+        break;
+      }
+
+      const bool ran_local_tasks = runLocalTasks(batch);
+      if (ran_local_tasks) {
+        closeEpochUnlessLocalTasks();
+      }
+      if (ran_local_tasks || runJobs() || stealJob() || runTimers()) {
+        flushCompletions();
+        wait_policy_.reset();
+        continue;
+      }
+
+      [[unlikely]] if (!running_) {
+        // Every task enqueued before 'stop()' is visible now, including any
+        // enqueued after the last read.
+        if (hasTasks()) {
+          continue;
+        }
+        break;
+      }
+
+      flushCompletions();
+      idle();
+    }
+    worker_exited_.store(true, std::memory_order_release);
+    epoch_closed_.notify();
+  }
+
+  /// Stops the partition thread, see DrainPolicy, and waits for it to exit.
+  void stop(DrainPolicy policy = DrainPolicy::kDrain) noexcept {
+    requestStop(policy);
+    join();
+  }
+
+  /// Tells the partition thread to exit once it has drained its queues, or
+  /// after its current batch with DrainPolicy::kDiscard, without waiting.
+  /// DrainPolicy::kQuiesce is the same as kDrain for a single partition.
+  void requestStop(DrainPolicy policy) noexcept {
+    if (policy == DrainPolicy::kDiscard) {
+      discard_.store(true, std::memory_order_relaxed);
+    }
+    running_ = false;
+    wait_policy_.notify();
+  }
+
+  /// Waits for the partition thread to exit, see 'requestStop()'. The
+  /// first caller joins the thread, and concurrent callers wait for it.
+  void join() noexcept {
+    if (joining_.test_and_set()) {
+      joined_.wait(false);
+      return;
+    }
+    if (thread_.joinable()) {
+      try {
+        thread_.join();
+      } catch (...) {
+        std::ostringstream oss;
+        oss << "Error: Failed to join worker thread (Partition: "
+            << partition_index_ << ", Thread ID: " << thread_.get_id()
+            << ").";
+        std::cerr << oss.str() << std::endl;
+      }
+    }
+    joined_.test_and_set();
+    joined_.notify_all();
+  }
+
+ private:
+  static constexpr std::size_t kBatchSize = TRAITS::kBatchSize;
+  static_assert(kBatchSize > 0, "kBatchSize must be greater than 0");
+
+  // Returns the queue of the lane of 'priority'.
+  Queue& lane(Priority priority) {
+    if constexpr (kPriorityLanes > 1) {
+      const std::size_t index =
+          std::min(static_cast<std::size_t>(priority), kPriorityLanes - 1);
+      if (index != 0) {
+        return lanes_.queues[index - 1];
+      }
+    }
+    return queue_;
+  }
+
+  Queue& lane(std::size_t index) {
+    return lane(static_cast<Priority>(index));
+  }
+
+  bool hasTasks() const {
+    if constexpr (kPriorityLanes > 1) {
+      for (const Queue& queue : lanes_.queues) {
+        if (!queue.isEmpty()) {
+          return true;
+        }
+      }
+    }
+    return !queue_.isEmpty();
+  }
+
+  // Dequeues up to kBatchSize tasks from the highest non-empty lane. Once
+  // higher lanes have been served kPriorityBudget times in a row while a
+  // lower lane had tasks, the lower lanes get one batch, in turn.
+  std::size_t readBatch(Task* batch) {
+    if constexpr (kPriorityLanes > 1) {
+      if (lanes_.streak >= TRAITS::kPriorityBudget) {
+        lanes_.streak = 0;
+        for (std::size_t n = 0; n < kPriorityLanes - 1; ++n) {
+          const std::size_t index = (lanes_.turn + n) % (kPriorityLanes - 1);
+          if (const std::size_t count = readLane(lane(index), batch)) {
+            lanes_.turn = index + 1;
+            lanes_.current = index;
+            return count;
+          }
+        }
+      }
+      for (std::size_t index = kPriorityLanes - 1; index > 0; --index) {
+        if (const std::size_t count = readLane(lane(index), batch)) {
+          bool starving = false;
+          for (std::size_t lower = 0; lower < index && !starving; ++lower) {
+            starving = !lane(lower).isEmpty();
+          }
+          lanes_.streak = starving ? lanes_.streak + 1 : 0;
+          lanes_.current = index;
+          return count;
+        }
+      }
+      lanes_.streak = 0;
+      lanes_.current = 0;
+    }
+    return readLane(queue_, batch);
+  }
+
+  // Reads a batch like 'readBatch()', within an odd epoch that lasts until
+  // the batch ran, see 'closeEpoch()'. A thread that sees a read position
+  // move also sees the epoch that read happened in, so 'waitDrained()' only
+  // needs to wait for that epoch to end.
+  std::size_t readEpochBatch(Task* batch) {
+    const std::uint64_t epoch = epoch_.load(std::memory_order_relaxed);
+    // Still open while local tasks of earlier batches are pending, see
+    // 'closeEpochUnlessLocalTasks()'.
+    if (epoch % 2 == 0) {
+      epoch_.store(epoch + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+    const std::size_t count = readBatch(batch);
+    if (count == 0) {
+      closeEpochUnlessLocalTasks();
+    }
+    return count;
+  }
+
+  // Keeps the epoch open while local tasks are pending: 'runLocalTasks()'
+  // leaves those appended by local tasks for later rounds, and the epoch
+  // must cover them until the deque is empty. Local tasks appended by jobs
+  // or timers run outside of any epoch.
+  void closeEpochUnlessLocalTasks() {
+    if constexpr (kLocalTasks) {
+      if (!local_.empty()) {
+        return;
+      }
+    }
+    if (epoch_.load(std::memory_order_relaxed) % 2 == 1) {
+      closeEpoch();
+    }
+  }
+
+  // Also wakes up the threads in 'waitDrained()', which costs a fence unless
+  // one is parked.
+  void closeEpoch() {
+    epoch_.store(epoch_.load(std::memory_order_relaxed) + 1,
+                 std::memory_order_release);
+    epoch_closed_.notify();
+  }
+
+  bool readPastAll(const DrainMark& mark) const {
+    if constexpr (kPriorityLanes > 1) {
+      for (std::size_t i = 1; i < kPriorityLanes; ++i) {
+        if (!readPast(lanes_.queues[i - 1], mark[i])) {
+          return false;
+        }
+      }
+    }
+    return readPast(queue_, mark[0]);
+  }
+
+  bool discarding() const {
+    return discard_.load(std::memory_order_relaxed);
+  }
+
+  // Dequeues up to kBatchSize tasks from one lane, in a single operation if
+  // the queue supports it.
+  static std::size_t readLane(Queue& queue, Task* batch) {
+    if constexpr (requires { queue.readBatch(batch, kBatchSize); }) {
+      return queue.readBatch(batch, kBatchSize);
+    } else {
+      std::size_t count = 0;
+      while (count < kBatchSize && queue.read(batch[count])) {
+        ++count;
+      }
+      return count;
+    }
+  }
+
+  // Executes a batch of tasks back to back. COMPUTABLE may define
+  // 'onBatchBegin()' and 'onBatchEnd()' to amortize work across a batch.
+  void runBatch(Task* batch, std::size_t count) {
+    if constexpr (requires { computable_.onBatchBegin(); }) {
+      computable_.onBatchBegin();
+    }
+    if constexpr (kAdmission) {
+      admission_.beginBatch();
+    }
+    std::uint64_t start = 0;
+    if constexpr (kMetrics) {
+      start = PartitionMetrics::now();
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+      if (i != 0) {
+        runPreemptingTasks(start);
+      }
+      runTask(batch[i], start);
+    }
+    if constexpr (kMetrics) {
+      metrics_.recordBatch(count);
+    }
+    if constexpr (requires { computable_.onBatchEnd(); }) {
+      computable_.onBatchEnd();
+    }
+    if constexpr (kAdmission) {
+      admission_.endBatch(count, depthOf(queue_));
+    }
+    if (watermarks_.high != 0) [[unlikely]] {
+      checkWatermarks();
+    }
+  }
+
+  // Runs one task of a batch. With TRAITS::kMetrics, 'start' is when the
+  // task starts, and becomes when it ended.
+  void runTask(Task& task, [[maybe_unused]] std::uint64_t& start) {
+    if constexpr (kMetrics) {
+      metrics_.startTask(start);
+    }
+    task(*this);
+    task.reset();
+    if constexpr (kMetrics) {
+      const std::uint64_t end = PartitionMetrics::now();
+      metrics_.recordExecution(end - start);
+      start = end;
+    }
+  }
+
+  // With several priority lanes, runs the tasks of the highest lane that
+  // arrived while a batch of a lower lane runs, up to one batch worth, so
+  // that they wait for one task rather than for the rest of the batch.
+  void runPreemptingTasks([[maybe_unused]] std::uint64_t& start) {
+    if constexpr (kPriorityLanes > 1) {
+      if (lanes_.current == kPriorityLanes - 1) {
+        return;
+      }
+      Queue& highest = lane(kPriorityLanes - 1);
+      if (highest.isEmpty()) [[likely]] {
+        return;
+      }
+      [[maybe_unused]] std::uint64_t dequeued;
+      if constexpr (kTracing) {
+        dequeued = dequeued_;
+      }
+      Task task;
+      for (std::size_t n = 0; n < kBatchSize && highest.read(task); ++n) {
+        if constexpr (kTracing) {
+          dequeued_ = traceTimestamp();
+        }
+        runTask(task, start);
+      }
+      if constexpr (kTracing) {
+        dequeued_ = dequeued;
+      }
+    }
+  }
+
+  // Whether a task enqueued now bypasses the queues, see SelfDispatch.
+  bool dispatchesLocally() const {
+    if constexpr (kSelfDispatch == SelfDispatch::kQueue) {
+      return false;
+    } else {
+      return current_ == this;
+    }
+  }
+
+  // Runs 'task' now or appends it to 'local_', see SelfDispatch.
+  template <typename Closure>
+  void dispatchLocally(Closure&& task) {
+    if constexpr (kLocalTasks) {
+      local_.emplace_back(traced(timed(std::forward<Closure>(task))));
+    } else if constexpr (kTracing) {
+      // Untraced, so that its callback does not end the running task.
+      TraceFlowScope scope(0);
+      task(*this);
+    } else {
+      task(*this);
+    }
+  }
+
+  // Same as 'dispatchLocally()' for each item of a batch, see
+  // 'process_batch()'.
+  template <typename MemberFunc, typename Callback, typename Items>
+  void dispatchItemsLocally(MemberFunc func, const Callback& callback,
+                            const Items& items, const std::uint32_t* indices,
+                            std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      std::apply(
+          [&](const auto& /*key*/, const auto&... args) {
+            dispatchLocally(makeTask(func, callback, args...));
+          },
+          items[indices[i]]);
+    }
+  }
+
+  // Runs the tasks in 'local_' in batches, but only those present on entry:
+  // the tasks they append in turn wait for the next call, so that a task
+  // re-appending itself cannot starve the queues. Returns whether it ran
+  // any.
+  bool runLocalTasks(Task* batch) {
+    if constexpr (kLocalTasks) {
+      if (local_.empty()) [[likely]] {
+        return false;
+      }
+      std::size_t pending = local_.size();
+      while (pending != 0 && !discarding()) {
+        std::size_t count = 0;
+        for (; count < kBatchSize && count < pending; ++count) {
+          batch[count] = std::move(local_.front());
+          local_.pop_front();
+        }
+        pending -= count;
+        if constexpr (kTracing) {
+          dequeued_ = traceTimestamp();
+        }
+        runBatch(batch, count);
+      }
+      return true;
+    } else {
+      return false;
+    }
+  }
+
+  // Whether the AdmissionPolicy accepts a task into 'queue_'.
+  bool admit() {
+    if constexpr (kAdmission) {
+      return admission_.admit([this]() { return depthOf(queue_); });
+    } else {
+      return true;
+    }
+  }
+
+  // Called by producers once they enqueued into this partition: wakes up
+  // the partition thread, and reports crossing the high watermark.
+  void enqueued() {
+    wait_policy_.notify();
+    if (watermarks_.high != 0) [[unlikely]] {
+      if (watermark_state_.load(std::memory_order_relaxed) == kBelow) {
+        checkWatermarks();
+      }
+    }
+  }
+
+  // Reports the crossings of the watermarks, with hysteresis between the
+  // high and the low one. A crossing is claimed by a single thread, and
+  // the others skip their checks until its 'on_change' returned, so calls
+  // never overlap. The claiming thread then checks again, so that the
+  // crossings skipped meanwhile are reported.
+  void checkWatermarks() {
+    for (;;) {
+      // Pairs with itself: a thread skipping a check sees the state it
+      // skipped on, and the claiming thread sees the depth it skipped on.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      std::uint8_t state = watermark_state_.load(std::memory_order_relaxed);
+      if (state == kRising || state == kFalling) {
+        return;
+      }
+      const bool high = state == kAbove;
+      const std::size_t depth = queueDepth();
+      if (high ? depth > watermarks_.low : depth < watermarks_.high) {
+        return;
+      }
+      if (!watermark_state_.compare_exchange_strong(
+              state, high ? kFalling : kRising, std::memory_order_acquire,
+              std::memory_order_relaxed)) {
+        return;
+      }
+      watermarks_.on_change(partition_index_, !high);
+      watermark_state_.store(high ? kBelow : kAbove,
+                             std::memory_order_release);
+    }
+  }
+
+  // Writes into 'queue', blocking while it is full. With TRAITS::kMetrics,
+  // accounts for the time spent blocked.
+  template <typename TargetQueue, typename Element>
+  void enqueue(TargetQueue& queue, Element&& element) {
+    if constexpr (kMetrics) {
+      // A failed write leaves 'element' untouched.
+      if (queue.writeIfNotFull(std::forward<Element>(element))) [[likely]] {
+        return;
+      }
+      const std::uint64_t start = PartitionMetrics::now();
+      queue.blockingWrite(std::forward<Element>(element));
+      metrics_.recordBlocked(PartitionMetrics::now() - start);
+    } else {
+      queue.blockingWrite(std::forward<Element>(element));
+    }
+  }
+
+  // Same as 'enqueue()', but gives up once 'deadline' has passed.
+  template <typename Element>
+  bool enqueueUntil(Clock::time_point deadline, Element&& element) {
+    if (queue_.writeIfNotFull(std::forward<Element>(element))) [[likely]] {
+      return true;
+    }
+    [[maybe_unused]] std::uint64_t start;
+    if constexpr (kMetrics) {
+      start = PartitionMetrics::now();
+    }
+    const bool written =
+        queue_.tryWriteUntil(deadline, std::forward<Element>(element));
+    if constexpr (kMetrics) {
+      metrics_.recordBlocked(PartitionMetrics::now() - start);
+    }
+    return written;
+  }
+
+  static std::size_t depthOf(const Queue& queue) {
+    const auto size = queue.sizeGuess();
+    return size > 0 ? static_cast<std::size_t>(size) : 0;
+  }
+
+  std::size_t queueDepth() const {
+    std::size_t depth = 0;
+    if constexpr (kPriorityLanes > 1) {
+      for (const Queue& queue : lanes_.queues) {
+        depth += depthOf(queue);
+      }
+    }
+    return depth + depthOf(queue_);
+  }
+
+  // Binds func, callback and copies of args into a single closure. The
+  // closure is handed to the queue as is, so the Task wrapping it is
+  // constructed in place inside the queue slot without any allocation.
+  template <typename MemberFunc, typename Callback, typename... Args>
+  static auto makeTask(MemberFunc func, Callback&& callback, Args&&... args) {
     static_assert(std::is_member_function_pointer_v<MemberFunc>,
                   "func must be a member function pointer");
     static_assert(std::is_invocable_v<MemberFunc, COMPUTABLE*, Args...>,
                   "Arguments provided to 'process()' function must match the "
                   "parameters of the COMPUTABLE member function");
-    Function task = [func, callback = callback,
-                     ... capturedArgs = args](COMPUTABLE* computable) mutable {
+    return [func, callback = std::forward<Callback>(callback),
+            ... capturedArgs = std::forward<Args>(args)](
+               ProactorPartition& partition) mutable {
+      COMPUTABLE* computable = &partition.computable_;
       if constexpr (std::is_void_v<std::invoke_result_t<MemberFunc, COMPUTABLE*,
                                                         Args...>>) {
         std::invoke(func, computable, std::forward<Args>(capturedArgs)...);
-        callback();
+        partition.complete(callback);
       } else {
         auto result =
             std::invoke(func, computable, std::forward<Args>(capturedArgs)...);
-        callback(std::move(result));
+        partition.complete(callback, std::move(result));
       }
     };
-
-    queue_.blockingWrite(std::move(task));
   }
 
+  // Same as the closure of 'makeTask()', with the arguments kept visible so
+  // that a later update of the same key can be merged into them.
   template <typename MemberFunc, typename Callback, typename... Args>
-  bool try_process(MemberFunc func, Callback&& callback, Args&&... args) {
+  struct Update {
     static_assert(std::is_member_function_pointer_v<MemberFunc>,
                   "func must be a member function pointer");
     static_assert(std::is_invocable_v<MemberFunc, COMPUTABLE*, Args...>,
-                  "Arguments provided to 'process()' function must match the "
-                  "parameters of the COMPUTABLE member function");
-    Function task = [func, callback = callback,
-                     ... capturedArgs = args](COMPUTABLE* computable) mutable {
-      if constexpr (std::is_void_v<std::invoke_result_t<MemberFunc, COMPUTABLE*,
-                                                        Args...>>) {
-        std::invoke(func, computable, std::forward<Args>(capturedArgs)...);
-        callback();
+                  "Arguments provided to 'process_latest()' function must "
+                  "match the parameters of the COMPUTABLE member function");
+
+    MemberFunc func;
+    Callback callback;
+    std::tuple<Args...> args;
+
+    void operator()(ProactorPartition& partition) {
+      COMPUTABLE* computable = &partition.computable_;
+      auto call = [&](Args&... values) {
+        return std::invoke(func, computable, std::move(values)...);
+      };
+      using Result = std::invoke_result_t<MemberFunc, COMPUTABLE*, Args...>;
+      if constexpr (std::is_void_v<Result>) {
+        std::apply(call, args);
+        partition.complete(callback);
       } else {
-        auto result =
-            std::invoke(func, computable, std::forward<Args>(capturedArgs)...);
-        callback(std::move(result));
+        auto result = std::apply(call, args);
+        partition.complete(callback, std::move(result));
       }
+    }
+  };
+
+  // With TRAITS::kMetrics, makes 'task' record the time from now to the
+  // start of its execution into the latency histogram.
+  template <typename Closure>
+  static auto timed(Closure&& task) {
+    if constexpr (kMetrics) {
+      return [task = std::forward<Closure>(task),
+              enqueued = PartitionMetrics::now()](
+                 ProactorPartition& partition) mutable {
+        partition.metrics_.recordLatency(enqueued);
+        task(partition);
+      };
+    } else {
+      return std::forward<Closure>(task);
+    }
+  }
+
+  // With TRAITS::kTracing, records the enqueue of 'task' now, as part of
+  // the current flow or a new one, and makes 'task' record its dequeue and
+  // execution, running as part of that flow.
+  template <typename Closure>
+  auto traced(Closure&& task) {
+    if constexpr (kTracing) {
+      const std::uint64_t flow = traceFlowForEnqueue();
+      traceEvent(TraceEventType::kEnqueue, flow, traceIndex());
+      return [task = std::forward<Closure>(task),
+              flow](ProactorPartition& partition) mutable {
+        const std::uint32_t index = partition.traceIndex();
+        traceRing().record(TraceEventType::kDequeue, flow, index,
+                           partition.dequeued_);
+        traceEvent(TraceEventType::kExecuteBegin, flow, index);
+        TraceFlowScope scope(flow);
+        task(partition);
+      };
+    } else {
+      return std::forward<Closure>(task);
+    }
+  }
+
+  std::uint32_t traceIndex() const {
+    return static_cast<std::uint32_t>(partition_index_);
+  }
+
+  // Runs the callback of a task with its result, or defers it to
+  // 'poll_completions()' in CompletionMode::kDeferred.
+  template <typename Callback, typename... Result>
+  void complete(Callback& callback, Result&&... result) {
+    if constexpr (kTracing) {
+      if (const std::uint64_t flow = currentTraceFlow()) {
+        completeTraced(flow, callback, std::forward<Result>(result)...);
+        return;
+      }
+    }
+    if constexpr (!kDeferredCompletions) {
+      callback(std::forward<Result>(result)...);
+    } else {
+      defer([callback = std::move(callback),
+             ... result = std::forward<Result>(result)]() mutable {
+        callback(std::move(result)...);
+      });
+    }
+  }
+
+  // Same as 'complete()' for a task of 'flow': ends its execution, and
+  // runs the callback as part of the flow, wherever it runs.
+  template <typename Callback, typename... Result>
+  void completeTraced(std::uint64_t flow, Callback& callback,
+                      Result&&... result) {
+    traceEvent(TraceEventType::kExecuteEnd, flow, traceIndex());
+    auto call = [flow, index = traceIndex()](auto& callback,
+                                             auto&&... result) {
+      TraceFlowScope scope(flow);
+      traceEvent(TraceEventType::kCallbackBegin, flow, index);
+      callback(std::forward<decltype(result)>(result)...);
+      traceEvent(TraceEventType::kCallbackEnd, flow, index);
     };
+    if constexpr (!kDeferredCompletions) {
+      call(callback, std::forward<Result>(result)...);
+    } else {
+      defer([call, callback = std::move(callback),
+             ... result = std::forward<Result>(result)]() mutable {
+        call(callback, std::move(result)...);
+      });
+    }
+  }
 
-    return queue_.writeIfNotFull(std::move(task));
+  // Hands a completion over to the pollers, without ever blocking.
+  void defer(Completion&& completion) {
+    if (completions_.overflow.empty() &&
+        completions_.ring.write(std::move(completion))) [[likely]] {
+      return;
+    }
+    if (completions_.overflow.empty()) {
+      completions_.overflowing.store(true, std::memory_order_relaxed);
+    }
+    completions_.overflow.push_back(std::move(completion));
   }
 
-  void processQueue() {
-    Function task;
+  // Moves overflowing completions into the ring as space becomes available.
+  void flushCompletions() {
+    if constexpr (kDeferredCompletions) {
+      auto& overflow = completions_.overflow;
+      while (!overflow.empty() &&
+             completions_.ring.write(std::move(overflow.front()))) {
+        overflow.pop_front();
+      }
+      if (overflow.empty()) {
+        completions_.overflowing.store(false, std::memory_order_relaxed);
+      }
+      // Once per batch rather than per completion, so that busy pollers
+      // cost the partition no more than a load.
+      const std::size_t written = completions_.ring.writeCount();
+      if (written != completions_.signalled) {
+        completions_.signalled = written;
+        completions_.signal.notify();
+      }
+    }
+  }
+
+
+  // Whether overflowing completions can move into the ring. While the ring
+  // is full, the partition parks until a poller makes room and wakes it up.
+  bool canFlushCompletions() const {
+    if constexpr (kDeferredCompletions) {
+      return !completions_.overflow.empty() &&
+             completions_.ring.sizeGuess() < completions_.ring.capacity();
+    } else {
+      return false;
+    }
+  }
+
+  // Waits for work, or until the next timer tick if there are timers.
+  void idle() {
+    const auto has_work = [this]() {
+      return !running_ || hasTasks() || canFlushCompletions() ||
+             hasJobs() || hasCancelledTimers();
+    };
+    [[maybe_unused]] std::uint64_t start;
+    if constexpr (kMetrics) {
+      start = PartitionMetrics::now();
+    }
+    if constexpr (kTimers) {
+      if (!timers_.wheel.empty()) {
+        wait_policy_.wait(has_work, tickTime(timers_.wheel.nextTick()));
+      } else {
+        wait_policy_.wait(has_work);
+      }
+    } else {
+      wait_policy_.wait(has_work);
+    }
+    if constexpr (kMetrics) {
+      metrics_.recordIdle(PartitionMetrics::now() - start);
+    }
+  }
+
+  static constexpr std::uint64_t timerState(std::uint64_t generation,
+                                            std::uint64_t status) {
+    return (generation << 2) | status;
+  }
+
+  static constexpr std::uint32_t timerGeneration(std::uint64_t state) {
+    return static_cast<std::uint32_t>(state >> 2);
+  }
+
+  // The number of whole ticks in 'duration', rounded up.
+  static std::uint64_t ceilTicks(std::chrono::nanoseconds duration) {
+    if (duration <= std::chrono::nanoseconds::zero()) {
+      return 0;
+    }
+    return (duration + TRAITS::kTimerResolution -
+            std::chrono::nanoseconds(1)) /
+           TRAITS::kTimerResolution;
+  }
+
+  std::uint64_t currentTick() const {
+    return (Clock::now() - timers_.epoch) / TRAITS::kTimerResolution;
+  }
+
+  Clock::time_point tickTime(std::uint64_t tick) const {
+    return timers_.epoch + std::chrono::duration_cast<Clock::duration>(
+                               tick * TRAITS::kTimerResolution);
+  }
+
+  // Takes a free timer slot, waiting for one if all are in use. On the
+  // partition thread, which no one else frees slots for, returns nullptr
+  // instead once the cancelled timers are reclaimed and none is free.
+  TimerSlot* allocateTimer() {
+    std::uint64_t head = timers_.free_head.load(std::memory_order_acquire);
     while (true) {
-      while (queue_.read(task)) [[likely]] {
-        task(&computable_);
-        sleeper_.reset();
+      const std::uint32_t index = static_cast<std::uint32_t>(head);
+      if (index == 0) {
+        if (current_ == this) {
+          // Only this thread frees slots, so waiting would never end.
+          reclaimCancelledTimers();
+          head = timers_.free_head.load(std::memory_order_acquire);
+          if (static_cast<std::uint32_t>(head) == 0) {
+            return nullptr;
+          }
+          continue;
+        }
+        // Have the partition reclaim the slots of cancelled timers.
+        wait_policy_.notify();
+        std::this_thread::yield();
+        head = timers_.free_head.load(std::memory_order_acquire);
+        continue;
+      }
+      TimerSlot& slot = timers_.slots[index - 1];
+      const std::uint64_t next =
+          (((head >> 32) + 1) << 32) |
+          slot.next_free.load(std::memory_order_relaxed);
+      if (timers_.free_head.compare_exchange_weak(head, next,
+                                                  std::memory_order_acquire,
+                                                  std::memory_order_acquire)) {
+        return &slot;
+      }
+    }
+  }
+
+  // Returns a slot to the free stack. Only called by the partition thread.
+  void freeTimer(TimerSlot* slot) {
+    slot->task.reset();
+    slot->period = 0;
+    const std::uint32_t generation =
+        timerGeneration(slot->state.load(std::memory_order_relaxed));
+    slot->state.store(timerState(std::uint64_t{generation} + 1, kTimerFree),
+                      std::memory_order_relaxed);
+    const std::uint32_t index =
+        static_cast<std::uint32_t>(slot - timers_.slots.get()) + 1;
+    std::uint64_t head = timers_.free_head.load(std::memory_order_relaxed);
+    std::uint64_t next;
+    do {
+      slot->next_free.store(static_cast<std::uint32_t>(head),
+                            std::memory_order_relaxed);
+      next = (((head >> 32) + 1) << 32) | index;
+    } while (!timers_.free_head.compare_exchange_weak(
+        head, next, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  template <typename Closure>
+  TimerHandle armTimer(std::chrono::nanoseconds delay,
+                       std::chrono::nanoseconds period, Closure&& closure) {
+    static_assert(kTimers, "timers require TRAITS::kTimers");
+    TimerSlot* slot = allocateTimer();
+    if (slot == nullptr) {
+      return {partition_index_, TimerHandle::kInvalidSlot, 0};
+    }
+    slot->task = std::forward<Closure>(closure);
+    slot->period = period > std::chrono::nanoseconds::zero()
+                       ? std::max<std::uint64_t>(ceilTicks(period), 1)
+                       : 0;
+    const std::uint32_t generation =
+        timerGeneration(slot->state.load(std::memory_order_relaxed));
+    slot->state.store(timerState(generation, kTimerPending),
+                      std::memory_order_relaxed);
+    const std::uint64_t deadline =
+        ceilTicks(Clock::now() + delay - timers_.epoch);
+    if (current_ == this) {
+      scheduleTimer(slot, deadline);
+    } else {
+      queue_.blockingWrite([slot, deadline](ProactorPartition& partition) {
+        partition.scheduleTimer(slot, deadline);
+      });
+      wait_policy_.notify();
+    }
+    return {partition_index_,
+            static_cast<std::uint32_t>(slot - timers_.slots.get()),
+            generation};
+  }
+
+  // Puts a pending timer on the wheel, unless it was cancelled meanwhile.
+  void scheduleTimer(TimerSlot* slot, std::uint64_t deadline) {
+    const std::uint32_t generation =
+        timerGeneration(slot->state.load(std::memory_order_relaxed));
+    std::uint64_t pending = timerState(generation, kTimerPending);
+    if (!slot->state.compare_exchange_strong(
+            pending, timerState(generation, kTimerArmed),
+            std::memory_order_acq_rel, std::memory_order_relaxed)) {
+      freeTimer(slot);
+      return;
+    }
+    if (timers_.wheel.empty()) {
+      // Catch up with the time spent without timers at once.
+      timers_.wheel.advance(currentTick(), [](TimerNode*) {});
+    }
+    timers_.wheel.schedule(slot, deadline);
+  }
+
+  // Fires the timers whose deadline passed. Returns whether any fired.
+  bool runTimers() {
+    if constexpr (kTimers) {
+      if (hasCancelledTimers()) {
+        reclaimCancelledTimers();
+      }
+      const std::uint64_t now = currentTick();
+      if (timers_.wheel.empty() || now < timers_.wheel.nextTick()) {
+        return false;
+      }
+      bool fired = false;
+      timers_.wheel.advance(now, [this, &fired](TimerNode* node) {
+        fireTimer(static_cast<TimerSlot*>(node));
+        fired = true;
+      });
+      return fired;
+    } else {
+      return false;
+    }
+  }
+
+  void fireTimer(TimerSlot* slot) {
+    std::uint64_t state = slot->state.load(std::memory_order_acquire);
+    if ((state & kTimerStatusMask) != kTimerArmed) {
+      // Cancelled: freed by 'reclaimCancelledTimers()'.
+      return;
+    }
+    if (slot->period == 0) {
+      if (slot->state.compare_exchange_strong(
+              state, timerState(timerGeneration(state), kTimerDone),
+              std::memory_order_acq_rel, std::memory_order_acquire)) {
+        slot->task(*this);
+        freeTimer(slot);
+      }
+      return;
+    }
+    slot->task(*this);
+    if ((slot->state.load(std::memory_order_acquire) & kTimerStatusMask) ==
+        kTimerArmed) {
+      timers_.wheel.schedule(slot, slot->deadline + slot->period);
+    }
+  }
+
+  bool hasCancelledTimers() const {
+    if constexpr (kTimers) {
+      return timers_.cancelled.load(std::memory_order_relaxed) != nullptr;
+    } else {
+      return false;
+    }
+  }
+
+  // Unlinks and frees the timers cancelled while armed.
+  void reclaimCancelledTimers() {
+    TimerSlot* slot =
+        timers_.cancelled.exchange(nullptr, std::memory_order_acquire);
+    while (slot != nullptr) {
+      TimerSlot* next = slot->next_cancelled;
+      if (slot->scheduled()) {
+        timers_.wheel.cancel(slot);
+      }
+      freeTimer(slot);
+      slot = next;
+    }
+  }
+
+  // Same as 'makeTask()', but the closure can be called repeatedly: it
+  // passes copies of its arguments and callback to every call.
+  template <typename MemberFunc, typename Callback, typename... Args>
+  static auto makeRepeatingTask(MemberFunc func, Callback&& callback,
+                                Args&&... args) {
+    static_assert(std::is_member_function_pointer_v<MemberFunc>,
+                  "func must be a member function pointer");
+    static_assert(std::is_invocable_v<MemberFunc, COMPUTABLE*, Args&...>,
+                  "Arguments provided to 'process_every()' function must "
+                  "match the parameters of the COMPUTABLE member function");
+    return [func, callback = callback,
+            ... capturedArgs = args](ProactorPartition& partition) mutable {
+      COMPUTABLE* computable = &partition.computable_;
+      auto copy = callback;
+      if constexpr (std::is_void_v<std::invoke_result_t<MemberFunc, COMPUTABLE*,
+                                                        Args&...>>) {
+        std::invoke(func, computable, capturedArgs...);
+        partition.complete(copy);
+      } else {
+        auto result = std::invoke(func, computable, capturedArgs...);
+        partition.complete(copy, std::move(result));
       }
+    };
+  }
 
-      [[unlikely]] if (!running_) { return; }
+  // Binds func and callback into an unkeyed job.
+  template <typename Func, typename Callback>
+  static auto makeJob(Func&& func, Callback&& callback) {
+    using Result = std::invoke_result_t<std::decay_t<Func>&>;
+    return [func = std::forward<Func>(func),
+            callback = std::forward<Callback>(callback)](
+               ProactorPartition& partition) mutable {
+      if constexpr (std::is_void_v<Result>) {
+        func();
+        partition.complete(callback);
+      } else {
+        partition.complete(callback, func());
+      }
+    };
+  }
 
-      sleeper_.sleep();
+  // Runs up to kBatchSize jobs of this partition's deque, after moving
+  // newly submitted jobs onto it. Returns whether any job ran.
+  bool runJobs() {
+    if constexpr (kWorkStealing) {
+      reclaimJobSlots();
+      while (jobs_.free != nullptr && jobs_.inject.read(jobs_.free->job)) {
+        JobSlot* slot = jobs_.free;
+        jobs_.free = slot->next;
+        jobs_.deque.push(slot);
+      }
+      if (jobs_.deque.sizeGuess() > 1) {
+        wakeThief();
+      }
+      std::size_t count = 0;
+      JobSlot* slot;
+      while (count < kBatchSize && jobs_.deque.pop(slot)) {
+        runJob(slot);
+        ++count;
+      }
+      return count != 0;
+    } else {
+      return false;
     }
   }
 
-  void stop() noexcept {
-    if (running_) {
-      running_ = false;
-      if (thread_.joinable()) {
-        try {
-          thread_.join();
-        } catch (...) {
-          std::ostringstream oss;
-          oss << "Error: Failed to join worker thread (Partition: "
-              << partition_index_ << ", Thread ID: " << thread_.get_id()
-              << ").";
-          std::cerr << oss.str() << std::endl;
+  // Runs a job stolen from a sibling's deque. Returns whether one was
+  // found.
+  bool stealJob() {
+    if constexpr (kWorkStealing) {
+      ProactorPartition* const* siblings =
+          jobs_.siblings.load(std::memory_order_acquire);
+      if (siblings == nullptr) {
+        return false;
+      }
+      const std::size_t count = jobs_.sibling_count;
+      for (std::size_t n = 0; n < count; ++n) {
+        const std::size_t index = (jobs_.next_victim + n) % count;
+        ProactorPartition& victim = *siblings[index];
+        JobSlot* slot;
+        if (&victim != this && victim.jobs_.deque.steal(slot)) {
+          // Keep stealing from the same victim, and get more help if it
+          // still has jobs.
+          jobs_.next_victim = index;
+          if (victim.jobs_.deque.sizeGuess() != 0) {
+            wakeThief();
+          }
+          runJob(slot);
+          return true;
         }
       }
+      return false;
+    } else {
+      return false;
     }
   }
 
- private:
+  void runJob(JobSlot* slot) {
+    slot->job(*this);
+    slot->job.reset();
+    ProactorPartition* owner = slot->owner;
+    if (owner == this) {
+      slot->next = jobs_.free;
+      jobs_.free = slot;
+    } else {
+      slot->next = owner->jobs_.returned.load(std::memory_order_relaxed);
+      while (!owner->jobs_.returned.compare_exchange_weak(
+          slot->next, slot, std::memory_order_release,
+          std::memory_order_relaxed)) {
+      }
+    }
+  }
+
+  // Takes back the slots of jobs stolen and run by siblings.
+  void reclaimJobSlots() {
+    JobSlot* slot = jobs_.returned.exchange(nullptr, std::memory_order_acquire);
+    while (slot != nullptr) {
+      JobSlot* next = slot->next;
+      slot->next = jobs_.free;
+      jobs_.free = slot;
+      slot = next;
+    }
+  }
+
+  // Wakes one sibling, a different one each time, to steal jobs.
+  void wakeThief() {
+    ProactorPartition* const* siblings =
+        jobs_.siblings.load(std::memory_order_acquire);
+    const std::size_t count = jobs_.sibling_count;
+    if (siblings == nullptr || count < 2) {
+      return;
+    }
+    jobs_.next_wake = (jobs_.next_wake + 1) % count;
+    if (jobs_.next_wake == partition_index_) {
+      jobs_.next_wake = (jobs_.next_wake + 1) % count;
+    }
+    siblings[jobs_.next_wake]->wait_policy_.notify();
+  }
+
+  // Whether there are jobs this partition could run or steal.
+  bool hasJobs() const {
+    if constexpr (kWorkStealing) {
+      if (!jobs_.inject.isEmpty() || jobs_.deque.sizeGuess() != 0) {
+        return true;
+      }
+      ProactorPartition* const* siblings =
+          jobs_.siblings.load(std::memory_order_acquire);
+      for (std::size_t i = 0; siblings != nullptr && i < jobs_.sibling_count;
+           ++i) {
+        if (siblings[i]->jobs_.deque.sizeGuess() != 0) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  template <typename... Args>
+  COMPUTABLE makeComputable(const Args&... args) {
+    if constexpr (std::uses_allocator_v<COMPUTABLE,
+                                        std::pmr::polymorphic_allocator<>>) {
+      return std::make_obj_using_allocator<COMPUTABLE>(
+          std::pmr::polymorphic_allocator<>(arena_.get()), args...);
+    } else {
+      return COMPUTABLE(args...);
+    }
+  }
+
+  // Binds a task for a tuple-like (key, args...) item, dropping the key.
+  template <typename MemberFunc, typename Callback, typename Item>
+  auto makeItemTask(MemberFunc func, const Callback& callback,
+                    const Item& item) {
+    return std::apply(
+        [&](const auto& /*key*/, const auto&... args) {
+          return traced(timed(makeTask(func, callback, args...)));
+        },
+        item);
+  }
+
   const std::size_t partition_index_;
+  // Declared first so that everything holding memory from it, including
+  // the tasks left in the queues, is destroyed before it releases it. Tasks
+  // boxed in it elsewhere, e.g. in another Proactor's queues, keep it alive.
+  PartitionArena::Ptr arena_ = PartitionArena::create();
   COMPUTABLE computable_;
-  folly::MPMCQueue<Function> queue_;
+  Queue queue_;
+  [[no_unique_address]] std::conditional_t<(kPriorityLanes > 1), PriorityLanes,
+                                           NoPriorityLanes>
+      lanes_;
+  std::conditional_t<kDeferredCompletions, DeferredCompletions, NoCompletions>
+      completions_;
+  std::conditional_t<kWorkStealing, Jobs, NoJobs> jobs_;
+  // With SelfDispatch::kLocal, the tasks this partition's thread enqueued
+  // into it. Only touched by the partition thread.
+  [[no_unique_address]] std::conditional_t<kLocalTasks, std::deque<Task>,
+                                           NoLocalTasks> local_;
+  [[no_unique_address]] std::conditional_t<kTimers, Timers, NoTimers> timers_;
+  [[no_unique_address]] std::conditional_t<kMetrics, PartitionMetrics,
+                                           NoMetrics> metrics_;
+  typename TRAITS::AdmissionPolicy admission_;
+  const Watermarks watermarks_;
+  // Where the queues stand relative to the watermarks, see
+  // 'checkWatermarks()'.
+  static constexpr std::uint8_t kBelow = 0;
+  static constexpr std::uint8_t kRising = 1;
+  static constexpr std::uint8_t kAbove = 2;
+  static constexpr std::uint8_t kFalling = 3;
+  std::atomic<std::uint8_t> watermark_state_{kBelow};
+  // With TRAITS::kTracing, when the current batch was dequeued.
+  std::uint64_t dequeued_ = 0;
   std::atomic<bool> running_;
+  std::atomic<bool> discard_{false};
+  std::atomic<bool> worker_exited_{false};
+  std::atomic_flag joining_;
+  // Set once the thread that took 'joining_' joined the partition thread.
+  std::atomic_flag joined_;
+  // Odd while the partition thread reads and runs a batch, see
+  // 'readEpochBatch()'.
+  alignas(kCacheLineSize) std::atomic<std::uint64_t> epoch_{0};
+  // Parks the threads in 'waitDrained()' until an epoch closes.
+  mutable EventCount epoch_closed_;
+  // Must be initialized before 'thread_' starts using it.
+  typename TRAITS::WaitPolicy wait_policy_;
   std::thread thread_;
-  AdaptiveSleeper sleeper_;
+
+  static inline thread_local ProactorPartition* current_ = nullptr;
 };
 
 }  // namespace mbucko
@@ -0,0 +1,199 @@
+#ifndef PROACTORTRAITS_H
+#define PROACTORTRAITS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "AdmissionPolicy.h"
+#include "QueuePolicy.h"
+#include "WaitPolicy.h"
+
+namespace mbucko {
+
+/// Where the callbacks passed to 'process()' run.
+enum class CompletionMode {
+  /// On the partition thread, right after the task.
+  kInline,
+  /// On whichever thread calls 'Proactor::poll_completions()', e.g. a
+  /// CompletionThreadPool. Each partition hands its completions over through
+  /// an SPSC ring, so a slow callback, or one blocking on a full downstream
+  /// Proactor, never stalls the partition.
+  kDeferred,
+};
+
+/// The lane of a partition a task is enqueued in, see
+/// DefaultProactorTraits::kPriorityLanes. Priorities above the highest lane
+/// use the highest lane.
+enum class Priority : std::uint8_t {
+  kNormal,
+  kHigh,
+  kUrgent,
+  kCritical,
+};
+
+/// What happens to the tasks still queued when a Proactor stops, see
+/// 'Proactor::stop()'.
+enum class DrainPolicy {
+  /// Every task enqueued before 'stop()' was called runs, with its callback
+  /// when callbacks run inline. Tasks enqueued while stopping, e.g. by those
+  /// tasks into other partitions, may be dropped.
+  kDrain,
+  /// Waits for the Proactor to become quiescent first, see
+  /// 'Proactor::quiesce()', so that the tasks enqueued by tasks and inline
+  /// callbacks run as well.
+  kQuiesce,
+  /// Partitions finish the batch they are running and drop the tasks left
+  /// in their queues, without running them. The callbacks of dropped tasks
+  /// are never called, and are only destroyed with the Proactor, so an
+  /// AsyncResult whose task is dropped never completes: a thread in its
+  /// 'get()' blocks forever, and an awaiting coroutine is never resumed.
+  kDiscard,
+};
+
+/// How a partition takes the tasks that its own thread enqueues into it with
+/// 'process()', 'try_process()', 'process_for()', their batch variants,
+/// 'process_latest()' or a broadcast, e.g. follow-up work a COMPUTABLE
+/// enqueues for its own key, or an inline callback feeding a chained stage
+/// that routes back to the same partition. Timers and the jobs of
+/// 'submit()' have their own partition-local paths.
+enum class SelfDispatch {
+  /// Through the queues, like any other producer. A task enqueuing into its
+  /// own full queue with 'process()' blocks forever.
+  kQueue,
+  /// Runs the task right away, nested in the task or callback enqueuing it.
+  /// Inline tasks are part of the trace events and metrics of the task
+  /// running them. Unbounded re-entrant work grows the stack.
+  kInline,
+  /// Appends the task to a deque private to the partition thread, with no
+  /// atomics and no capacity limit, which the partition runs after each
+  /// batch, before it reads its queues again. The tasks appended meanwhile
+  /// by those tasks wait for the next round, after the queues. Priorities
+  /// do not apply.
+  kLocal,
+};
+
+/// Compile-time configuration shared by Proactor and ProactorPartition. To
+/// change a setting, derive from DefaultProactorTraits and override only the
+/// members that need to differ:
+///
+/// \code
+/// struct LargeTaskTraits : DefaultProactorTraits {
+///   static constexpr std::size_t kTaskCapacity = 128;
+/// };
+///
+/// Proactor<int, HashPolicy, kPartitions, Adder, LargeTaskTraits> proactor(
+///     kQueueSize, 0);
+/// \endcode
+struct DefaultProactorTraits {
+  /// Bytes of inline storage available to each enqueued task. A task holds
+  /// the member function pointer, the callback and copies of all arguments.
+  /// The default keeps a whole task within a single cache line.
+  static constexpr std::size_t kTaskCapacity = 48;
+
+  /// When false, a task whose captures exceed kTaskCapacity fails to compile.
+  /// When true, such tasks are allocated on the heap instead.
+  static constexpr bool kTaskHeapFallback = false;
+
+  /// The queue each partition receives its tasks through, see QueuePolicy.h.
+  /// Use SPSCLanesQueuePolicy<> when many producer threads write to the same
+  /// partitions.
+  using QueuePolicy = MPMCQueuePolicy;
+
+  /// Whether partitions accept the tasks offered with 'try_process()',
+  /// 'try_process_batch()' and 'process_for()', see AdmissionPolicy.h.
+  /// SojournAdmissionPolicy<> sheds load once the queueing delay stays too
+  /// high.
+  using AdmissionPolicy = AdmitAllPolicy;
+
+  /// The maximum number of tasks a partition dequeues per wakeup and then
+  /// executes back to back. A partition never waits for a batch to fill up.
+  static constexpr std::size_t kBatchSize = 16;
+
+  /// What an idle partition does while its queue is empty, see WaitPolicy.h.
+  /// The default backs off and eventually parks. BusySpinWaitPolicy minimizes
+  /// latency, FutexWaitPolicy<> parks as soon as possible.
+  using WaitPolicy = AdaptiveWaitPolicy;
+
+  /// How tasks enqueued by a partition's own thread into that partition are
+  /// run, see SelfDispatch.
+  static constexpr SelfDispatch kSelfDispatch = SelfDispatch::kQueue;
+
+  /// Where callbacks run, see CompletionMode.
+  static constexpr CompletionMode kCompletionMode = CompletionMode::kInline;
+
+  /// Bytes of inline storage for a deferred completion, which holds the
+  /// callback and the result of the task.
+  static constexpr std::size_t kCompletionCapacity = 48;
+
+  /// Whether Proactor samples the keys it routes, to report per-partition
+  /// load and hot keys, and supports moving keys between partitions, see
+  /// KeyRouter.h. Costs two extra atomic stores and a fence per keyed
+  /// enqueue.
+  static constexpr bool kHotKeyTracking = false;
+
+  /// With kHotKeyTracking, one keyed enqueue in kHotKeySampleRate is
+  /// sampled, per producer thread.
+  static constexpr std::size_t kHotKeySampleRate = 64;
+
+  /// With kHotKeyTracking, the number of hot keys tracked.
+  static constexpr std::size_t kHotKeyCapacity = 32;
+
+  /// The number of priority lanes per partition, from 1 to 4. With more than
+  /// one lane, a partition always takes its next batch from the highest
+  /// non-empty lane, so a control task waits for at most one batch instead
+  /// of a whole queue. Between the tasks of a batch from a lower lane, it
+  /// also runs the tasks that arrived in the highest lane, so those wait for
+  /// at most one task. Each lane holds up to the queue capacity. Tasks are
+  /// only FIFO within a lane.
+  static constexpr std::size_t kPriorityLanes = 1;
+
+  /// With several priority lanes, the number of consecutive batches taken
+  /// from higher lanes while lower lanes have tasks, before the lower lanes
+  /// get one batch, in turn.
+  static constexpr std::size_t kPriorityBudget = 8;
+
+  /// Whether partitions run timers armed with 'Proactor::process_after()'
+  /// and 'Proactor::process_every()', on a timing wheel ticked by the
+  /// partition thread itself.
+  static constexpr bool kTimers = false;
+
+  /// With kTimers, the number of timers a partition can hold at once.
+  static constexpr std::size_t kTimerCapacity = 1024;
+
+  /// With kTimers, the tick of the timing wheels: timers fire at the first
+  /// tick at or after their deadline.
+  static constexpr std::chrono::nanoseconds kTimerResolution =
+      std::chrono::milliseconds(1);
+
+  /// Whether partitions also run the unkeyed jobs passed to
+  /// 'Proactor::submit()'. Idle partitions steal such jobs from the
+  /// work-stealing deques of busy ones.
+  static constexpr bool kWorkStealing = false;
+
+  /// With kWorkStealing, the number of jobs each partition's work-stealing
+  /// deque can hold.
+  static constexpr std::size_t kStealCapacity = 256;
+
+  /// Whether the Proactor keeps a table of pending updates per partition for
+  /// 'Proactor::process_latest()', see ConflationTable.h. Each table costs
+  /// a few kilobytes, plus one slot per distinct key ever updated.
+  static constexpr bool kConflation = false;
+
+  /// Whether partitions keep the counters and latency histograms reported
+  /// by 'Proactor::snapshot()', see PartitionMetrics.h. Costs two clock
+  /// reads per task and one per enqueue, and 8 bytes of every task's
+  /// kTaskCapacity. Compiled out entirely when false.
+  static constexpr bool kMetrics = false;
+
+  /// Whether tasks enqueued with 'process()', 'try_process()' and their
+  /// batch variants record trace events into per-thread rings, from their
+  /// enqueue to the end of their callback, see Tracing.h. Costs a TSC read
+  /// and a few relaxed stores per event, and 8 bytes of every task's
+  /// kTaskCapacity. Compiled out entirely when false.
+  static constexpr bool kTracing = false;
+};
+
+}  // namespace mbucko
+
+#endif  // PROACTORTRAITS_H
@@ -0,0 +1,52 @@
+#include "ProducerSlot.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace mbucko {
+
+namespace {
+
+class SlotRegistry {
+ public:
+  std::size_t acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) {
+      return next_++;
+    }
+    auto lowest = std::min_element(free_.begin(), free_.end());
+    const std::size_t slot = *lowest;
+    free_.erase(lowest);
+    return slot;
+  }
+
+  void release(std::size_t slot) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(slot);
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::size_t> free_;
+  std::size_t next_ = 0;
+};
+
+// Intentionally leaked: thread-local holders of detached threads may release
+// their slots after static destructors have run.
+SlotRegistry& registry() {
+  static SlotRegistry* registry = new SlotRegistry();
+  return *registry;
+}
+
+}  // namespace
+
+namespace detail {
+
+std::size_t acquireProducerSlot() { return registry().acquire(); }
+
+void releaseProducerSlot(std::size_t slot) { registry().release(slot); }
+
+}  // namespace detail
+
+}  // namespace mbucko
@@ -0,0 +1,35 @@
+#ifndef PRODUCERSLOT_H
+#define PRODUCERSLOT_H
+
+#include <cstddef>
+
+namespace mbucko {
+
+namespace detail {
+
+std::size_t acquireProducerSlot();
+
+void releaseProducerSlot(std::size_t slot);
+
+struct ProducerSlotHolder {
+  ProducerSlotHolder() : slot(acquireProducerSlot()) {}
+  ~ProducerSlotHolder() { releaseProducerSlot(slot); }
+
+  const std::size_t slot;
+};
+
+}  // namespace detail
+
+/// Returns a small integer identifying the calling thread among the threads
+/// that are currently alive. Slots are handed out lowest-first on a thread's
+/// first call and recycled only when the thread exits, so they can be used
+/// to index fixed-size per-producer arrays. A thread holds its slot from its
+/// first call until it exits, whether or not it calls again.
+inline std::size_t producerSlot() {
+  thread_local detail::ProducerSlotHolder holder;
+  return holder.slot;
+}
+
+}  // namespace mbucko
+
+#endif  // PRODUCERSLOT_H
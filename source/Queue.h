@@ -1,61 +1,243 @@
 #ifndef QUEUE_H
 #define QUEUE_H
 
-#include <mutex>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "CacheLine.h"
+#include "WaitPolicy.h"
 
 namespace mbucko {
+
+/// A bounded lock-free multi-producer/multi-consumer queue (Vyukov). Every
+/// slot carries a sequence number telling whether it is free for the
+/// producer or filled for the consumer of a given ticket, so producers and
+/// consumers only contend on their own end of the queue and never take a
+/// lock. Elements are constructed in place in uninitialized storage when
+/// written and destroyed when read.
+///
+/// Elements are read in the order producers claimed their tickets, so the
+/// queue is FIFO across producers. It offers the interface of
+/// folly::MPMCQueue used by ProactorPartition, and can therefore back it,
+/// see MPMCQueuePolicy, plus 'writeBatch()' to claim several slots at once.
+///
+/// \tparam T The element type. Must be nothrow move constructible.
 template <typename T>
 class Queue {
+  static_assert(std::is_nothrow_move_constructible_v<T>,
+                "Queue elements must be nothrow move constructible");
+
  public:
-  Queue(std::size_t capacity)
-      : capacity_(capacity),
-        data_(new T[capacity]),
-        head_(0),
-        tail_(0),
-        size_(0) {}
-
-  ~Queue() { delete[] data_; }
-
-  bool enqueue(const T& value) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (size_ == capacity_) {
-      return false;
+  /// Creates a queue holding at least 'capacity' elements. The capacity is
+  /// rounded up to a power of two.
+  explicit Queue(std::size_t capacity)
+      : mask_(std::bit_ceil(capacity < 1 ? 1 : capacity) - 1),
+        slots_(std::make_unique<Slot[]>(mask_ + 1)) {
+    for (std::size_t i = 0; i <= mask_; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~Queue() {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    for (std::size_t ticket = head_.load(std::memory_order_relaxed);
+         ticket != tail; ++ticket) {
+      Slot& slot = slots_[ticket & mask_];
+      std::launder(reinterpret_cast<T*>(slot.storage))->~T();
+    }
+  }
+
+  Queue(const Queue&) = delete;
+  Queue& operator=(const Queue&) = delete;
+
+  /// Constructs an element from 'args' unless the queue is full. Returns
+  /// whether the element was written.
+  template <typename... Args>
+  bool writeIfNotFull(Args&&... args) {
+    std::size_t ticket = tail_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[ticket & mask_];
+      const std::size_t sequence =
+          slot.sequence.load(std::memory_order_acquire);
+      const std::intptr_t lag = static_cast<std::intptr_t>(sequence) -
+                                static_cast<std::intptr_t>(ticket);
+      if (lag == 0) {
+        if (tail_.compare_exchange_weak(ticket, ticket + 1,
+                                        std::memory_order_relaxed)) {
+          new (slot.storage) T(std::forward<Args>(args)...);
+          slot.sequence.store(ticket + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (lag < 0) {
+        // The slot still holds the element of the previous lap.
+        return false;
+      } else {
+        ticket = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  template <typename... Args>
+  bool write(Args&&... args) {
+    return writeIfNotFull(std::forward<Args>(args)...);
+  }
+
+  /// Constructs up to 'count' elements, the i-th one from 'generator(i)',
+  /// and returns how many were written. Their tickets are claimed with a
+  /// single CAS, so the elements are consecutive in the queue; fewer are
+  /// written when fewer slots in a row are free at the tail.
+  template <typename Generator>
+  std::size_t writeBatch(std::size_t count, Generator&& generator) {
+    std::size_t ticket = tail_.load(std::memory_order_relaxed);
+    while (true) {
+      // A slot is free for 'ticket + free' until that ticket is claimed,
+      // which moves the tail past 'ticket' and fails the CAS below.
+      std::size_t free = 0;
+      while (free < count && free <= mask_ &&
+             slots_[(ticket + free) & mask_].sequence.load(
+                 std::memory_order_acquire) == ticket + free) {
+        ++free;
+      }
+      if (free == 0) {
+        const std::size_t sequence =
+            slots_[ticket & mask_].sequence.load(std::memory_order_acquire);
+        if (static_cast<std::intptr_t>(sequence) -
+                static_cast<std::intptr_t>(ticket) <
+            0) {
+          // The slot still holds the element of the previous lap.
+          return 0;
+        }
+        ticket = tail_.load(std::memory_order_relaxed);
+      } else if (tail_.compare_exchange_weak(ticket, ticket + free,
+                                             std::memory_order_relaxed)) {
+        for (std::size_t i = 0; i < free; ++i) {
+          Slot& slot = slots_[(ticket + i) & mask_];
+          new (slot.storage) T(generator(i));
+          slot.sequence.store(ticket + i + 1, std::memory_order_release);
+        }
+        return free;
+      }
     }
-    data_[tail_] = value;
-    tail_ = (tail_ + 1) % capacity_;
-    ++size_;
-    return true;
   }
 
-  bool try_deque(T& value) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (size_ == 0) {
-      return false;
+  /// Constructs an element from 'args', spinning, then yielding, while the
+  /// queue is full.
+  template <typename... Args>
+  void blockingWrite(Args&&... args) {
+    for (std::uint32_t spins = 0;
+         !writeIfNotFull(std::forward<Args>(args)...); ++spins) {
+      if (spins < kSpinsBeforeYield) {
+        cpuRelax();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  /// Same as 'blockingWrite()', but gives up once 'when' has passed while
+  /// the queue is full. Returns whether the element was written. Same as in
+  /// folly::MPMCQueue.
+  template <typename Clock, typename... Args>
+  bool tryWriteUntil(const std::chrono::time_point<Clock>& when,
+                     Args&&... args) {
+    for (std::uint32_t spins = 0;
+         !writeIfNotFull(std::forward<Args>(args)...); ++spins) {
+      if (spins < kSpinsBeforeYield) {
+        cpuRelax();
+      } else if (Clock::now() >= when) {
+        return false;
+      } else {
+        std::this_thread::yield();
+      }
     }
-    value = data_[head_];
-    head_ = (head_ + 1) % capacity_;
-    --size_;
     return true;
   }
 
-  std::size_t size() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return size_;
+  /// Moves the oldest element into 'value' unless the queue is empty.
+  /// Returns whether an element was read.
+  bool read(T& value) {
+    std::size_t ticket = head_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[ticket & mask_];
+      const std::size_t sequence =
+          slot.sequence.load(std::memory_order_acquire);
+      const std::intptr_t lag = static_cast<std::intptr_t>(sequence) -
+                                static_cast<std::intptr_t>(ticket + 1);
+      if (lag == 0) {
+        if (head_.compare_exchange_weak(ticket, ticket + 1,
+                                        std::memory_order_relaxed)) {
+          T* element = std::launder(reinterpret_cast<T*>(slot.storage));
+          value = std::move(*element);
+          element->~T();
+          slot.sequence.store(ticket + mask_ + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (lag < 0) {
+        // Not written yet.
+        return false;
+      } else {
+        ticket = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// Returns the number of elements, which may be stale by the time it is
+  /// used.
+  std::size_t sizeGuess() const {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+
+  bool isEmpty() const { return sizeGuess() == 0; }
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+  /// Returns the number of tickets claimed by writers so far, including
+  /// elements being written. Since elements are read in ticket order, every
+  /// element written before the call has been read once 'readCount()'
+  /// reaches it. Same as in folly::MPMCQueue.
+  std::uint64_t writeCount() const {
+    return tail_.load(std::memory_order_acquire);
+  }
+
+  /// Returns the number of elements read so far.
+  std::uint64_t readCount() const {
+    return head_.load(std::memory_order_acquire);
   }
 
-  std::size_t capacity() const { return capacity_; }
+  /// Same as 'writeIfNotFull()'.
+  bool enqueue(const T& value) { return writeIfNotFull(value); }
 
-  std::size_t empty() const { return size() == 0; }
+  /// Same as 'read()'.
+  bool try_deque(T& value) { return read(value); }
+
+  std::size_t size() const { return sizeGuess(); }
+
+  bool empty() const { return isEmpty(); }
 
  private:
-  const std::size_t capacity_;
-  T* data_;
-  std::size_t head_;
-  std::size_t tail_;
-  std::size_t size_;
-  mutable std::mutex mutex_;
+  static constexpr std::uint32_t kSpinsBeforeYield = 64;
+
+  struct Slot {
+    std::atomic<std::size_t> sequence;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  const std::size_t mask_;
+  const std::unique_ptr<Slot[]> slots_;
+  alignas(kCacheLineSize) std::atomic<std::size_t> head_{0};
+  alignas(kCacheLineSize) std::atomic<std::size_t> tail_{0};
 };
 
 }  // namespace mbucko
 
-#endif  // QUEUE_H
\ No newline at end of file
+#endif  // QUEUE_H
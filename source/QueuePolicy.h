@@ -0,0 +1,67 @@
+#ifndef QUEUEPOLICY_H
+#define QUEUEPOLICY_H
+
+#ifdef PROACTOR_WITH_FOLLY
+#include <folly/MPMCQueue.h>
+#endif
+
+#include <cstddef>
+
+#include "LaneQueue.h"
+#include "Queue.h"
+
+namespace mbucko {
+
+/// Queue policies select the queue type each ProactorPartition uses to
+/// receive tasks. A policy exposes a 'Queue<T>' alias template whose type is
+/// constructible from a capacity and provides 'blockingWrite(args...)',
+/// 'writeIfNotFull(args...)' and 'read(T&)'. Queues may additionally provide
+/// 'readBatch(T*, max)' and 'writeBatch(count, generator)' to move several
+/// elements with a single synchronization. 'kFifoAcrossProducers' tells
+/// whether tasks run in the order they were enqueued across all producers,
+/// or only per producer thread.
+
+/// One lock-free mbucko::Queue per partition, shared by all producers.
+/// 'Proactor::process_batch()' claims the slots of a partition's items with
+/// one CAS.
+struct MPMCQueuePolicy {
+  static constexpr bool kFifoAcrossProducers = true;
+
+  template <typename T>
+  using Queue = mbucko::Queue<T>;
+};
+
+#ifdef PROACTOR_WITH_FOLLY
+/// One folly::MPMCQueue per partition, shared by all producers. Only
+/// available when building with PROACTOR_WITH_FOLLY. It has no batch write,
+/// so 'Proactor::process_batch()' writes its items one by one.
+struct FollyMPMCQueuePolicy {
+  static constexpr bool kFifoAcrossProducers = true;
+
+  template <typename T>
+  using Queue = folly::MPMCQueue<T>;
+};
+#endif
+
+/// One single-producer/single-consumer lane per producer thread and
+/// partition, see LaneQueue. Avoids contention between producers writing to
+/// the same partition. The partition capacity is split evenly across the
+/// lanes, so each producer can only have capacity / MAX_LANES tasks in
+/// flight per partition, but at least LaneQueue::kMinLaneCapacity, so a
+/// partition may hold more than its capacity. A producer thread keeps its
+/// lane until it exits.
+///
+/// \tparam MAX_LANES
+///     The maximum number of producer threads with a dedicated lane. Further
+///     threads share one overflow lane guarded by a mutex.
+template <std::size_t MAX_LANES = 64>
+struct SPSCLanesQueuePolicy {
+  static constexpr bool kFifoAcrossProducers = false;
+
+  template <typename T>
+  using Queue = LaneQueue<T, MAX_LANES>;
+};
+
+}  // namespace mbucko
+
+#endif  // QUEUEPOLICY_H
@@ -0,0 +1,165 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include "CacheLine.h"
+
+namespace mbucko {
+
+/// A bounded, wait-free single-producer/single-consumer ring buffer. Elements
+/// are constructed in place in uninitialized storage. Each side keeps a cached
+/// copy of the other side's index, so the shared indices are only touched when
+/// the ring looks full (producer) or empty (consumer).
+///
+/// \tparam T The element type. Must be nothrow move constructible.
+template <typename T>
+class SPSCQueue {
+ public:
+  /// Creates a queue holding at least 'capacity' elements. The capacity is
+  /// rounded up to a power of two.
+  explicit SPSCQueue(std::size_t capacity)
+      : mask_(std::bit_ceil(capacity < 2 ? 2 : capacity) - 1),
+        slots_(static_cast<Slot*>(::operator new[](
+            sizeof(Slot) * (mask_ + 1), std::align_val_t{alignof(Slot)}))) {}
+
+  ~SPSCQueue() {
+    const std::size_t tail = producer_.tail.load(std::memory_order_acquire);
+    for (std::size_t head = consumer_.head.load(std::memory_order_relaxed);
+         head != tail; ++head) {
+      std::launder(reinterpret_cast<T*>(&slots_[head & mask_]))->~T();
+    }
+    ::operator delete[](slots_, std::align_val_t{alignof(Slot)});
+  }
+
+  SPSCQueue(const SPSCQueue&) = delete;
+  SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+  /// Constructs an element from 'args' at the tail of the queue. Returns
+  /// false without constructing anything if the queue is full. Must only be
+  /// called from the producer thread.
+  template <typename... Args>
+  bool write(Args&&... args) {
+    const std::size_t tail = producer_.tail.load(std::memory_order_relaxed);
+    if (tail - producer_.cached_head > mask_) [[unlikely]] {
+      producer_.cached_head = consumer_.head.load(std::memory_order_acquire);
+      if (tail - producer_.cached_head > mask_) {
+        return false;
+      }
+    }
+    new (&slots_[tail & mask_]) T(std::forward<Args>(args)...);
+    producer_.tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Constructs up to 'count' elements at the tail of the queue, the i-th one
+  /// from 'generator(i)', and returns how many were written. The tail index is
+  /// published once for the whole batch. Must only be called from the
+  /// producer thread.
+  template <typename Generator>
+  std::size_t writeBatch(std::size_t count, Generator&& generator) {
+    const std::size_t tail = producer_.tail.load(std::memory_order_relaxed);
+    if (mask_ + 1 - (tail - producer_.cached_head) < count) {
+      producer_.cached_head = consumer_.head.load(std::memory_order_acquire);
+    }
+    count = std::min(count, mask_ + 1 - (tail - producer_.cached_head));
+    for (std::size_t i = 0; i < count; ++i) {
+      new (&slots_[(tail + i) & mask_]) T(generator(i));
+    }
+    if (count != 0) {
+      producer_.tail.store(tail + count, std::memory_order_release);
+    }
+    return count;
+  }
+
+  /// Moves the element at the head of the queue into 'item'. Returns false if
+  /// the queue is empty. Must only be called from the consumer thread.
+  bool read(T& item) {
+    const std::size_t head = consumer_.head.load(std::memory_order_relaxed);
+    if (head == consumer_.cached_tail) [[unlikely]] {
+      consumer_.cached_tail = producer_.tail.load(std::memory_order_acquire);
+      if (head == consumer_.cached_tail) {
+        return false;
+      }
+    }
+    T* slot = std::launder(reinterpret_cast<T*>(&slots_[head & mask_]));
+    item = std::move(*slot);
+    slot->~T();
+    consumer_.head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Moves up to 'max' elements from the head of the queue into 'items' and
+  /// returns how many were read. The head index is published once for the
+  /// whole batch. Must only be called from the consumer thread.
+  std::size_t readBatch(T* items, std::size_t max) {
+    const std::size_t head = consumer_.head.load(std::memory_order_relaxed);
+    if (consumer_.cached_tail - head < max) {
+      consumer_.cached_tail = producer_.tail.load(std::memory_order_acquire);
+    }
+    const std::size_t count = std::min(consumer_.cached_tail - head, max);
+    for (std::size_t i = 0; i < count; ++i) {
+      T* slot =
+          std::launder(reinterpret_cast<T*>(&slots_[(head + i) & mask_]));
+      items[i] = std::move(*slot);
+      slot->~T();
+    }
+    if (count != 0) {
+      consumer_.head.store(head + count, std::memory_order_release);
+    }
+    return count;
+  }
+
+  /// Returns true if the queue looks empty. Exact only when called from the
+  /// producer or the consumer thread while the other side is quiescent.
+  bool isEmpty() const noexcept { return sizeGuess() == 0; }
+
+  /// Returns an estimate of the number of elements in the queue.
+  std::size_t sizeGuess() const noexcept {
+    const std::size_t head = consumer_.head.load(std::memory_order_acquire);
+    const std::size_t tail = producer_.tail.load(std::memory_order_acquire);
+    return tail - head;
+  }
+
+  std::size_t capacity() const noexcept { return mask_ + 1; }
+
+  /// Returns the number of elements written so far.
+  std::size_t writeCount() const noexcept {
+    return producer_.tail.load(std::memory_order_acquire);
+  }
+
+  /// Returns the number of elements read so far.
+  std::size_t readCount() const noexcept {
+    return consumer_.head.load(std::memory_order_acquire);
+  }
+
+ private:
+  struct alignas(T) Slot {
+    unsigned char bytes[sizeof(T)];
+  };
+
+  struct alignas(kCacheLineSize) ProducerState {
+    std::atomic<std::size_t> tail{0};
+    std::size_t cached_head{0};
+  };
+
+  struct alignas(kCacheLineSize) ConsumerState {
+    std::atomic<std::size_t> head{0};
+    std::size_t cached_tail{0};
+  };
+
+  const std::size_t mask_;
+  Slot* const slots_;
+  ProducerState producer_;
+  ConsumerState consumer_;
+};
+
+}  // namespace mbucko
+
+#endif  // SPSCQUEUE_H
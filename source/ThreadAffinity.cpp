@@ -1,8 +1,17 @@
 #include "ThreadAffinity.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <semaphore>
+#include <set>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #ifdef __APPLE__
@@ -14,6 +23,7 @@
 #include <windows.h>
 #else
 #include <pthread.h>
+#include <sched.h>
 #endif
 
 namespace mbucko {
@@ -32,6 +42,13 @@ CoreInfo getCoreInfo() {
   if (info.performanceCores == 0 && info.efficiencyCores == 0) {
     info.performanceCores = std::thread::hardware_concurrency();
   }
+#elif defined(__linux__)
+  cpu_set_t cpuset;
+  if (sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0) {
+    info.performanceCores = CPU_COUNT(&cpuset);
+  } else {
+    info.performanceCores = std::thread::hardware_concurrency();
+  }
 #else
   info.performanceCores = std::thread::hardware_concurrency();
 #endif
@@ -81,4 +98,151 @@ void setThreadAffinity(std::thread& t, int coreId) {
 #endif
 }
 
-}  // namespace mbucko
\ No newline at end of file
+namespace {
+
+// Reads the integer in 'path', or returns 'fallback' if there is none.
+int readInt(const std::filesystem::path& path, int fallback) {
+  std::ifstream file(path);
+  int value;
+  return file >> value ? value : fallback;
+}
+
+// Orders 'cpus' by rank within their physical core: the first SMT thread of
+// every core, in order of appearance, then the second ones, and so on.
+std::vector<int> byCore(const std::vector<CpuInfo>& cpus) {
+  std::map<std::pair<int, int>, int> siblings_seen;
+  std::vector<std::pair<int, int>> ranked;  // (rank, position)
+  for (std::size_t i = 0; i < cpus.size(); ++i) {
+    const int rank = siblings_seen[{cpus[i].package, cpus[i].core}]++;
+    ranked.emplace_back(rank, static_cast<int>(i));
+  }
+  std::stable_sort(
+      ranked.begin(), ranked.end(),
+      [](const auto& a, const auto& b) { return a.first < b.first; });
+  std::vector<int> order;
+  for (const auto& [rank, position] : ranked) {
+    order.push_back(cpus[position].id);
+  }
+  return order;
+}
+
+}  // namespace
+
+std::size_t CpuTopology::nodes() const {
+  std::set<int> nodes;
+  for (const CpuInfo& cpu : cpus) {
+    nodes.insert(cpu.node);
+  }
+  return nodes.size();
+}
+
+CpuTopology readTopology(const std::string& cpu_dir,
+                         const std::vector<int>& allowed) {
+  namespace fs = std::filesystem;
+  CpuTopology topology;
+  for (const int id : allowed) {
+    const fs::path dir = fs::path(cpu_dir) / ("cpu" + std::to_string(id));
+    CpuInfo cpu{.id = id};
+    cpu.core = readInt(dir / "topology" / "core_id", id);
+    cpu.package = readInt(dir / "topology" / "physical_package_id", 0);
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator(dir, error)) {
+      const std::string name = entry.path().filename().string();
+      if (name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+          std::all_of(name.begin() + 4, name.end(),
+                      [](char c) { return c >= '0' && c <= '9'; })) {
+        cpu.node = std::stoi(name.substr(4));
+        break;
+      }
+    }
+    topology.cpus.push_back(cpu);
+  }
+  std::sort(topology.cpus.begin(), topology.cpus.end(),
+            [](const CpuInfo& a, const CpuInfo& b) { return a.id < b.id; });
+  return topology;
+}
+
+CpuTopology discoverTopology() {
+  std::vector<int> allowed;
+#if defined(__linux__)
+  cpu_set_t cpuset;
+  if (sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &cpuset)) {
+        allowed.push_back(cpu);
+      }
+    }
+    return readTopology("/sys/devices/system/cpu", allowed);
+  }
+#endif
+  const CoreInfo cores = getCoreInfo();
+  const int count = std::max(cores.performanceCores + cores.efficiencyCores, 1);
+  CpuTopology topology;
+  for (int id = 0; id < count; ++id) {
+    topology.cpus.push_back({.id = id, .core = id});
+  }
+  return topology;
+}
+
+std::vector<int> placeThreads(const CpuTopology& topology,
+                              const ThreadPlacement& placement,
+                              std::size_t threads) {
+  std::vector<int> order;
+  switch (placement.policy) {
+    case PlacementPolicy::kPhysicalCores:
+      order = byCore(topology.cpus);
+      break;
+    case PlacementPolicy::kSpreadNodes: {
+      std::map<int, std::vector<CpuInfo>> nodes;
+      for (const CpuInfo& cpu : topology.cpus) {
+        nodes[cpu.node].push_back(cpu);
+      }
+      std::vector<std::vector<int>> per_node;
+      for (const auto& [node, cpus] : nodes) {
+        per_node.push_back(byCore(cpus));
+      }
+      for (std::size_t rank = 0; order.size() < topology.cpus.size(); ++rank) {
+        for (const std::vector<int>& cpus : per_node) {
+          if (rank < cpus.size()) {
+            order.push_back(cpus[rank]);
+          }
+        }
+      }
+      break;
+    }
+    case PlacementPolicy::kExplicit:
+      order = placement.cpus;
+      break;
+    case PlacementPolicy::kUnpinned:
+      break;
+  }
+  std::vector<int> cpus(threads, -1);
+  if (!order.empty()) {
+    for (std::size_t i = 0; i < threads; ++i) {
+      cpus[i] = order[i % order.size()];
+    }
+  }
+  return cpus;
+}
+
+void runOnCpu(int cpu, const std::function<void()>& function) {
+  std::binary_semaphore pinned(0);
+  std::exception_ptr error;
+  std::thread thread([&] {
+    // Pages touched before the thread is pinned could land on any node.
+    pinned.acquire();
+    try {
+      function();
+    } catch (...) {
+      error = std::current_exception();
+    }
+  });
+  setThreadAffinity(thread, cpu);
+  pinned.release();
+  thread.join();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+}  // namespace mbucko
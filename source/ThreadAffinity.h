@@ -1,7 +1,11 @@
 #ifndef THREADAFFINITY_H
 #define THREADAFFINITY_H
 
+#include <cstddef>
+#include <functional>
+#include <string>
 #include <thread>
+#include <vector>
 
 namespace mbucko {
 
@@ -10,10 +14,72 @@ struct CoreInfo {
   int efficiencyCores = 0;
 };
 
+/// Returns the number of CPUs the process may run on. On Linux this honors
+/// the affinity mask, and thus isolcpus and cgroup cpusets.
 CoreInfo getCoreInfo();
 
 void setThreadAffinity(std::thread& t, int coreId);
 
+/// A logical CPU: an SMT thread of a physical core.
+struct CpuInfo {
+  int id = 0;
+  /// The physical core, unique within its package.
+  int core = 0;
+  int package = 0;
+  int node = 0;
+};
+
+/// The logical CPUs the process may run on, ordered by id.
+struct CpuTopology {
+  std::vector<CpuInfo> cpus;
+
+  /// Returns the number of NUMA nodes with at least one allowed CPU.
+  std::size_t nodes() const;
+};
+
+/// Discovers the CPUs the process may run on. On Linux, reads the affinity
+/// mask with sched_getaffinity() and the cores, packages and NUMA nodes of
+/// those CPUs from sysfs. Elsewhere, every CPU is its own core on node 0.
+CpuTopology discoverTopology();
+
+/// Reads the topology of the 'allowed' CPUs from a sysfs CPU directory laid
+/// out like /sys/devices/system/cpu. CPUs without topology information are
+/// their own core on package and node 0.
+CpuTopology readTopology(const std::string& cpu_dir,
+                         const std::vector<int>& allowed);
+
+/// How partition threads are pinned to CPUs.
+enum class PlacementPolicy {
+  /// One thread per physical core, filling the first SMT thread of every
+  /// core before any sibling is used.
+  kPhysicalCores,
+  /// Like kPhysicalCores, alternating between NUMA nodes, so that threads
+  /// are spread evenly across nodes.
+  kSpreadNodes,
+  /// Thread i on ThreadPlacement::cpus[i], wrapping around.
+  kExplicit,
+  /// Threads are not pinned.
+  kUnpinned,
+};
+
+struct ThreadPlacement {
+  PlacementPolicy policy = PlacementPolicy::kPhysicalCores;
+  /// The CPUs of PlacementPolicy::kExplicit.
+  std::vector<int> cpus{};
+};
+
+/// Returns the CPU each of 'threads' threads is pinned to under 'placement',
+/// or -1 for threads that are not pinned. With more threads than CPUs,
+/// threads wrap around.
+std::vector<int> placeThreads(const CpuTopology& topology,
+                              const ThreadPlacement& placement,
+                              std::size_t threads);
+
+/// Runs 'function' on a temporary thread pinned to 'cpu', and rethrows what
+/// it throws. Memory first touched by 'function' is then allocated on the
+/// NUMA node of 'cpu' under the default first-touch policy.
+void runOnCpu(int cpu, const std::function<void()>& function);
+
 }  // namespace mbucko
 
 #endif  // THREADAFFINITY_H
\ No newline at end of file
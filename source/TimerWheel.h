@@ -0,0 +1,196 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace mbucko {
+
+/// Identifies a timer armed with 'Proactor::process_after()' or
+/// 'Proactor::process_every()', to cancel it.
+struct TimerHandle {
+  /// The slot of a handle whose timer could not be armed.
+  static constexpr std::uint32_t kInvalidSlot = ~std::uint32_t{0};
+
+  std::size_t partition = 0;
+  std::uint32_t slot = kInvalidSlot;
+  std::uint32_t generation = 0;
+
+  /// Whether the timer was armed.
+  bool valid() const { return slot != kInvalidSlot; }
+};
+
+/// A timer scheduled in a TimerWheel. Timers embed their node, so that the
+/// wheel never allocates.
+struct TimerNode {
+  std::uint64_t deadline = 0;
+  TimerNode* prev = nullptr;
+  TimerNode* next = nullptr;
+  std::uint16_t bucket = 0;
+
+  bool scheduled() const { return prev != nullptr; }
+};
+
+/// A hierarchical timing wheel (Varghese and Lauck) over integer ticks: 4
+/// levels of 64 buckets, each bucket of a level spanning a whole revolution
+/// of the level below. Scheduling and cancelling are O(1); a timer cascades
+/// down at most 3 times before it expires. Deadlines more than 2^24 ticks
+/// away wait in the last level for as many revolutions as needed.
+///
+/// Not thread-safe: a wheel belongs to a single thread.
+class TimerWheel {
+ public:
+  static constexpr unsigned kLevelBits = 6;
+  static constexpr std::size_t kBuckets = std::size_t{1} << kLevelBits;
+  static constexpr std::size_t kLevels = 4;
+
+  explicit TimerWheel(std::uint64_t now = 0) : now_(now) {
+    for (auto& level : buckets_) {
+      for (TimerNode& head : level) {
+        head.prev = head.next = &head;
+      }
+    }
+  }
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  /// The last tick the wheel advanced to.
+  std::uint64_t now() const { return now_; }
+
+  std::size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  /// Schedules 'node' to expire at 'deadline', or at the next tick if the
+  /// deadline has passed. 'node' must not be scheduled already.
+  void schedule(TimerNode* node, std::uint64_t deadline) {
+    node->deadline = std::max(deadline, now_ + 1);
+    link(node);
+    ++size_;
+  }
+
+  /// Unschedules 'node', which must be scheduled.
+  void cancel(TimerNode* node) {
+    unlink(node);
+    --size_;
+  }
+
+  /// Advances the wheel to 'tick', calling 'expire(node)' for every node
+  /// whose deadline is reached, in deadline order. Expired nodes are no
+  /// longer scheduled, and 'expire' may schedule them again.
+  template <typename Expire>
+  void advance(std::uint64_t tick, Expire&& expire) {
+    while (now_ < tick) {
+      if (size_ == 0) {
+        now_ = tick;
+        return;
+      }
+      if (occupied_[0] == 0) {
+        // Nothing expires before the end of this revolution of level 0.
+        now_ = std::min(tick - 1, now_ | (kBuckets - 1));
+      }
+      ++now_;
+      cascade();
+      TimerNode& head = buckets_[0][now_ & (kBuckets - 1)];
+      while (head.next != &head) {
+        TimerNode* node = head.next;
+        cancel(node);
+        expire(node);
+      }
+    }
+  }
+
+  /// Returns a tick at or before the earliest deadline, at which the wheel
+  /// should be advanced next, or the maximum tick if the wheel is empty.
+  std::uint64_t nextTick() const {
+    if (size_ == 0) {
+      return std::numeric_limits<std::uint64_t>::max();
+    }
+    const unsigned offset = now_ & (kBuckets - 1);
+    const std::uint64_t later =
+        offset == kBuckets - 1
+            ? 0
+            : occupied_[0] & (~std::uint64_t{0} << (offset + 1));
+    if (later != 0) {
+      return (now_ & ~std::uint64_t{kBuckets - 1}) + std::countr_zero(later);
+    }
+    return (now_ | (kBuckets - 1)) + 1;
+  }
+
+ private:
+  static unsigned shift(std::size_t level) { return kLevelBits * level; }
+
+  // Links 'node' into the lowest level whose current revolution contains
+  // its deadline.
+  void link(TimerNode* node) {
+    std::size_t level = 0;
+    while (level + 1 < kLevels && (node->deadline >> shift(level + 1)) !=
+                                      (now_ >> shift(level + 1))) {
+      ++level;
+    }
+    const std::size_t index =
+        (node->deadline >> shift(level)) & (kBuckets - 1);
+    TimerNode& head = buckets_[level][index];
+    node->bucket = static_cast<std::uint16_t>(level * kBuckets + index);
+    node->prev = head.prev;
+    node->next = &head;
+    head.prev->next = node;
+    head.prev = node;
+    occupied_[level] |= std::uint64_t{1} << index;
+  }
+
+  void unlink(TimerNode* node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    const std::size_t level = node->bucket / kBuckets;
+    const std::size_t index = node->bucket % kBuckets;
+    const TimerNode& head = buckets_[level][index];
+    if (head.next == &head) {
+      occupied_[level] &= ~(std::uint64_t{1} << index);
+    }
+    node->prev = node->next = nullptr;
+  }
+
+  // At the start of a revolution of level 0, moves the timers of the bucket
+  // that just became current down, starting from the highest level that
+  // also started a revolution.
+  void cascade() {
+    std::size_t top = 0;
+    while (top + 1 < kLevels &&
+           (now_ & ((std::uint64_t{1} << shift(top + 1)) - 1)) == 0) {
+      ++top;
+    }
+    for (std::size_t level = top; level > 0; --level) {
+      const std::size_t index = (now_ >> shift(level)) & (kBuckets - 1);
+      TimerNode& head = buckets_[level][index];
+      if (head.next == &head) {
+        continue;
+      }
+      // Detach the bucket first: far timers of the last level go back into
+      // the same bucket.
+      TimerNode* node = head.next;
+      head.prev->next = nullptr;
+      head.prev = head.next = &head;
+      occupied_[level] &= ~(std::uint64_t{1} << index);
+      while (node != nullptr) {
+        TimerNode* next = node->next;
+        link(node);
+        node = next;
+      }
+    }
+  }
+
+  std::uint64_t now_;
+  std::size_t size_ = 0;
+  std::array<std::uint64_t, kLevels> occupied_{};
+  std::array<std::array<TimerNode, kBuckets>, kLevels> buckets_;
+};
+
+}  // namespace mbucko
+
+#endif  // TIMERWHEEL_H
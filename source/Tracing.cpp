@@ -0,0 +1,265 @@
+#include "Tracing.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+namespace mbucko {
+
+namespace {
+
+std::uint64_t steadyNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Every trace ring, and how to convert their timestamps to steady_clock
+// time: from a reference point taken when the registry is created, at the
+// rate measured between that point and the collection.
+struct TraceRegistry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<TraceRing>> rings;
+  // The rings of the threads that exited, reused by new threads.
+  std::vector<TraceRing*> free;
+  std::vector<std::string> names;
+  const std::uint64_t reference_timestamp = traceTimestamp();
+  const std::uint64_t reference_nanoseconds = steadyNanoseconds();
+};
+
+TraceRegistry& registry() {
+  static TraceRegistry* registry = new TraceRegistry();
+  return *registry;
+}
+
+// Nanoseconds per timestamp tick.
+double timestampRate(const TraceRegistry& registry) {
+#if defined(__x86_64__) || defined(__i386__)
+  // Measure over at least 10ms, for a precise rate.
+  constexpr std::uint64_t kMinInterval = 10 * 1000 * 1000;
+  std::uint64_t nanoseconds = steadyNanoseconds();
+  if (nanoseconds - registry.reference_nanoseconds < kMinInterval) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(
+        kMinInterval - (nanoseconds - registry.reference_nanoseconds)));
+    nanoseconds = steadyNanoseconds();
+  }
+  const std::uint64_t ticks = traceTimestamp() - registry.reference_timestamp;
+  return ticks == 0 ? 1.0
+                    : static_cast<double>(nanoseconds -
+                                          registry.reference_nanoseconds) /
+                          static_cast<double>(ticks);
+#else
+  return 1.0;
+#endif
+}
+
+const char* eventName(TraceEventType type) {
+  switch (type) {
+    case TraceEventType::kEnqueue:
+      return "enqueue";
+    case TraceEventType::kDequeue:
+      return "dequeue";
+    case TraceEventType::kExecuteBegin:
+    case TraceEventType::kExecuteEnd:
+      return "execute";
+    case TraceEventType::kCallbackBegin:
+    case TraceEventType::kCallbackEnd:
+      return "callback";
+  }
+  return "";
+}
+
+const char* eventPhase(TraceEventType type) {
+  switch (type) {
+    case TraceEventType::kExecuteBegin:
+    case TraceEventType::kCallbackBegin:
+      return "B";
+    case TraceEventType::kExecuteEnd:
+    case TraceEventType::kCallbackEnd:
+      return "E";
+    default:
+      return "i";
+  }
+}
+
+// Writes the common fields of an event, in microseconds for 'ts'.
+void writeEventHead(std::ostream& out, const char* name, const char* phase,
+                    const TraceRecord& record) {
+  out << "{\"name\":\"" << name << "\",\"cat\":\"proactor\",\"ph\":\""
+      << phase << "\",\"ts\":" << record.time.count() / 1000 << '.'
+      << std::setw(3) << std::setfill('0') << record.time.count() % 1000
+      << ",\"pid\":1,\"tid\":" << record.thread;
+}
+
+// Set once the calling thread returned its ring.
+thread_local bool trace_ring_returned = false;
+
+// Returns the ring of its thread to the free list when the thread exits.
+struct TraceRingReturner {
+  TraceRing* ring;
+
+  ~TraceRingReturner() {
+    TraceRegistry& traces = registry();
+    std::lock_guard<std::mutex> lock(traces.mutex);
+    traces.free.push_back(ring);
+    detail::trace_ring = nullptr;
+    trace_ring_returned = true;
+  }
+};
+
+}  // namespace
+
+namespace detail {
+
+TraceRing& registerTraceRing() {
+  TraceRegistry& traces = registry();
+  TraceRing* ring;
+  {
+    std::lock_guard<std::mutex> lock(traces.mutex);
+    if (!traces.free.empty()) {
+      ring = traces.free.back();
+      traces.free.pop_back();
+      ring->clear();
+    } else {
+      const auto id = static_cast<std::uint32_t>(traces.rings.size());
+      traces.rings.push_back(std::make_unique<TraceRing>(id));
+      traces.names.emplace_back();
+      ring = traces.rings.back().get();
+    }
+    traces.names[ring->id()] = "thread " + std::to_string(ring->id());
+  }
+  // A thread tracing from a thread_local destructor run after its returner
+  // keeps its new ring for good.
+  if (!trace_ring_returned) {
+    thread_local TraceRingReturner returner{ring};
+  }
+  trace_ring = ring;
+  return *ring;
+}
+
+}  // namespace detail
+
+void TraceRing::collect(std::vector<TraceRecord>& records) const {
+  const std::uint64_t head = head_.load(std::memory_order_acquire);
+  const std::uint64_t begin =
+      std::max(cleared_.load(std::memory_order_relaxed),
+               head > kCapacity ? head - kCapacity : 0);
+  const std::size_t first = records.size();
+  for (std::uint64_t i = begin; i < head; ++i) {
+    const Slot& slot = slots_[i & (kCapacity - 1)];
+    const std::uint64_t info = slot.info.load(std::memory_order_relaxed);
+    records.push_back(
+        {std::chrono::nanoseconds(
+             slot.timestamp.load(std::memory_order_relaxed)),
+         slot.flow.load(std::memory_order_relaxed),
+         static_cast<std::uint32_t>(info >> 8), id_,
+         static_cast<TraceEventType>(info & 0xFF)});
+  }
+  // Drop the slots the writer started to overwrite meanwhile.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const std::uint64_t writing = writing_.load(std::memory_order_relaxed);
+  if (writing > kCapacity && writing - kCapacity > begin) {
+    const std::uint64_t torn = std::min(writing - kCapacity, head) - begin;
+    records.erase(records.begin() + first,
+                  records.begin() + first + static_cast<std::ptrdiff_t>(torn));
+  }
+}
+
+void setTraceThreadName(std::string name) {
+  const std::uint32_t id = traceRing().id();
+  TraceRegistry& traces = registry();
+  std::lock_guard<std::mutex> lock(traces.mutex);
+  traces.names[id] = std::move(name);
+}
+
+std::vector<TraceRecord> collectTrace() {
+  TraceRegistry& traces = registry();
+  const double rate = timestampRate(traces);
+  std::vector<TraceRecord> records;
+  {
+    std::lock_guard<std::mutex> lock(traces.mutex);
+    for (const auto& ring : traces.rings) {
+      ring->collect(records);
+    }
+  }
+  for (TraceRecord& record : records) {
+    const auto ticks = static_cast<double>(
+        static_cast<std::int64_t>(record.time.count() -
+                                  traces.reference_timestamp));
+    record.time = std::chrono::nanoseconds(
+        traces.reference_nanoseconds +
+        static_cast<std::int64_t>(ticks * rate));
+  }
+  std::stable_sort(records.begin(), records.end(),
+                   [](const TraceRecord& a, const TraceRecord& b) {
+                     return a.time < b.time;
+                   });
+  return records;
+}
+
+void clearTrace() {
+  TraceRegistry& traces = registry();
+  std::lock_guard<std::mutex> lock(traces.mutex);
+  for (const auto& ring : traces.rings) {
+    ring->clear();
+  }
+}
+
+void writeChromeTrace(std::ostream& out) {
+  const std::vector<TraceRecord> records = collectTrace();
+  // The last execution of every flow ends its arrows.
+  std::unordered_map<std::uint64_t, std::size_t> last_execution;
+  for (std::size_t i = 0; i < records.size(); ++i) {
+    if (records[i].type == TraceEventType::kExecuteBegin) {
+      last_execution[records[i].flow] = i;
+    }
+  }
+
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  const char* separator = "\n";
+  {
+    TraceRegistry& traces = registry();
+    std::lock_guard<std::mutex> lock(traces.mutex);
+    for (std::size_t id = 0; id < traces.names.size(); ++id) {
+      out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+          << "\"tid\":" << id << ",\"args\":{\"name\":\"" << traces.names[id]
+          << "\"}}";
+      separator = ",\n";
+    }
+  }
+  std::unordered_map<std::uint64_t, bool> started;
+  for (std::size_t i = 0; i < records.size(); ++i) {
+    const TraceRecord& record = records[i];
+    out << separator;
+    separator = ",\n";
+    writeEventHead(out, eventName(record.type), eventPhase(record.type),
+                   record);
+    if (record.type == TraceEventType::kEnqueue ||
+        record.type == TraceEventType::kDequeue) {
+      out << ",\"s\":\"t\"";
+    }
+    out << ",\"args\":{\"flow\":" << record.flow
+        << ",\"partition\":" << record.partition << "}}";
+
+    const char* flow_phase = nullptr;
+    if (record.type == TraceEventType::kEnqueue) {
+      flow_phase = started[record.flow] ? "t" : "s";
+      started[record.flow] = true;
+    } else if (record.type == TraceEventType::kExecuteBegin &&
+               started[record.flow]) {
+      flow_phase = last_execution[record.flow] == i ? "f" : "t";
+    }
+    if (flow_phase != nullptr) {
+      out << separator;
+      writeEventHead(out, "message", flow_phase, record);
+      out << ",\"id\":" << record.flow << ",\"bp\":\"e\"}";
+    }
+  }
+  out << "\n]}\n";
+}
+
+}  // namespace mbucko
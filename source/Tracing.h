@@ -0,0 +1,191 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace mbucko {
+
+/// What a trace event marks in the life of a task.
+enum class TraceEventType : std::uint8_t {
+  /// A producer enqueued the task.
+  kEnqueue,
+  /// The partition dequeued the task, with the rest of its batch.
+  kDequeue,
+  kExecuteBegin,
+  kExecuteEnd,
+  kCallbackBegin,
+  kCallbackEnd,
+};
+
+/// A trace event, as returned by 'collectTrace()'.
+struct TraceRecord {
+  /// The steady_clock time of the event, since the clock's epoch.
+  std::chrono::nanoseconds time;
+  /// Identifies the message the task belongs to. A task enqueued while a
+  /// traced task or its callback runs carries on the flow of that task, so
+  /// a flow follows a message across chained Proactors.
+  std::uint64_t flow;
+  /// The partition the task was enqueued into.
+  std::uint32_t partition;
+  /// The thread that recorded the event, see 'setTraceThreadName()'.
+  std::uint32_t thread;
+  TraceEventType type;
+};
+
+/// Returns a timestamp for trace events: the TSC where available, which
+/// costs a few nanoseconds, and steady_clock nanoseconds otherwise.
+/// 'collectTrace()' converts timestamps to steady_clock time.
+inline std::uint64_t traceTimestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+/// The trace events of one thread: a ring of the last kCapacity events,
+/// written by the thread without locking or read-modify-writes, and read
+/// by 'collectTrace()' from any thread while it keeps being written to.
+class TraceRing {
+ public:
+  static constexpr std::size_t kCapacity = std::size_t{1} << 16;
+
+  explicit TraceRing(std::uint32_t id) : id_(id) {}
+
+  TraceRing(const TraceRing&) = delete;
+  TraceRing& operator=(const TraceRing&) = delete;
+
+  std::uint32_t id() const { return id_; }
+
+  void record(TraceEventType type, std::uint64_t flow, std::uint32_t partition,
+              std::uint64_t timestamp) {
+    const std::uint64_t head = head_.load(std::memory_order_relaxed);
+    // Announce the overwrite first: a reader that sees any of the new
+    // fields also sees 'writing_', and discards the slot.
+    writing_.store(head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    Slot& slot = slots_[head & (kCapacity - 1)];
+    slot.timestamp.store(timestamp, std::memory_order_relaxed);
+    slot.flow.store(flow, std::memory_order_relaxed);
+    slot.info.store((std::uint64_t{partition} << 8) |
+                        static_cast<std::uint8_t>(type),
+                    std::memory_order_relaxed);
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  /// Returns a flow id no other thread returns, without synchronization.
+  std::uint64_t newFlow() {
+    return (std::uint64_t{id_ + 1} << 40) | ++flows_;
+  }
+
+  /// Appends the events recorded since the last 'clear()' that are still
+  /// in the ring to 'records', with raw timestamps.
+  void collect(std::vector<TraceRecord>& records) const;
+
+  /// Makes 'collect()' skip the events recorded so far.
+  void clear() {
+    cleared_.store(head_.load(std::memory_order_acquire),
+                   std::memory_order_relaxed);
+  }
+
+ private:
+  struct Slot {
+    std::atomic<std::uint64_t> timestamp;
+    std::atomic<std::uint64_t> flow;
+    std::atomic<std::uint64_t> info;
+  };
+
+  const std::uint32_t id_;
+  std::uint64_t flows_ = 0;
+  std::atomic<std::uint64_t> head_{0};
+  std::atomic<std::uint64_t> writing_{0};
+  std::atomic<std::uint64_t> cleared_{0};
+  std::array<Slot, kCapacity> slots_;
+};
+
+namespace detail {
+
+TraceRing& registerTraceRing();
+
+inline thread_local TraceRing* trace_ring = nullptr;
+inline thread_local std::uint64_t trace_flow = 0;
+
+}  // namespace detail
+
+/// Returns the trace ring of the calling thread, registering it on first
+/// use. When a thread exits, its ring goes to a free list, where its events
+/// can still be collected until a new thread takes the ring over, which
+/// discards them. Memory is thus bounded by the peak number of threads
+/// tracing at once rather than by all threads ever traced.
+inline TraceRing& traceRing() {
+  TraceRing* ring = detail::trace_ring;
+  if (ring == nullptr) [[unlikely]] {
+    ring = &detail::registerTraceRing();
+  }
+  return *ring;
+}
+
+inline void traceEvent(TraceEventType type, std::uint64_t flow,
+                       std::uint32_t partition) {
+  traceRing().record(type, flow, partition, traceTimestamp());
+}
+
+/// Returns the flow of the traced task or callback running on the calling
+/// thread, or 0.
+inline std::uint64_t currentTraceFlow() { return detail::trace_flow; }
+
+/// Returns the flow of a task about to be enqueued: the current flow, or a
+/// new one outside of traced tasks.
+inline std::uint64_t traceFlowForEnqueue() {
+  const std::uint64_t flow = detail::trace_flow;
+  return flow != 0 ? flow : traceRing().newFlow();
+}
+
+/// Makes 'flow' the current flow of the calling thread for its lifetime.
+class TraceFlowScope {
+ public:
+  explicit TraceFlowScope(std::uint64_t flow) : previous_(detail::trace_flow) {
+    detail::trace_flow = flow;
+  }
+
+  ~TraceFlowScope() { detail::trace_flow = previous_; }
+
+  TraceFlowScope(const TraceFlowScope&) = delete;
+  TraceFlowScope& operator=(const TraceFlowScope&) = delete;
+
+ private:
+  const std::uint64_t previous_;
+};
+
+/// Names the calling thread in Chrome traces, e.g. "partition 3".
+void setTraceThreadName(std::string name);
+
+/// Returns the events of every thread still in their rings, ordered by
+/// time.
+std::vector<TraceRecord> collectTrace();
+
+/// Discards the events recorded so far.
+void clearTrace();
+
+/// Writes the events of 'collectTrace()' as Chrome trace JSON, which
+/// chrome://tracing and the Perfetto UI open: execution and callbacks as
+/// slices, enqueues and dequeues as instant events, and every flow as
+/// arrows from each enqueue to the execution it leads to.
+void writeChromeTrace(std::ostream& out);
+
+}  // namespace mbucko
+
+#endif  // TRACING_H
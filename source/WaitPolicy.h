@@ -0,0 +1,242 @@
+#ifndef WAITPOLICY_H
+#define WAITPOLICY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+#include "AdaptiveSleeper.h"
+#include "Futex.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace mbucko {
+
+/// Wait policies decide what a partition's worker thread does while its
+/// queue is empty. Each partition owns one instance, used as follows:
+///
+/// - 'wait(has_work)' is called by the worker when it found no work. It may
+///   return at any time; 'has_work()' reports whether the queue has become
+///   non-empty or the partition is stopping.
+/// - 'wait(has_work, deadline)' is called instead while the partition has
+///   timers; it must return by 'deadline', give or take the timer slack of
+///   the operating system.
+/// - 'reset()' is called by the worker after it found work.
+/// - 'notify()' is called by producers after every successful enqueue.
+
+/// Hints the CPU that the calling thread is spinning.
+inline void cpuRelax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+/// Spins on the queue with a pause instruction, never giving up the core.
+/// Lowest wake-up latency, but keeps one core fully busy per partition.
+class BusySpinWaitPolicy {
+ public:
+  template <typename HasWork>
+  void wait(HasWork&&) noexcept {
+    cpuRelax();
+  }
+
+  template <typename HasWork>
+  void wait(HasWork&&, std::chrono::steady_clock::time_point) noexcept {
+    cpuRelax();
+  }
+
+  void reset() noexcept {}
+
+  void notify() noexcept {}
+};
+
+/// Yields, then sleeps for increasingly long periods (1us up to 1ms), see
+/// AdaptiveSleeper. Producers never have to wake the worker up.
+class BackoffWaitPolicy {
+ public:
+  template <typename HasWork>
+  void wait(HasWork&&) {
+    sleeper_.sleep();
+  }
+
+  template <typename HasWork>
+  void wait(HasWork&&, std::chrono::steady_clock::time_point deadline) {
+    sleeper_.sleep(deadline);
+  }
+
+  void reset() noexcept { sleeper_.reset(); }
+
+  void notify() noexcept {}
+
+ private:
+  AdaptiveSleeper sleeper_;
+};
+
+/// Parks a single consumer thread on a futex until a producer wakes it up.
+/// Producers only issue the wake-up system call when they observe the
+/// consumer parked, so 'unpark()' is syscall-free while the consumer is busy.
+class Parker {
+ public:
+  /// Parks the calling (consumer) thread unless 'has_work()' returns true
+  /// after the consumer announced it is parking. May return spuriously.
+  template <typename HasWork>
+  void park(HasWork&& has_work) {
+    state_.store(kParked, std::memory_order_relaxed);
+    // Pairs with the fence in 'unpark()': either the producer sees the
+    // consumer parked, or the consumer sees the producer's work.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!has_work()) {
+      futexWait(state_, kParked);
+    }
+    state_.store(kRunning, std::memory_order_relaxed);
+  }
+
+  /// Same as 'park()', but returns by 'deadline'.
+  template <typename HasWork>
+  void park(HasWork&& has_work,
+            std::chrono::steady_clock::time_point deadline) {
+    state_.store(kParked, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!has_work()) {
+      futexWaitFor(state_, kParked,
+                   deadline - std::chrono::steady_clock::now());
+    }
+    state_.store(kRunning, std::memory_order_relaxed);
+  }
+
+  /// Wakes the consumer up if it is parked. Called by producers after they
+  /// published work.
+  void unpark() noexcept {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (state_.load(std::memory_order_relaxed) == kParked) [[unlikely]] {
+      uint32_t expected = kParked;
+      // Only one of the producers racing here issues the system call.
+      if (state_.compare_exchange_strong(expected, kRunning,
+                                         std::memory_order_relaxed)) {
+        futexWakeOne(state_);
+      }
+    }
+  }
+
+ private:
+  static constexpr uint32_t kRunning = 0;
+  static constexpr uint32_t kParked = 1;
+
+  std::atomic<uint32_t> state_{kRunning};
+};
+
+/// Parks any number of consumer threads on a futex until a producer signals
+/// new work. Like Parker, 'notify()' only issues the wake-up system call
+/// when a consumer is parked.
+class EventCount {
+ public:
+  /// Parks the calling (consumer) thread unless 'has_work()' returns true
+  /// after the consumer announced it is parking. May return spuriously.
+  template <typename HasWork>
+  void wait(HasWork&& has_work) {
+    const uint32_t epoch = epoch_.load(std::memory_order_relaxed);
+    waiters_.fetch_add(1, std::memory_order_relaxed);
+    // Pairs with the fence in 'notify()': either the producer sees the
+    // consumer waiting, and then moves the epoch past the one read above, or
+    // the consumer sees the producer's work.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!has_work()) {
+      futexWait(epoch_, epoch);
+    }
+    waiters_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  /// Wakes up all parked consumers. Called by producers after they
+  /// published work.
+  void notify() noexcept {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) != 0) [[unlikely]] {
+      epoch_.fetch_add(1, std::memory_order_relaxed);
+      futexWakeAll(epoch_);
+    }
+  }
+
+ private:
+  std::atomic<uint32_t> epoch_{0};
+  std::atomic<uint32_t> waiters_{0};
+};
+
+/// Spins briefly, then parks the worker, see Parker.
+///
+/// \tparam SPIN_ITERATIONS
+///     The number of empty polls before the worker parks.
+template <uint32_t SPIN_ITERATIONS = 128>
+class FutexWaitPolicy {
+ public:
+  template <typename HasWork>
+  void wait(HasWork&& has_work) {
+    if (spins_ < SPIN_ITERATIONS) {
+      ++spins_;
+      cpuRelax();
+      return;
+    }
+    parker_.park(std::forward<HasWork>(has_work));
+  }
+
+  template <typename HasWork>
+  void wait(HasWork&& has_work,
+            std::chrono::steady_clock::time_point deadline) {
+    if (spins_ < SPIN_ITERATIONS) {
+      ++spins_;
+      cpuRelax();
+      return;
+    }
+    parker_.park(std::forward<HasWork>(has_work), deadline);
+  }
+
+  void reset() noexcept { spins_ = 0; }
+
+  void notify() noexcept { parker_.unpark(); }
+
+ private:
+  Parker parker_;
+  uint32_t spins_ = 0;
+};
+
+/// Backs off like BackoffWaitPolicy (yields, then sleeps of 1us up to
+/// 100us), but instead of then sleeping for 1ms forever, parks the worker,
+/// see Parker. An idle partition stops consuming CPU time, and the first
+/// message after a quiet period wakes it up immediately.
+class AdaptiveWaitPolicy {
+ public:
+  template <typename HasWork>
+  void wait(HasWork&& has_work) {
+    if (sleeper_.isBackedOff()) {
+      parker_.park(std::forward<HasWork>(has_work));
+    } else {
+      sleeper_.sleep();
+    }
+  }
+
+  template <typename HasWork>
+  void wait(HasWork&& has_work,
+            std::chrono::steady_clock::time_point deadline) {
+    if (sleeper_.isBackedOff()) {
+      parker_.park(std::forward<HasWork>(has_work), deadline);
+    } else {
+      sleeper_.sleep(deadline);
+    }
+  }
+
+  void reset() noexcept { sleeper_.reset(); }
+
+  void notify() noexcept { parker_.unpark(); }
+
+ private:
+  AdaptiveSleeper sleeper_;
+  Parker parker_;
+};
+
+}  // namespace mbucko
+
+#endif  // WAITPOLICY_H
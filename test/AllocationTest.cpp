@@ -0,0 +1,205 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <type_traits>
+
+#include "Proactor.h"
+
+// This file is its own test binary: it replaces the global operator new, and
+// the other tests must keep the standard one.
+
+using ::testing::Eq;
+using namespace mbucko;
+
+namespace {
+// Set while 'countAllocations()' measures.
+std::atomic<bool> counting{false};
+std::atomic<uint64_t> allocations{0};
+
+// Returns the number of global allocations made by all threads while 'f'
+// runs.
+template <typename F>
+uint64_t countAllocations(F&& f) {
+  allocations.store(0);
+  counting.store(true);
+  f();
+  counting.store(false);
+  return allocations.load();
+}
+}  // namespace
+
+// Counts the global allocations made while 'counting' is set, so that the
+// allocation cost of enqueuing a message can be measured. Not inlined, so
+// that the compiler does not pair the malloc() and free() with new
+// expressions and delete expressions.
+[[gnu::noinline]] void* operator new(std::size_t size) {
+  if (counting.load(std::memory_order_relaxed)) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (void* ptr = std::malloc(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+[[gnu::noinline]] void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+class MathOperator {
+ public:
+  MathOperator(int64_t initial_value) : value_(initial_value) {}
+  int64_t add(int64_t value) {
+    value_ += value;
+    return value;
+  }
+  int64_t apply(const std::function<int64_t(MathOperator&)>& work) {
+    return work(*this);
+  }
+
+ private:
+  int64_t value_;
+};
+
+struct Hash {
+  std::size_t operator()(int key) const { return key; }
+};
+
+// The tasks of 'addBoxedValue()' hold a std::function next to their
+// callback.
+struct PipelineTraits : DefaultProactorTraits {
+  static constexpr std::size_t kTaskCapacity = 64;
+};
+
+struct MPMCTraits : PipelineTraits {
+  using QueuePolicy = MPMCQueuePolicy;
+};
+
+struct SPSCLanesTraits : PipelineTraits {
+  using QueuePolicy = SPSCLanesQueuePolicy<>;
+};
+
+struct QueueModeName {
+  template <typename T>
+  static std::string GetName(int) {
+    if constexpr (std::is_same_v<T, MPMCTraits>) {
+      return "MPMC";
+    } else {
+      return "SPSCLanes";
+    }
+  }
+};
+
+template <typename TRAITS>
+class AllocationTest : public ::testing::Test {
+ protected:
+  using key_type = int;
+
+  static constexpr std::size_t kPartitions = 10;
+  static constexpr std::size_t kQueueSize = 128 * 1024;
+
+  Proactor<key_type, Hash, 1, MathOperator, TRAITS> endLayer;
+  Proactor<key_type, Hash, kPartitions, MathOperator, TRAITS> midLayer;
+  Proactor<key_type, Hash, kPartitions, MathOperator, TRAITS> startLayer;
+
+  AllocationTest()
+      : endLayer(kQueueSize, 0ull),
+        midLayer(kQueueSize, 0ull),
+        startLayer(kQueueSize, 0ull) {}
+
+  void addValue(int key, int64_t value) {
+    startLayer.process(
+        key, &MathOperator::add,
+        [key, this](int64_t value) {
+          midLayer.process(
+              key, &MathOperator::add,
+              [key, this](int64_t value) {
+                endLayer.process(key, &MathOperator::add, [](int64_t) {},
+                                 value);
+              },
+              value);
+        },
+        value);
+  }
+
+  // Same as 'addValue()', with the work of every hop type-erased in a
+  // std::function, the way the partitions used to store their tasks.
+  void addBoxedValue(int key, int64_t value) {
+    startLayer.process(
+        key, &MathOperator::apply,
+        [key, this](int64_t value) {
+          midLayer.process(
+              key, &MathOperator::apply,
+              [key, this](int64_t value) {
+                endLayer.process(key, &MathOperator::apply, [](int64_t) {},
+                                 boxedAdd(value));
+              },
+              boxedAdd(value));
+        },
+        boxedAdd(value));
+  }
+
+  static std::function<int64_t(MathOperator&)> boxedAdd(int64_t value) {
+    return [func = &MathOperator::add, value](MathOperator& computable) {
+      return std::invoke(func, computable, value);
+    };
+  }
+
+  // Waits until every message sent through 'addValue()' reached the end
+  // layer. Callbacks run right after their task, so once a layer is
+  // drained, everything it forwarded is enqueued in the next one.
+  void wait() {
+    startLayer.drain();
+    midLayer.drain();
+    endLayer.drain();
+  }
+
+  ~AllocationTest() {
+    startLayer.stop();
+    midLayer.stop();
+    endLayer.stop();
+  }
+};
+
+using QueueModes = ::testing::Types<MPMCTraits, SPSCLanesTraits>;
+TYPED_TEST_SUITE(AllocationTest, QueueModes, QueueModeName);
+
+TYPED_TEST(AllocationTest, AllocationsPerMessage) {
+  constexpr uint64_t kMessages = 100 * 1000ull;
+  constexpr std::size_t kPartitions = TestFixture::kPartitions;
+
+  // The warm-up lets SPSC lanes allocate their rings for every producer
+  // thread, and the arenas their first chunks.
+  for (std::size_t key = 0; key < kPartitions; ++key) {
+    this->addBoxedValue(static_cast<int>(key), 1);
+    this->addValue(static_cast<int>(key), 1);
+  }
+  this->wait();
+
+  // Before: the three-layer pipeline with std::function tasks.
+  const uint64_t functionAllocations = countAllocations([this]() {
+    for (uint64_t i = 0; i < kMessages; ++i) {
+      this->addBoxedValue(static_cast<int>(i % kPartitions), 1);
+    }
+    this->wait();
+  });
+
+  // After: the same pipeline with InlineTask envelopes only.
+  const uint64_t taskAllocations = countAllocations([this]() {
+    for (uint64_t i = 0; i < kMessages; ++i) {
+      this->addValue(static_cast<int>(i % kPartitions), 1);
+    }
+    this->wait();
+  });
+
+  EXPECT_THAT(functionAllocations, ::testing::Ge(3 * kMessages));
+  EXPECT_THAT(taskAllocations, Eq(0u));
+}
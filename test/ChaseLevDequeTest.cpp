@@ -0,0 +1,70 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "ChaseLevDeque.h"
+
+using ::testing::Eq;
+using namespace mbucko;
+
+TEST(ChaseLevDequeTest, OwnerPopsLifoAndThievesStealFifo) {
+  ChaseLevDeque<int> deque(4);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(deque.push(i));
+  }
+  EXPECT_FALSE(deque.push(4));
+  int value = -1;
+  EXPECT_TRUE(deque.steal(value));
+  EXPECT_THAT(value, Eq(0));
+  EXPECT_TRUE(deque.pop(value));
+  EXPECT_THAT(value, Eq(3));
+  EXPECT_THAT(deque.sizeGuess(), Eq(2u));
+  EXPECT_TRUE(deque.pop(value));
+  EXPECT_TRUE(deque.pop(value));
+  EXPECT_THAT(value, Eq(1));
+  EXPECT_FALSE(deque.pop(value));
+  EXPECT_FALSE(deque.steal(value));
+}
+
+TEST(ChaseLevDequeTest, EveryElementIsTakenExactlyOnce) {
+  constexpr int kItems = 200000;
+  constexpr int kThieves = 3;
+  ChaseLevDeque<int> deque(64);
+  std::vector<std::atomic<int>> taken(kItems);
+  std::atomic<bool> done{false};
+  std::vector<std::thread> thieves;
+  for (int t = 0; t < kThieves; ++t) {
+    thieves.emplace_back([&]() {
+      int value;
+      while (!done.load(std::memory_order_acquire)) {
+        if (deque.steal(value)) {
+          taken[value].fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    });
+  }
+  int value;
+  for (int i = 0; i < kItems; ++i) {
+    while (!deque.push(i)) {
+      if (deque.pop(value)) {
+        taken[value].fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    if (i % 3 == 0 && deque.pop(value)) {
+      taken[value].fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  while (deque.pop(value)) {
+    taken[value].fetch_add(1, std::memory_order_relaxed);
+  }
+  done.store(true, std::memory_order_release);
+  for (std::thread& thief : thieves) {
+    thief.join();
+  }
+  for (int i = 0; i < kItems; ++i) {
+    ASSERT_THAT(taken[i].load(), Eq(1)) << i;
+  }
+}
@@ -0,0 +1,82 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "InlineTask.h"
+
+using ::testing::Eq;
+using namespace mbucko;
+
+namespace {
+
+using Task = InlineTask<int(int), 32>;
+using BoxingTask = InlineTask<int(int), 16, true>;
+
+}  // namespace
+
+TEST(InlineTaskTest, DefaultConstructedIsEmpty) {
+  Task task;
+  EXPECT_FALSE(static_cast<bool>(task));
+}
+
+TEST(InlineTaskTest, InvokesStoredCallable) {
+  int offset = 5;
+  Task task = [offset](int value) { return value + offset; };
+  ASSERT_TRUE(static_cast<bool>(task));
+  EXPECT_THAT(task(10), Eq(15));
+}
+
+TEST(InlineTaskTest, MoveTransfersCallable) {
+  auto counter = std::make_shared<int>(0);
+  Task task = [counter](int value) { return *counter += value; };
+  Task moved(std::move(task));
+  EXPECT_FALSE(static_cast<bool>(task));
+  EXPECT_THAT(moved(3), Eq(3));
+
+  Task assigned;
+  assigned = std::move(moved);
+  EXPECT_FALSE(static_cast<bool>(moved));
+  EXPECT_THAT(assigned(4), Eq(7));
+  EXPECT_THAT(counter.use_count(), Eq(2));
+}
+
+TEST(InlineTaskTest, ResetDestroysCallable) {
+  auto counter = std::make_shared<int>(0);
+  Task task = [counter](int value) { return value; };
+  EXPECT_THAT(counter.use_count(), Eq(2));
+  task.reset();
+  EXPECT_FALSE(static_cast<bool>(task));
+  EXPECT_THAT(counter.use_count(), Eq(1));
+}
+
+TEST(InlineTaskTest, OversizedCallableIsRejectedOrBoxed) {
+  using Oversized = std::array<int, 16>;
+  auto sum = [payload = Oversized{}](int value) { return value + payload[0]; };
+  static_assert(!Task::fitsInline<decltype(sum)>);
+
+  BoxingTask boxed = sum;
+  BoxingTask moved = std::move(boxed);
+  EXPECT_THAT(moved(2), Eq(2));
+}
+
+TEST(InlineTaskTest, TargetReturnsTheCallableOfTheGivenType) {
+  using Oversized = std::array<int, 16>;
+  auto add = [offset = 1](int value) { return value + offset; };
+  auto boxed_add = [payload = Oversized{2}](int value) {
+    return value + payload[0];
+  };
+
+  Task task = add;
+  ASSERT_THAT(task.target<decltype(add)>(), ::testing::NotNull());
+  EXPECT_THAT(task.target<decltype(boxed_add)>(), ::testing::IsNull());
+  EXPECT_THAT((*task.target<decltype(add)>())(1), Eq(2));
+
+  BoxingTask boxed = boxed_add;
+  ASSERT_THAT(boxed.target<decltype(boxed_add)>(), ::testing::NotNull());
+  EXPECT_THAT(boxed.target<decltype(add)>(), ::testing::IsNull());
+  EXPECT_THAT(Task().target<decltype(add)>(), ::testing::IsNull());
+}
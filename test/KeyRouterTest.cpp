@@ -0,0 +1,29 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "KeyRouter.h"
+
+using ::testing::Eq;
+using ::testing::Ge;
+using ::testing::Le;
+using namespace mbucko;
+
+TEST(SpaceSavingSketchTest, TracksHeavyHittersAmongManyKeys) {
+  SpaceSavingSketch<int, 8> sketch;
+  for (int i = 0; i < 10000; ++i) {
+    EXPECT_TRUE(sketch.tryRecord(i % 4 == 0 ? 42 : 1000 + i));
+    if (i % 5 == 0) {
+      EXPECT_TRUE(sketch.tryRecord(7));
+    }
+  }
+  const auto top = sketch.top();
+  ASSERT_THAT(top.size(), Eq(8u));
+  EXPECT_THAT(top[0].key, Eq(42));
+  EXPECT_THAT(top[0].count, Ge(2500u));
+  EXPECT_THAT(top[0].count - top[0].error, Le(2500u));
+  EXPECT_THAT(top[1].key, Eq(7));
+  EXPECT_THAT(top[1].count, Ge(2000u));
+
+  sketch.clear();
+  EXPECT_TRUE(sketch.top().empty());
+}
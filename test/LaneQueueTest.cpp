@@ -0,0 +1,82 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "LaneQueue.h"
+#include "SPSCQueue.h"
+
+using ::testing::Eq;
+using namespace mbucko;
+
+TEST(SPSCQueueTest, WriteFailsWhenFull) {
+  SPSCQueue<int> queue(4);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(queue.write(i));
+  }
+  EXPECT_FALSE(queue.write(4));
+  int value = -1;
+  EXPECT_TRUE(queue.read(value));
+  EXPECT_THAT(value, Eq(0));
+  EXPECT_TRUE(queue.write(4));
+}
+
+TEST(SPSCQueueTest, PreservesOrderAcrossThreads) {
+  constexpr int kItems = 100000;
+  SPSCQueue<int> queue(16);
+  std::thread producer([&queue]() {
+    for (int i = 0; i < kItems; ++i) {
+      while (!queue.write(i)) {
+      }
+    }
+  });
+  for (int expected = 0; expected < kItems; ++expected) {
+    int value = -1;
+    while (!queue.read(value)) {
+    }
+    ASSERT_THAT(value, Eq(expected));
+  }
+  producer.join();
+}
+
+TEST(SPSCQueueTest, BatchesArePartialWhenFull) {
+  SPSCQueue<int> queue(4);
+  EXPECT_TRUE(queue.write(-1));
+  EXPECT_THAT(queue.writeBatch(5, [](std::size_t i) { return int(i); }),
+              Eq(3u));
+  int values[8];
+  ASSERT_THAT(queue.readBatch(values, 8), Eq(4u));
+  EXPECT_THAT(values[0], Eq(-1));
+  EXPECT_THAT(values[3], Eq(2));
+  EXPECT_THAT(queue.readBatch(values, 8), Eq(0u));
+}
+
+TEST(LaneQueueTest, IsFifoPerProducer) {
+  constexpr int kProducers = 4;
+  constexpr int kItems = 20000;
+  LaneQueue<std::pair<int, int>, 2> queue(256);
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&queue, p]() {
+      for (int i = 0; i < kItems; ++i) {
+        queue.blockingWrite(p, i);
+      }
+    });
+  }
+
+  // Two producers get dedicated lanes, the others share the overflow lane.
+  std::vector<int> next(kProducers, 0);
+  for (int received = 0; received < kProducers * kItems;) {
+    std::pair<int, int> item;
+    if (queue.read(item)) {
+      ASSERT_THAT(item.second, Eq(next[item.first]));
+      ++next[item.first];
+      ++received;
+    }
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  EXPECT_TRUE(queue.isEmpty());
+}
@@ -0,0 +1,117 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "InlineTask.h"
+#include "PartitionArena.h"
+
+using ::testing::Eq;
+using namespace mbucko;
+
+namespace {
+
+// Counts the allocations that reach the upstream resource.
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  std::size_t allocations = 0;
+  std::size_t deallocations = 0;
+
+ protected:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+    ++allocations;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* pointer, std::size_t bytes,
+                     std::size_t alignment) override {
+    ++deallocations;
+    std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+  }
+
+  bool do_is_equal(const memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+}  // namespace
+
+TEST(PartitionArenaTest, ReusesBlocksOfTheSameSizeClass) {
+  CountingResource upstream;
+  {
+    PartitionArena arena(&upstream);
+    PartitionArena::setLocal(&arena);
+
+    void* first = arena.allocate(24);
+    EXPECT_THAT(upstream.allocations, Eq(1u));
+    arena.deallocate(first, 24);
+    // 24 and 32 bytes share a size class.
+    EXPECT_THAT(arena.allocate(32), Eq(first));
+    EXPECT_FALSE(arena.allocate(24) == first);
+    EXPECT_THAT(upstream.allocations, Eq(1u));
+
+    // Larger blocks go straight to the upstream resource.
+    void* large = arena.allocate(PartitionArena::kMaxBlockSize + 1);
+    EXPECT_THAT(upstream.allocations, Eq(2u));
+    arena.deallocate(large, PartitionArena::kMaxBlockSize + 1);
+
+    PartitionArena::setLocal(nullptr);
+  }
+}
+
+TEST(PartitionArenaTest, BlocksFreedByOtherThreadsReturnToTheOwner) {
+  constexpr std::size_t kBlocks = 1000;
+  CountingResource upstream;
+  PartitionArena arena(&upstream);
+  PartitionArena::setLocal(&arena);
+
+  std::vector<void*> blocks;
+  for (std::size_t i = 0; i < kBlocks; ++i) {
+    blocks.push_back(arena.allocate(64));
+  }
+  const std::size_t chunks = upstream.allocations;
+
+  std::vector<std::thread> freers;
+  for (std::size_t t = 0; t < 4; ++t) {
+    freers.emplace_back([&, t] {
+      for (std::size_t i = t; i < kBlocks; i += 4) {
+        arena.deallocate(blocks[i], 64);
+      }
+    });
+  }
+  for (std::thread& freer : freers) {
+    freer.join();
+  }
+
+  const std::set<void*> freed(blocks.begin(), blocks.end());
+  for (std::size_t i = 0; i < kBlocks; ++i) {
+    EXPECT_THAT(freed.count(arena.allocate(64)), Eq(1u));
+  }
+  EXPECT_THAT(upstream.allocations, Eq(chunks));
+
+  PartitionArena::setLocal(nullptr);
+}
+
+TEST(PartitionArenaTest, BoxedTaskKeepsItsArenaAlive) {
+  using Oversized = std::array<int, 16>;
+  CountingResource upstream;
+  PartitionArena::Ptr arena = PartitionArena::create(&upstream);
+  PartitionArena::setLocal(arena.get());
+  InlineTask<int(int), 16, true> task = [payload = Oversized{}](int value) {
+    return value + payload[0];
+  };
+  PartitionArena::setLocal(nullptr);
+
+  // The owner goes away first, e.g. a Proactor destroyed while a task it
+  // created waits in another Proactor's queue.
+  arena.reset();
+  EXPECT_THAT(upstream.deallocations, Eq(0u));
+  EXPECT_THAT(task(2), Eq(2));
+  task.reset();
+  EXPECT_THAT(upstream.deallocations, Eq(upstream.allocations));
+}
@@ -0,0 +1,49 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <limits>
+
+#include "PartitionMetrics.h"
+
+using ::testing::Eq;
+using ::testing::Ge;
+using ::testing::Le;
+using ::testing::Lt;
+using namespace mbucko;
+
+TEST(LatencyHistogramTest, BucketsBoundTheRelativeError) {
+  std::size_t previous = 0;
+  for (std::uint64_t value = 1; value < (std::uint64_t{1} << 40);
+       value += value / 7 + 1) {
+    const std::size_t bucket = LatencyHistogram::bucketOf(value);
+    ASSERT_THAT(bucket, Ge(previous));
+    ASSERT_THAT(bucket, Lt(LatencyHistogram::kBuckets));
+    const std::uint64_t upper = LatencyHistogram::bucketUpperBound(bucket);
+    EXPECT_THAT(upper, Ge(value));
+    EXPECT_THAT(upper - value, Le(value / LatencyHistogram::kSubBuckets));
+    previous = bucket;
+  }
+  const std::uint64_t max = std::numeric_limits<std::uint64_t>::max();
+  EXPECT_THAT(LatencyHistogram::bucketOf(max),
+              Eq(LatencyHistogram::kBuckets - 1));
+  EXPECT_THAT(
+      LatencyHistogram::bucketUpperBound(LatencyHistogram::kBuckets - 1),
+      Eq(max));
+}
+
+TEST(LatencyHistogramTest, SnapshotReportsPercentiles) {
+  LatencyHistogram histogram;
+  for (std::uint64_t value = 1; value <= 1000; ++value) {
+    histogram.record(value * 1000);
+  }
+  const HistogramSnapshot snapshot = histogram.snapshot();
+  EXPECT_THAT(snapshot.count, Eq(1000u));
+  EXPECT_THAT(snapshot.max, Eq(1000000u));
+  EXPECT_THAT(snapshot.mean(), Eq(500500u));
+  EXPECT_THAT(snapshot.percentile(0.5), Ge(500000u));
+  EXPECT_THAT(snapshot.percentile(0.5), Le(500000u * 9 / 8));
+  EXPECT_THAT(snapshot.percentile(0.99), Ge(990000u));
+  EXPECT_THAT(snapshot.percentile(1.0), Eq(1000000u));
+  EXPECT_THAT(HistogramSnapshot().percentile(0.5), Eq(0u));
+}
@@ -0,0 +1,49 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+
+#include "Partitions.h"
+
+using ::testing::Eq;
+using ::testing::Lt;
+using namespace mbucko;
+
+TEST(JumpConsistentHashTest, StaysWithinBuckets) {
+  for (std::uint64_t hash = 0; hash < 10000; ++hash) {
+    EXPECT_THAT(jumpConsistentHash(hash * 7919, 13), Lt(13u));
+  }
+  EXPECT_THAT(jumpConsistentHash(12345, 1), Eq(0u));
+}
+
+TEST(JumpConsistentHashTest, GrowingOnlyMovesKeysToTheNewBucket) {
+  constexpr std::uint64_t kKeys = 100000;
+  constexpr std::size_t kBuckets = 10;
+  std::uint64_t moved = 0;
+  for (std::uint64_t key = 0; key < kKeys; ++key) {
+    const std::uint64_t hash = key * 0x9E3779B97F4A7C15ull;
+    const std::size_t before = jumpConsistentHash(hash, kBuckets);
+    const std::size_t after = jumpConsistentHash(hash, kBuckets + 1);
+    if (before != after) {
+      EXPECT_THAT(after, Eq(kBuckets));
+      ++moved;
+    }
+  }
+  // About 1/11 of the keys move; modulo would move about 10/11 of them.
+  EXPECT_THAT(moved, Lt(kKeys / 8));
+  EXPECT_THAT(kKeys / 12, Lt(moved));
+}
+
+TEST(DynamicBitsetTest, MatchesBitsetSemantics) {
+  DynamicBitset bits(70);
+  EXPECT_TRUE(bits.none());
+  bits.set();
+  EXPECT_TRUE(bits.all());
+  EXPECT_THAT(bits.count(), Eq(70u));
+  bits.reset(65);
+  bits.set(3, false);
+  EXPECT_FALSE(bits.all());
+  EXPECT_FALSE(bits.test(65));
+  EXPECT_TRUE(bits.test(64));
+  EXPECT_THAT(bits.count(), Eq(68u));
+}
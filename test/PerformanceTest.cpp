@@ -4,12 +4,12 @@
 #include <gtest/gtest.h>
 
 #include <atomic>
-#include <chrono>
 #include <cstdint>
-#include <memory>
 #include <semaphore>
+#include <string>
 #include <thread>
-#include <utility>
+#include <type_traits>
+#include <vector>
 
 #include "Proactor.h"
 
@@ -33,74 +33,69 @@ struct Hash {
   std::size_t operator()(int key) const { return key; }
 };
 
+struct MPMCTraits : DefaultProactorTraits {
+  using QueuePolicy = MPMCQueuePolicy;
+};
+
+struct SPSCLanesTraits : DefaultProactorTraits {
+  using QueuePolicy = SPSCLanesQueuePolicy<>;
+};
+
+struct QueueModeName {
+  template <typename T>
+  static std::string GetName(int) {
+    if constexpr (std::is_same_v<T, MPMCTraits>) {
+      return "MPMC";
+    } else {
+      return "SPSCLanes";
+    }
+  }
+};
+
+template <typename TRAITS>
 class PerformanceTest : public ::testing::Test {
  protected:
   using key_type = int;
 
-  static constexpr std::size_t kPartitions = 10;
   static constexpr std::size_t kQueueSize = 128 * 1024;
 
-  Proactor<key_type, Hash, 1, MathOperator> endLayer;
-  Proactor<key_type, Hash, kPartitions, MathOperator> midLayer;
-  Proactor<key_type, Hash, kPartitions, MathOperator> startLayer;
-
-  PerformanceTest()
-      : endLayer(kQueueSize, 0ull),
-        midLayer(kQueueSize, 0ull),
-        startLayer(kQueueSize, 0ull) {}
-
-  void addValue(int key, int64_t value) {
-    startLayer.process(
-        key, &MathOperator::add,
-        [key, this](int64_t value) {
-          midLayer.process(
-              key, &MathOperator::add,
-              [key, this](int64_t value) {
-                endLayer.process(
-                    key, &MathOperator::add, [key](int64_t value) {}, value);
-              },
-              value);
-        },
-        value);
-  }
+  Proactor<key_type, Hash, 1, MathOperator, TRAITS> proactor;
 
-  void wait() {
-    std::counting_semaphore<kPartitions> semaphore{0};
-    startLayer.process(&MathOperator::get,
-                       [&semaphore](int64_t) { semaphore.release(); });
-    for (int i = 0; i < kPartitions; ++i) {
-      semaphore.acquire();
-    }
-    midLayer.process(&MathOperator::get,
-                     [&semaphore](int64_t) { semaphore.release(); });
-    for (int i = 0; i < kPartitions; ++i) {
-      semaphore.acquire();
-    }
-    endLayer.process(0, &MathOperator::get,
-                     [&semaphore](int64_t) { semaphore.release(); });
-    semaphore.acquire();
-  }
+  PerformanceTest() : proactor(kQueueSize, 0ull) {}
 
-  ~PerformanceTest() {
-    startLayer.stop();
-    midLayer.stop();
-    endLayer.stop();
-  }
+  ~PerformanceTest() { proactor.stop(); }
 };
 
-TEST_F(PerformanceTest, Timed_100M_Messages) {
-  constexpr uint64_t kMessages = 10 * 1000 * 1000ull;
-  std::counting_semaphore<1> semaphore{0};
-  for (uint64_t i = 0; i < kMessages; ++i) {
-    addValue(static_cast<int>(i % kPartitions), 1);
+using QueueModes = ::testing::Types<MPMCTraits, SPSCLanesTraits>;
+TYPED_TEST_SUITE(PerformanceTest, QueueModes, QueueModeName);
+
+TYPED_TEST(PerformanceTest, ManyProducersOneHotPartition) {
+  constexpr std::size_t kProducers = 12;
+  constexpr uint64_t kMessagesPerProducer = 200 * 1000ull;
+  std::counting_semaphore<kProducers> semaphore{0};
+  std::vector<std::thread> producers;
+  for (std::size_t p = 0; p < kProducers; ++p) {
+    producers.emplace_back([this, &semaphore]() {
+      for (uint64_t i = 0; i < kMessagesPerProducer; ++i) {
+        this->proactor.process(0, &MathOperator::add, [](int64_t) {}, 1);
+      }
+      this->proactor.process(0, &MathOperator::get,
+                             [&semaphore](int64_t) { semaphore.release(); });
+    });
+  }
+  for (std::size_t p = 0; p < kProducers; ++p) {
+    semaphore.acquire();
+  }
+  for (auto& producer : producers) {
+    producer.join();
   }
-  wait();
   std::atomic<int64_t> retrievedSum = 0ull;
-  endLayer.process(0, &MathOperator::get,
-                   [&retrievedSum, &semaphore](int64_t sum) {
-                     retrievedSum = sum;
-                     semaphore.release();
-                   });
+  this->proactor.process(0, &MathOperator::get,
+                         [&retrievedSum, &semaphore](int64_t sum) {
+                           retrievedSum = sum;
+                           semaphore.release();
+                         });
   semaphore.acquire();
-  EXPECT_THAT(static_cast<int64_t>(retrievedSum), kMessages);
-}
\ No newline at end of file
+  EXPECT_THAT(static_cast<int64_t>(retrievedSum),
+              kProducers * kMessagesPerProducer);
+}
@@ -1,16 +1,29 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <chrono>
+#include <coroutine>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <semaphore>
+#include <sstream>
 #include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "Accumulator.h"
+#include "CompletionThreadPool.h"
 #include "Proactor.h"
 
 using ::testing::Eq;
+using ::testing::Ge;
+using ::testing::HasSubstr;
 using namespace mbucko;
 using namespace mbucko_test;
 
@@ -93,4 +106,1331 @@ TEST_F(ProactorTest, NonBlockingApi) {
   EXPECT_THAT(retrievedSum0, Eq(114u));
   EXPECT_THAT(retrievedSum1, Eq(117u));
   EXPECT_THAT(retrievedSum2, Eq(111u));
-}
\ No newline at end of file
+}
+
+class BatchRecorder {
+ public:
+  void onBatchBegin() {
+    ++batches_;
+    in_batch_ = true;
+  }
+
+  void onBatchEnd() { in_batch_ = false; }
+
+  bool add(uint32_t value) {
+    sum_ += value;
+    return in_batch_;
+  }
+
+  uint64_t batches() const { return batches_; }
+
+  uint64_t sum() const { return sum_; }
+
+ private:
+  bool in_batch_ = false;
+  uint64_t batches_ = 0;
+  uint64_t sum_ = 0;
+};
+
+struct SmallBatchTraits : DefaultProactorTraits {
+  static constexpr std::size_t kBatchSize = 4;
+};
+
+TEST(ProactorBatchTest, RunsTasksInsideBatchHooks) {
+  constexpr uint32_t kMessages = 1000;
+  Proactor<int, Hash, 1, BatchRecorder, SmallBatchTraits> proactor(kMessages);
+  std::atomic<uint32_t> outside_batch{0};
+  for (uint32_t i = 1; i <= kMessages; ++i) {
+    proactor.process(
+        0, &BatchRecorder::add,
+        [&outside_batch](bool in_batch) {
+          if (!in_batch) {
+            ++outside_batch;
+          }
+        },
+        i);
+  }
+
+  uint64_t batches = 0;
+  uint64_t sum = 0;
+  std::binary_semaphore semaphore{0};
+  proactor.process(0, &BatchRecorder::batches, [&](uint64_t value) {
+    batches = value;
+    semaphore.release();
+  });
+  semaphore.acquire();
+  proactor.process(0, &BatchRecorder::sum, [&](uint64_t value) {
+    sum = value;
+    semaphore.release();
+  });
+  semaphore.acquire();
+  proactor.stop();
+
+  EXPECT_THAT(outside_batch.load(), Eq(0u));
+  EXPECT_THAT(sum, Eq(uint64_t{kMessages} * (kMessages + 1) / 2));
+  // Batches hold at most 4 tasks.
+  EXPECT_GE(batches, (kMessages + 1) / 4);
+}
+
+TEST_F(ProactorTest, BatchApi) {
+  std::vector<std::pair<int, uint32_t>> items;
+  for (int i = 0; i < 100; ++i) {
+    items.emplace_back(i % 3, static_cast<uint32_t>(i));
+  }
+  std::atomic<uint32_t> callbacks{0};
+  proactor.process_batch(items, &Accumulator::add,
+                         [&callbacks]() { ++callbacks; });
+
+  uint32_t retrievedSum0{0};
+  uint32_t retrievedSum2{0};
+  std::counting_semaphore<kPartitions> semaphore{0};
+  proactor.process(0, &Accumulator::get, [&](uint32_t sum) {
+    retrievedSum0 = sum;
+    semaphore.release();
+  });
+  proactor.process(2, &Accumulator::get, [&](uint32_t sum) {
+    retrievedSum2 = sum;
+    semaphore.release();
+  });
+  semaphore.acquire();
+  semaphore.acquire();
+  EXPECT_THAT(callbacks.load(), Eq(100u));
+  // 0 + 3 + ... + 99 and 2 + 5 + ... + 98 on top of the initial 110.
+  EXPECT_THAT(retrievedSum0, Eq(110u + 1683u));
+  EXPECT_THAT(retrievedSum2, Eq(110u + 1650u));
+}
+
+class Gate {
+ public:
+  void hold(std::binary_semaphore* entered, std::binary_semaphore* release) {
+    entered->release();
+    release->acquire();
+  }
+
+  void add(int value) { sum_ += value; }
+
+  int get() const { return sum_; }
+
+  void report(int* sum, std::binary_semaphore* done) const {
+    *sum = sum_;
+    done->release();
+  }
+
+ private:
+  int sum_ = 0;
+};
+
+struct Identity {
+  std::size_t operator()(int key) const { return key; }
+};
+
+TEST(ProactorBatchTest, TryBatchReportsAcceptedItemsPerPartition) {
+  constexpr std::size_t kCapacity = 4;
+  Proactor<int, Identity, 2, Gate> proactor(kCapacity);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  proactor.process(1, &Gate::hold, []() {}, &entered, &release);
+  entered.acquire();
+
+  // Partition 1 is busy with an empty queue, partition 0 is idle.
+  std::vector<std::tuple<int, int>> items;
+  for (int i = 0; i < 6; ++i) {
+    items.emplace_back(1, 1);
+  }
+  items.emplace_back(0, 5);
+  const auto accepted =
+      proactor.try_process_batch(items, &Gate::add, []() {});
+  EXPECT_THAT(accepted[0], Eq(1u));
+  EXPECT_THAT(accepted[1], Eq(kCapacity));
+  release.release();
+
+  int sum = 0;
+  std::binary_semaphore done{0};
+  proactor.process(1, &Gate::get, [&](int value) {
+    sum = value;
+    done.release();
+  });
+  done.acquire();
+  proactor.stop();
+  EXPECT_THAT(sum, Eq(static_cast<int>(kCapacity)));
+}
+
+TEST_F(ProactorTest, BroadcastCallsDoneAfterAllCallbacks) {
+  std::atomic<std::size_t> callbacks{0};
+  std::size_t callbacks_at_done = 0;
+  std::binary_semaphore done{0};
+  proactor.broadcast(
+      &Accumulator::add, [&callbacks]() { ++callbacks; },
+      [&]() {
+        callbacks_at_done = callbacks;
+        done.release();
+      },
+      1u);
+  done.acquire();
+  EXPECT_THAT(callbacks_at_done, Eq(kPartitions));
+  EXPECT_THAT(proactor.process_async(3, &Accumulator::get).get(), Eq(111u));
+}
+
+TEST(ProactorBroadcastTest, TryBroadcastReportsRejectedPartitions) {
+  Proactor<int, Identity, 2, Gate> proactor(4);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  proactor.process(1, &Gate::hold, []() {}, &entered, &release);
+  entered.acquire();
+  int queued = 0;
+  while (proactor.try_process(1, &Gate::add, []() {}, 1)) {
+    ++queued;
+  }
+
+  // Partition 1 is busy with a full queue, partition 0 is idle.
+  std::binary_semaphore done{0};
+  const auto accepted = proactor.try_broadcast(
+      &Gate::add, []() {}, [&done]() { done.release(); }, 10);
+  EXPECT_TRUE(accepted.test(0));
+  EXPECT_FALSE(accepted.test(1));
+  done.acquire();
+  EXPECT_FALSE(proactor.try_process(&Gate::add, []() {}, 100));
+  release.release();
+
+  int sum0 = 0;
+  int sum1 = 0;
+  std::binary_semaphore reported0{0};
+  std::binary_semaphore reported1{0};
+  proactor.process(0, &Gate::report, []() {}, &sum0, &reported0);
+  proactor.process(1, &Gate::report, []() {}, &sum1, &reported1);
+  reported0.acquire();
+  reported1.acquire();
+  proactor.stop();
+  EXPECT_THAT(sum0, Eq(110));
+  EXPECT_THAT(sum1, Eq(queued));
+}
+
+TEST_F(ProactorTest, MapReduceSumsAllPartitions) {
+  proactor.process(0, &Accumulator::add, []() {}, 1u);
+  std::binary_semaphore done{0};
+  uint32_t total = 0;
+  proactor.map_reduce(&Accumulator::get, std::plus<>(), [&](uint32_t sum) {
+    total = sum;
+    done.release();
+  });
+  done.acquire();
+  EXPECT_THAT(total, Eq(kPartitions * 110u + 1u));
+}
+
+TEST(ProactorBroadcastTest, MapReduceFoldsInPartitionOrder) {
+  Proactor<int, Identity, 3, Gate> proactor(16);
+  for (int i = 0; i < 3; ++i) {
+    proactor.process(i, &Gate::add, []() {}, i + 1);
+  }
+  std::binary_semaphore done{0};
+  int digits = 0;
+  proactor.map_reduce(
+      &Gate::get, [](int high, int low) { return high * 10 + low; },
+      [&](int value) {
+        digits = value;
+        done.release();
+      });
+  done.acquire();
+  proactor.stop();
+  EXPECT_THAT(digits, Eq(123));
+}
+
+TEST(ProactorDynamicTest, PartitionCountIsChosenAtConstruction) {
+  using DynamicProactor = Proactor<int, Hash, kDynamicPartitions, Gate>;
+  DynamicProactor proactor(ProactorOptions{.capacity = 64, .partitions = 7});
+  ASSERT_THAT(proactor.partition_count(), Eq(7u));
+  for (int key = 0; key < 100; ++key) {
+    proactor.process(key, &Gate::add, []() {}, 1);
+  }
+  EXPECT_TRUE(proactor.try_broadcast(&Gate::add, []() {}, []() {}, 0).all());
+  std::binary_semaphore done{0};
+  int total = 0;
+  proactor.map_reduce(&Gate::get, std::plus<>(), [&](int sum) {
+    total = sum;
+    done.release();
+  });
+  done.acquire();
+  proactor.stop();
+  EXPECT_THAT(total, Eq(100));
+
+  DynamicProactor per_core(64);
+  EXPECT_THAT(per_core.partition_count(), ::testing::Ge(1u));
+  per_core.stop();
+}
+
+// Keeps its values in the memory resource it is constructed with.
+class PmrLog {
+ public:
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
+  explicit PmrLog(allocator_type allocator) : values_(allocator) {}
+
+  void append(int value) { values_.push_back(value); }
+
+  // Whether the values live in the arena of the calling partition thread.
+  bool usesPartitionArena() const {
+    return PartitionArena::local() != nullptr &&
+           values_.get_allocator().resource() == PartitionArena::local();
+  }
+
+  std::size_t size() const { return values_.size(); }
+
+ private:
+  std::pmr::vector<int> values_;
+};
+
+TEST(ProactorArenaTest, ComputableAllocatesFromItsPartitionArena) {
+  Proactor<int, Hash, 2, PmrLog> proactor(64);
+  for (int value = 0; value < 100; ++value) {
+    proactor.process(value, &PmrLog::append, []() {}, value);
+  }
+  std::atomic<int> in_arena{0};
+  std::atomic<std::size_t> total{0};
+  proactor.broadcast(
+      &PmrLog::usesPartitionArena, [&](bool uses) { in_arena += uses; },
+      []() {});
+  proactor.broadcast(
+      &PmrLog::size, [&](std::size_t size) { total += size; }, []() {});
+  proactor.stop();
+  EXPECT_THAT(in_arena.load(), Eq(2));
+  EXPECT_THAT(total.load(), Eq(100u));
+}
+
+// Logs, per key, the values appended in order, and hands a key's log over
+// when the key moves to another partition.
+class KeyedLog {
+ public:
+  void append(int key, int value) { log_[key].push_back(value); }
+
+  std::vector<int> get(int key) const {
+    const auto it = log_.find(key);
+    return it == log_.end() ? std::vector<int>() : it->second;
+  }
+
+  std::vector<int> exportKey(int key) {
+    auto node = log_.extract(key);
+    return node ? std::move(node.mapped()) : std::vector<int>();
+  }
+
+  void importKey(int key, std::vector<int>&& values) {
+    log_[key] = std::move(values);
+  }
+
+ private:
+  std::unordered_map<int, std::vector<int>> log_;
+};
+
+struct HotKeyTraits : DefaultProactorTraits {
+  static constexpr bool kHotKeyTracking = true;
+  static constexpr std::size_t kHotKeySampleRate = 1;
+};
+
+TEST(ProactorHotKeyTest, ReportsHotKeysAndPartitionLoads) {
+  Proactor<int, Identity, 4, KeyedLog, HotKeyTraits> proactor(1024);
+  for (int i = 0; i < 1000; ++i) {
+    const int key = i % 10 == 0 ? 7 : i;
+    proactor.process(key, &KeyedLog::append, []() {}, key, i);
+  }
+  const auto hot_keys = proactor.hot_keys();
+  ASSERT_FALSE(hot_keys.empty());
+  EXPECT_THAT(hot_keys.front().key, Eq(7));
+  EXPECT_THAT(hot_keys.front().count, ::testing::Ge(100u));
+  const auto loads = proactor.partition_loads();
+  EXPECT_THAT(loads[0] + loads[1] + loads[2] + loads[3], Eq(1000u));
+  proactor.stop();
+}
+
+TEST(ProactorHotKeyTest, MigrationPreservesPerKeyOrder) {
+  constexpr int kMessages = 20000;
+  static constexpr int kKey = 5;
+  Proactor<int, Identity, 4, KeyedLog, HotKeyTraits> proactor(64);
+  std::thread producer([&proactor]() {
+    for (int i = 0; i < kMessages; ++i) {
+      proactor.process(kKey, &KeyedLog::append, []() {}, kKey, i);
+      proactor.process(i, &KeyedLog::append, []() {}, i, i);
+    }
+  });
+  for (std::size_t target : {2, 3, 0, 1, 2}) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    proactor.migrate_key(kKey, target);
+    EXPECT_THAT(proactor.partition_of(kKey), Eq(target));
+  }
+  producer.join();
+
+  const std::vector<int> log =
+      proactor.process_async(kKey, &KeyedLog::get, kKey).get();
+  proactor.stop();
+  ASSERT_THAT(log.size(), Eq(static_cast<std::size_t>(kMessages + 1)));
+  std::vector<int> expected;
+  for (int i = 0; i < kMessages; ++i) {
+    expected.push_back(i);
+    if (i == kKey) {
+      expected.push_back(kKey);
+    }
+  }
+  EXPECT_THAT(log, Eq(expected));
+}
+
+TEST(ProactorHotKeyTest, RebalanceMovesHotKeyOffTheBusiestPartition) {
+  Proactor<int, Identity, 4, KeyedLog, HotKeyTraits> proactor(1024);
+  for (int i = 0; i < 400; ++i) {
+    const int key = i % 2 == 0 ? 0 : 4 * (i % 5);
+    proactor.process(key, &KeyedLog::append, []() {}, key, i);
+  }
+  ASSERT_THAT(proactor.partition_of(0), Eq(0u));
+  EXPECT_TRUE(proactor.rebalance());
+  EXPECT_THAT(proactor.partition_of(0), ::testing::Ne(0u));
+  EXPECT_THAT(proactor.partition_loads()[0], Eq(0u));
+  proactor.stop();
+}
+
+TEST(ProactorHotKeyTest, RebalanceMovesTheKeyThatEvensTheLoadsOut) {
+  Proactor<int, Identity, 4, KeyedLog, HotKeyTraits> proactor(1024);
+  constexpr int kKeys[] = {0, 0, 0, 4, 4, 1, 2, 3};
+  for (int i = 0; i < 400; ++i) {
+    const int key = kKeys[i % 8];
+    proactor.process(key, &KeyedLog::append, []() {}, key, i);
+  }
+  // Partition 0 runs 150 tasks of key 0 and 100 of key 4, the others 50.
+  // Moving key 0 would leave 200 tasks on partition 1, moving key 4 150.
+  EXPECT_TRUE(proactor.rebalance());
+  EXPECT_THAT(proactor.partition_of(4), Eq(1u));
+  EXPECT_THAT(proactor.partition_of(0), Eq(0u));
+  proactor.stop();
+}
+
+// Logs values in the order their tasks ran, and can hold its partition.
+class OrderLog {
+ public:
+  void hold(std::binary_semaphore* entered, std::binary_semaphore* release) {
+    entered->release();
+    release->acquire();
+  }
+
+  void append(int value) { log_.push_back(value); }
+
+  std::vector<int> get() const { return log_; }
+
+ private:
+  std::vector<int> log_;
+};
+
+template <std::size_t LANES, std::size_t BUDGET>
+struct PriorityTraits : DefaultProactorTraits {
+  static constexpr std::size_t kBatchSize = 1;
+  static constexpr std::size_t kPriorityLanes = LANES;
+  static constexpr std::size_t kPriorityBudget = BUDGET;
+};
+
+TEST(ProactorPriorityTest, HigherLanesRunFirst) {
+  Proactor<int, Identity, 1, OrderLog, PriorityTraits<3, 8>> proactor(16);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+  entered.acquire();
+  proactor.process(0, &OrderLog::append, []() {}, 1);
+  proactor.process(0, Priority::kNormal, &OrderLog::append, []() {}, 2);
+  proactor.process(0, Priority::kHigh, &OrderLog::append, []() {}, 10);
+  // Above the highest lane, so in the highest lane.
+  proactor.process(0, Priority::kCritical, &OrderLog::append, []() {}, 20);
+  EXPECT_TRUE(
+      proactor.try_process(0, Priority::kHigh, &OrderLog::append, []() {}, 11));
+  release.release();
+  const std::vector<int> log = proactor.process_async(0, &OrderLog::get).get();
+  proactor.stop();
+  EXPECT_THAT(log, Eq(std::vector<int>{20, 10, 11, 1, 2}));
+}
+
+TEST(ProactorPriorityTest, BudgetLetsLowerLanesMakeProgress) {
+  Proactor<int, Identity, 1, OrderLog, PriorityTraits<2, 2>> proactor(16);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+  entered.acquire();
+  proactor.process(0, &OrderLog::append, []() {}, 1);
+  proactor.process(0, &OrderLog::append, []() {}, 2);
+  for (int i = 10; i < 16; ++i) {
+    proactor.process(0, Priority::kHigh, &OrderLog::append, []() {}, i);
+  }
+  release.release();
+  const std::vector<int> log = proactor.process_async(0, &OrderLog::get).get();
+  proactor.stop();
+  EXPECT_THAT(log, Eq(std::vector<int>{10, 11, 1, 12, 13, 2, 14, 15}));
+}
+
+struct PreemptingTraits : DefaultProactorTraits {
+  static constexpr std::size_t kPriorityLanes = 4;
+};
+
+TEST(ProactorPriorityTest, HighestLaneRunsBetweenTasksOfABatch) {
+  Proactor<int, Identity, 1, OrderLog, PreemptingTraits> proactor(16);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+  entered.acquire();
+  // One batch, during which a critical task arrives.
+  proactor.process(0, &OrderLog::append, [&]() {
+    proactor.process(0, Priority::kCritical, &OrderLog::append, []() {}, 99);
+  }, 1);
+  for (int i = 2; i <= 4; ++i) {
+    proactor.process(0, &OrderLog::append, []() {}, i);
+  }
+  release.release();
+  const std::vector<int> log = proactor.process_async(0, &OrderLog::get).get();
+  proactor.stop();
+  EXPECT_THAT(log, Eq(std::vector<int>{1, 99, 2, 3, 4}));
+}
+
+TEST(ProactorPriorityTest, BroadcastsAndMapReducesTakeTheirLane) {
+  Proactor<int, Identity, 1, OrderLog, PriorityTraits<4, 8>> proactor(16);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+  entered.acquire();
+  proactor.process(0, &OrderLog::append, []() {}, 1);
+  proactor.broadcast(Priority::kCritical, &OrderLog::append, []() {}, []() {},
+                     99);
+  std::vector<int> reduced;
+  std::binary_semaphore done{0};
+  proactor.map_reduce(
+      Priority::kCritical, &OrderLog::get,
+      [](std::vector<int> left, std::vector<int> right) {
+        left.insert(left.end(), right.begin(), right.end());
+        return left;
+      },
+      [&](std::vector<int> log) {
+        reduced = std::move(log);
+        done.release();
+      });
+  release.release();
+  done.acquire();
+  EXPECT_THAT(reduced, Eq(std::vector<int>{99}));
+  const std::vector<int> log = proactor.process_async(0, &OrderLog::get).get();
+  proactor.stop();
+  EXPECT_THAT(log, Eq(std::vector<int>{99, 1}));
+}
+
+struct MetricsTraits : DefaultProactorTraits {
+  static constexpr bool kMetrics = true;
+};
+
+TEST(ProactorMetricsTest, SnapshotReportsDepthBlockingAndLatencies) {
+  Proactor<int, Identity, 1, OrderLog, MetricsTraits> proactor(4);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+  entered.acquire();
+  for (int i = 0; i < 4; ++i) {
+    proactor.process(0, &OrderLog::append, []() {}, i);
+  }
+  EXPECT_THAT(proactor.snapshot()[0].queue_depth, Eq(4u));
+
+  std::thread blocked([&] {
+    proactor.process(0, &OrderLog::append, []() {}, 4);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  release.release();
+  blocked.join();
+  proactor.stop();
+
+  const MetricsSnapshot metrics = proactor.snapshot()[0];
+  EXPECT_THAT(metrics.queue_depth, Eq(0u));
+  EXPECT_THAT(metrics.executed, Eq(6u));
+  EXPECT_THAT(metrics.enqueued(), Eq(6u));
+  EXPECT_THAT(metrics.blocked_writes, Eq(1u));
+  EXPECT_THAT(metrics.blocked_time, Ge(std::chrono::milliseconds(10)));
+  EXPECT_THAT(metrics.execution.count, Eq(6u));
+  EXPECT_THAT(metrics.latency.count, Eq(6u));
+  // The tasks queued behind 'hold' waited at least as long as it ran.
+  EXPECT_THAT(metrics.execution.max, Ge(20000000u));
+  EXPECT_THAT(metrics.latency.percentile(0.5), Ge(10000000u));
+  EXPECT_THAT(metrics.busy_time.count(), Eq(metrics.execution.sum));
+}
+
+struct LanesTraits : DefaultProactorTraits {
+  using QueuePolicy = SPSCLanesQueuePolicy<>;
+  static constexpr std::size_t kPriorityLanes = 2;
+};
+
+template <typename TRAITS>
+class ProactorDrainTest : public ::testing::Test {};
+
+using DrainTraits = ::testing::Types<DefaultProactorTraits, LanesTraits>;
+TYPED_TEST_SUITE(ProactorDrainTest, DrainTraits);
+
+TYPED_TEST(ProactorDrainTest, DrainWaitsForTasksEnqueuedBefore) {
+  constexpr int kProducers = 4;
+  constexpr int kMessages = 10000;
+  Proactor<int, Identity, 3, OrderLog, TypeParam> proactor(1024);
+  std::atomic<int> done{0};
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&proactor, &done, p] {
+      for (int i = 0; i < kMessages; ++i) {
+        proactor.process(i % 3, &OrderLog::append, [&done]() { ++done; }, p);
+      }
+    });
+  }
+  for (std::thread& producer : producers) {
+    producer.join();
+  }
+  proactor.drain();
+  EXPECT_THAT(done.load(), Eq(kProducers * kMessages));
+  proactor.stop();
+}
+
+TYPED_TEST(ProactorDrainTest, QuiesceWaitsForTasksEnqueuedByTasks) {
+  using DrainProactor = Proactor<int, Identity, 3, OrderLog, TypeParam>;
+  DrainProactor proactor(16);
+  std::atomic<int> done{0};
+  struct Hop {
+    DrainProactor* proactor;
+    std::atomic<int>* done;
+    int left;
+
+    void operator()() const {
+      ++*done;
+      if (left > 0) {
+        proactor->process(left, &OrderLog::append,
+                          Hop{proactor, done, left - 1}, left);
+      }
+    }
+  };
+  for (int i = 0; i < 10; ++i) {
+    proactor.process(i, &OrderLog::append, Hop{&proactor, &done, 100}, i);
+  }
+  proactor.quiesce();
+  EXPECT_THAT(done.load(), Eq(10 * 101));
+  proactor.stop();
+}
+
+TEST(ProactorStopTest, StopRunsEveryTaskEnqueuedBefore) {
+  Proactor<int, Identity, 2, OrderLog> proactor(256);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  std::atomic<int> done{0};
+  proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+  entered.acquire();
+  for (int i = 0; i < 200; ++i) {
+    proactor.process(i, &OrderLog::append, [&done]() { ++done; }, i);
+  }
+  std::thread releaser([&release] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    release.release();
+  });
+  proactor.stop();
+  releaser.join();
+  EXPECT_THAT(done.load(), Eq(200));
+}
+
+TEST(ProactorStopTest, DiscardDropsQueuedTasks) {
+  Proactor<int, Identity, 1, OrderLog> proactor(256);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  std::atomic<int> done{0};
+  proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+  entered.acquire();
+  for (int i = 0; i < 100; ++i) {
+    proactor.process(0, &OrderLog::append, [&done]() { ++done; }, i);
+  }
+  std::thread releaser([&release] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    release.release();
+  });
+  proactor.stop(DrainPolicy::kDiscard);
+  releaser.join();
+  EXPECT_THAT(done.load(), Eq(0));
+}
+
+TEST(ProactorStopTest, DiscardNeverCallsTheCallbacksOfDroppedTasks) {
+  // Which is why an AsyncResult of a dropped task never completes.
+  auto token = std::make_shared<int>(0);
+  std::atomic<int> called{0};
+  {
+    Proactor<int, Identity, 1, OrderLog> proactor(256);
+    std::binary_semaphore entered{0};
+    std::binary_semaphore release{0};
+    proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+    entered.acquire();
+    for (int i = 0; i < 10; ++i) {
+      proactor.process(0, &OrderLog::append, [token, &called]() { ++called; },
+                       i);
+    }
+    std::thread releaser([&release] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      release.release();
+    });
+    proactor.stop(DrainPolicy::kDiscard);
+    releaser.join();
+    EXPECT_THAT(token.use_count(), Eq(11));
+  }
+  EXPECT_THAT(called.load(), Eq(0));
+  EXPECT_THAT(token.use_count(), Eq(1));
+}
+
+TEST(ProactorStopTest, ConcurrentStopsAllWaitForTheThreads) {
+  Proactor<int, Identity, 1, OrderLog> proactor(16);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  std::atomic<bool> finished{false};
+  proactor.process(0, &OrderLog::hold, [&finished]() { finished = true; },
+                   &entered, &release);
+  entered.acquire();
+  std::atomic<int> early{0};
+  std::vector<std::thread> stoppers;
+  for (int i = 0; i < 3; ++i) {
+    stoppers.emplace_back([&] {
+      proactor.stop();
+      early += !finished;
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  release.release();
+  for (std::thread& stopper : stoppers) {
+    stopper.join();
+  }
+  EXPECT_THAT(early.load(), Eq(0));
+}
+
+TEST(ProactorBackpressureTest, ProcessForGivesUpOnceTheTimeoutElapses) {
+  using namespace std::chrono_literals;
+  Proactor<int, Identity, 1, OrderLog> proactor(4);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+  entered.acquire();
+  while (proactor.try_process(0, &OrderLog::append, []() {}, 0)) {
+  }
+  const auto start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(proactor.process_for(0, 20ms, &OrderLog::append, []() {}, 1));
+  EXPECT_TRUE(std::chrono::steady_clock::now() - start >= 20ms);
+  release.release();
+  EXPECT_TRUE(proactor.process_for(0, 10s, &OrderLog::append, []() {}, 2));
+  const std::vector<int> log = proactor.process_async(0, &OrderLog::get).get();
+  proactor.stop();
+  EXPECT_THAT(log.back(), Eq(2));
+}
+
+TEST(ProactorBackpressureTest, WatermarksReportHighThenLow) {
+  std::mutex mutex;
+  std::vector<bool> changes;
+  ProactorOptions options{.capacity = 16};
+  options.watermarks = {6, 1, [&](std::size_t partition, bool high) {
+                          std::lock_guard<std::mutex> lock(mutex);
+                          EXPECT_THAT(partition, Eq(0u));
+                          changes.push_back(high);
+                        }};
+  Proactor<int, Identity, 1, OrderLog> proactor(options);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+  entered.acquire();
+  for (int i = 0; i < 8; ++i) {
+    proactor.process(0, &OrderLog::append, []() {}, i);
+  }
+  {
+    // Reported by the enqueue, while the partition is still busy.
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_THAT(changes, Eq(std::vector<bool>{true}));
+  }
+  release.release();
+  proactor.drain();
+  proactor.stop();
+  EXPECT_THAT(changes, Eq(std::vector<bool>{true, false}));
+}
+
+// Busy for the given number of microseconds.
+class Spinner {
+ public:
+  void spin(int microseconds) {
+    const auto until = std::chrono::steady_clock::now() +
+                       std::chrono::microseconds(microseconds);
+    while (std::chrono::steady_clock::now() < until) {
+    }
+  }
+};
+
+struct SheddingTraits : DefaultProactorTraits {
+  static constexpr std::size_t kBatchSize = 1;
+  static constexpr bool kMetrics = true;
+  using AdmissionPolicy = SojournAdmissionPolicy<1000, 0>;
+};
+
+TEST(ProactorBackpressureTest, SojournAdmissionBoundsTheQueue) {
+  Proactor<int, Identity, 1, Spinner, SheddingTraits> proactor(4096);
+  int accepted = 0;
+  int rejected = 0;
+  std::size_t max_depth = 0;
+  // Tasks arrive several times faster than they run.
+  const auto until =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+  while (std::chrono::steady_clock::now() < until) {
+    if (proactor.try_process(0, &Spinner::spin, []() {}, 200)) {
+      ++accepted;
+    } else {
+      ++rejected;
+    }
+    max_depth = std::max(max_depth, proactor.snapshot()[0].queue_depth);
+    std::this_thread::sleep_for(std::chrono::microseconds(20));
+  }
+  proactor.drain();
+  EXPECT_THAT(rejected, ::testing::Gt(0));
+  EXPECT_THAT(max_depth, ::testing::Lt(50u));
+  EXPECT_THAT(proactor.snapshot()[0].executed,
+              Eq(static_cast<std::uint64_t>(accepted)));
+  // Once the partition caught up, tasks are admitted again.
+  EXPECT_TRUE(proactor.try_process(0, &Spinner::spin, []() {}, 1));
+  proactor.stop();
+}
+
+TEST(ProactorBackpressureTest, SheddingStartsDuringALongBatch) {
+  Proactor<int, Identity, 1, Spinner, SheddingTraits> proactor(4096);
+  // Tasks of 2ms, twice the target per queued task.
+  proactor.process(0, &Spinner::spin, []() {}, 2000);
+  proactor.drain();
+  proactor.process(0, &Spinner::spin, []() {}, 100000);
+  int rejected = 0;
+  for (int i = 0; i < 64; ++i) {
+    if (!proactor.try_process(0, &Spinner::spin, []() {}, 1)) {
+      ++rejected;
+    }
+  }
+  std::vector<std::tuple<int, int>> items(8, {0, 1});
+  const auto accepted =
+      proactor.try_process_batch(items, &Spinner::spin, []() {});
+  proactor.stop();
+  EXPECT_THAT(rejected, ::testing::Gt(0));
+  EXPECT_THAT(accepted[0], Eq(0u));
+}
+
+struct ConflationTraits : DefaultProactorTraits {
+  static constexpr bool kConflation = true;
+};
+
+TEST(ProactorConflationTest, OnlyTheLatestPendingUpdateRuns) {
+  // Far fewer slots than updates: each key takes at most one.
+  Proactor<int, Identity, 1, OrderLog, ConflationTraits> proactor(4);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  std::atomic<int> done{0};
+  proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+  entered.acquire();
+  for (int i = 0; i < 100; ++i) {
+    proactor.process_latest(1, &OrderLog::append, [&done]() { ++done; }, i);
+    proactor.process_latest(2, &OrderLog::append, [&done]() { ++done; },
+                            1000 + i);
+  }
+  release.release();
+  EXPECT_THAT(proactor.process_async(0, &OrderLog::get).get(),
+              Eq(std::vector<int>{99, 1099}));
+  EXPECT_THAT(done.load(), Eq(2));
+  // Once run, the next update of a key is queued again.
+  proactor.process_latest(1, &OrderLog::append, []() {}, 5);
+  EXPECT_THAT(proactor.process_async(0, &OrderLog::get).get().back(), Eq(5));
+  proactor.stop();
+}
+
+TEST(ProactorConflationTest, CombineMergesIntoThePendingUpdate) {
+  Proactor<int, Identity, 1, OrderLog, ConflationTraits> proactor(4);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+  entered.acquire();
+  for (int i = 1; i <= 10; ++i) {
+    proactor.process_latest(
+        0, [](int& pending, int update) { pending += update; },
+        &OrderLog::append, []() {}, i);
+  }
+  release.release();
+  EXPECT_THAT(proactor.process_async(0, &OrderLog::get).get(),
+              Eq(std::vector<int>{55}));
+  proactor.stop();
+}
+
+TEST(ProactorConflationTest, CombineTakesUpdatesAsRvalues) {
+  Proactor<int, Identity, 1, OrderLog, ConflationTraits> proactor(4);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+  entered.acquire();
+  for (int i = 1; i <= 3; ++i) {
+    const int update = i * 10;
+    proactor.process_latest(
+        0, [](int& pending, int&& update) { pending = pending + update; },
+        &OrderLog::append, []() {}, update);
+  }
+  release.release();
+  EXPECT_THAT(proactor.process_async(0, &OrderLog::get).get(),
+              Eq(std::vector<int>{60}));
+  proactor.stop();
+}
+
+template <SelfDispatch DISPATCH>
+struct SelfDispatchTraits : DefaultProactorTraits {
+  static constexpr SelfDispatch kSelfDispatch = DISPATCH;
+};
+
+TEST(ProactorSelfDispatchTest, LocalTasksNeverBlockOnTheOwnQueue) {
+  // With SelfDispatch::kQueue, the fifth re-entrant 'process()' would block
+  // forever on the partition's own full queue.
+  Proactor<int, Identity, 1, OrderLog, SelfDispatchTraits<SelfDispatch::kLocal>>
+      proactor(4);
+  proactor.process(0, &OrderLog::append, [&]() {
+    for (int i = 1; i <= 10; ++i) {
+      proactor.process(0, &OrderLog::append, []() {}, i);
+    }
+  }, 0);
+  proactor.quiesce();
+  EXPECT_THAT(proactor.process_async(0, &OrderLog::get).get(),
+              Eq(std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10}));
+  proactor.stop();
+}
+
+struct LocalSingleBatchTraits : SelfDispatchTraits<SelfDispatch::kLocal> {
+  static constexpr std::size_t kBatchSize = 1;
+};
+
+TEST(ProactorSelfDispatchTest, LocalTasksAppendedByLocalTasksWaitATurn) {
+  Proactor<int, Identity, 1, OrderLog, LocalSingleBatchTraits> proactor(4);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+  entered.acquire();
+  // Each step appends the next one locally, which must not keep the
+  // partition from reading its queue.
+  int step = 0;
+  std::function<void()> chain = [&]() {
+    if (++step <= 3) {
+      proactor.process(0, &OrderLog::append, [&chain]() { chain(); }, step);
+    }
+  };
+  proactor.process(0, &OrderLog::append, [&chain]() { chain(); }, 0);
+  proactor.process(0, &OrderLog::append, []() {}, -1);
+  release.release();
+  proactor.quiesce();
+  EXPECT_THAT(proactor.process_async(0, &OrderLog::get).get(),
+              Eq(std::vector<int>{0, 1, -1, 2, 3}));
+  proactor.stop();
+}
+
+struct LocalConflationTraits : SelfDispatchTraits<SelfDispatch::kLocal> {
+  static constexpr bool kConflation = true;
+};
+
+TEST(ProactorSelfDispatchTest, LatestUpdatesNeverBlockOnTheOwnQueue) {
+  Proactor<int, Identity, 1, OrderLog, LocalConflationTraits> proactor(4);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  proactor.process(0, &OrderLog::hold, [&]() {
+    proactor.process_latest(0, nullptr, &OrderLog::append, []() {}, 0);
+  }, &entered, &release);
+  entered.acquire();
+  for (int i = 1; i <= 4; ++i) {
+    proactor.process(0, &OrderLog::append, []() {}, i);
+  }
+  release.release();
+  proactor.quiesce();
+  EXPECT_THAT(proactor.process_async(0, &OrderLog::get).get(),
+              Eq(std::vector<int>{0, 1, 2, 3, 4}));
+  proactor.stop();
+}
+
+TEST(ProactorSelfDispatchTest, InlineTasksRunBeforeProcessReturns) {
+  Proactor<int, Identity, 2, OrderLog,
+           SelfDispatchTraits<SelfDispatch::kInline>>
+      proactor(4);
+  std::vector<int> seen;
+  std::binary_semaphore done{0};
+  proactor.process(0, &OrderLog::append, [&]() {
+    proactor.process(0, &OrderLog::append, []() {}, 1);
+    proactor.process(0, &OrderLog::get, [&](std::vector<int> log) {
+      seen = std::move(log);
+    });
+    done.release();
+  }, 0);
+  done.acquire();
+  EXPECT_THAT(seen, Eq(std::vector<int>{0, 1}));
+  proactor.stop();
+}
+
+struct TracingTraits : DefaultProactorTraits {
+  static constexpr bool kTracing = true;
+};
+
+TEST(ProactorTracingTest, FlowFollowsAMessageAcrossProactors) {
+  using TracedProactor = Proactor<int, Identity, 1, OrderLog, TracingTraits>;
+  TracedProactor first(16);
+  TracedProactor second(16);
+  clearTrace();
+  std::binary_semaphore done{0};
+  first.process(0, &OrderLog::append, [&]() {
+    second.process(0, &OrderLog::append, [&]() { done.release(); }, 2);
+  }, 1);
+  done.acquire();
+  first.stop();
+  second.stop();
+
+  const std::vector<TraceRecord> records = collectTrace();
+  ASSERT_THAT(records.size(), Eq(12u));
+  ASSERT_THAT(records[0].type, Eq(TraceEventType::kEnqueue));
+  std::unordered_map<std::uint32_t, std::vector<TraceEventType>> threads;
+  for (const TraceRecord& record : records) {
+    EXPECT_THAT(record.flow, Eq(records[0].flow));
+    threads[record.thread].push_back(record.type);
+  }
+  using enum TraceEventType;
+  ASSERT_THAT(threads.size(), Eq(3u));
+  EXPECT_THAT(threads[records[0].thread], Eq(std::vector{kEnqueue}));
+  EXPECT_THAT(threads[records[1].thread],
+              Eq(std::vector{kDequeue, kExecuteBegin, kExecuteEnd,
+                             kCallbackBegin, kEnqueue, kCallbackEnd}));
+  EXPECT_THAT(threads[records.back().thread],
+              Eq(std::vector{kDequeue, kExecuteBegin, kExecuteEnd,
+                             kCallbackBegin, kCallbackEnd}));
+
+  std::ostringstream trace;
+  writeChromeTrace(trace);
+  EXPECT_THAT(trace.str(), HasSubstr("\"traceEvents\""));
+  EXPECT_THAT(trace.str(), HasSubstr("\"name\":\"partition 0\""));
+  EXPECT_THAT(trace.str(), HasSubstr("\"ph\":\"f\""));
+}
+
+struct TimerTraits : DefaultProactorTraits {
+  static constexpr bool kTimers = true;
+};
+
+TEST(ProactorTimerTest, ProcessAfterFiresOnceTheDelayElapsed) {
+  using namespace std::chrono_literals;
+  Proactor<int, Identity, 2, Gate, TimerTraits> proactor(16);
+  std::binary_semaphore fired{0};
+  const auto start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point end;
+  proactor.process_after(1, 20ms, &Gate::add, [&]() {
+    end = std::chrono::steady_clock::now();
+    fired.release();
+  }, 5);
+  fired.acquire();
+  EXPECT_TRUE(end - start >= 20ms);
+  EXPECT_THAT(proactor.process_async(1, &Gate::get).get(), Eq(5));
+  proactor.stop();
+}
+
+TEST(ProactorTimerTest, ProcessEveryRepeatsUntilCancelled) {
+  using namespace std::chrono_literals;
+  Proactor<int, Identity, 2, Gate, TimerTraits> proactor(16);
+  std::atomic<int> runs{0};
+  std::counting_semaphore<1000> ran{0};
+  const TimerHandle handle =
+      proactor.process_every(0, 2ms, &Gate::add, [&]() {
+        runs.fetch_add(1);
+        ran.release();
+      }, 1);
+  for (int i = 0; i < 3; ++i) {
+    ran.acquire();
+  }
+  EXPECT_TRUE(proactor.cancel_timer(handle));
+  EXPECT_FALSE(proactor.cancel_timer(handle));
+  // No run starts once cancel_timer() returned.
+  const int sum = proactor.process_async(0, &Gate::get).get();
+  std::this_thread::sleep_for(20ms);
+  EXPECT_THAT(proactor.process_async(0, &Gate::get).get(), Eq(sum));
+  EXPECT_THAT(runs.load(), Eq(sum));
+  proactor.stop();
+}
+
+TEST(ProactorTimerTest, CancelledTimersFreeTheirSlots) {
+  using namespace std::chrono_literals;
+  Proactor<int, Identity, 1, Gate, TimerTraits> proactor(16);
+  // Far more timers than a partition holds at once.
+  for (std::size_t i = 0; i < 4 * TimerTraits::kTimerCapacity; ++i) {
+    const TimerHandle handle =
+        proactor.process_after(0, 1h, &Gate::add, []() {}, 1);
+    EXPECT_TRUE(proactor.cancel_timer(handle));
+  }
+  EXPECT_THAT(proactor.process_async(0, &Gate::get).get(), Eq(0));
+  proactor.stop();
+}
+
+struct FewTimersTraits : TimerTraits {
+  static constexpr std::size_t kTimerCapacity = 4;
+};
+
+TEST(ProactorTimerTest, ArmingFromTheOwnPartitionNeverWaitsForASlot) {
+  using namespace std::chrono_literals;
+  Proactor<int, Identity, 1, Gate, FewTimersTraits> proactor(16);
+  std::vector<TimerHandle> handles;
+  bool rearmed = false;
+  std::binary_semaphore done{0};
+  auto arm = [&]() {
+    for (std::size_t i = 0; i <= FewTimersTraits::kTimerCapacity; ++i) {
+      handles.push_back(proactor.process_after(0, 1h, &Gate::add, []() {}, 1));
+    }
+    // Cancelled slots are reclaimed right away.
+    proactor.cancel_timer(handles[0]);
+    rearmed = proactor.process_after(0, 1h, &Gate::add, []() {}, 1).valid();
+    done.release();
+  };
+  proactor.process(0, &Gate::add, [&arm]() { arm(); }, 0);
+  done.acquire();
+  ASSERT_THAT(handles.size(), Eq(FewTimersTraits::kTimerCapacity + 1));
+  for (std::size_t i = 0; i < FewTimersTraits::kTimerCapacity; ++i) {
+    EXPECT_TRUE(handles[i].valid());
+  }
+  EXPECT_FALSE(handles.back().valid());
+  EXPECT_FALSE(proactor.cancel_timer(handles.back()));
+  EXPECT_TRUE(rearmed);
+  proactor.stop();
+}
+
+struct StealingTraits : DefaultProactorTraits {
+  static constexpr bool kWorkStealing = true;
+};
+
+TEST(ProactorStealTest, SubmitRunsEveryJobAndCallback) {
+  constexpr int kJobs = 10000;
+  Proactor<int, Identity, 4, KeyedLog, StealingTraits> proactor(256);
+  std::atomic<int> sum{0};
+  std::counting_semaphore<kJobs> done{0};
+  for (int i = 0; i < kJobs; ++i) {
+    proactor.submit([i]() { return i; },
+                    [&](int value) {
+                      sum.fetch_add(value, std::memory_order_relaxed);
+                      done.release();
+                    });
+  }
+  for (int i = 0; i < kJobs; ++i) {
+    done.acquire();
+  }
+  EXPECT_THAT(sum.load(), Eq(kJobs * (kJobs - 1) / 2));
+  proactor.stop();
+}
+
+// Runs arbitrary code on a partition.
+struct Runner {
+  void run(const std::function<void()>* code) { (*code)(); }
+};
+
+TEST(ProactorStealTest, IdlePartitionsStealJobsOfABusyOne) {
+  constexpr int kJobs = 64;
+  Proactor<int, Identity, 4, Runner, StealingTraits> proactor(256);
+  std::counting_semaphore<kJobs> done{0};
+  std::mutex mutex;
+  std::vector<std::thread::id> runners;
+  std::thread::id busy;
+  // A task on partition 0 spawns jobs onto its own deque, then stays busy
+  // until they all ran, which only other partitions can do.
+  const std::function<void()> spawn = [&]() {
+    busy = std::this_thread::get_id();
+    for (int i = 0; i < kJobs; ++i) {
+      proactor.submit(
+          [&]() {
+            std::lock_guard lock(mutex);
+            runners.push_back(std::this_thread::get_id());
+          },
+          [&]() { done.release(); });
+    }
+    for (int i = 0; i < kJobs; ++i) {
+      done.acquire();
+    }
+  };
+  proactor.process_async(0, &Runner::run, &spawn).get();
+  proactor.stop();
+  ASSERT_THAT(runners.size(), Eq(static_cast<std::size_t>(kJobs)));
+  for (const std::thread::id& runner : runners) {
+    EXPECT_THAT(runner == busy, Eq(false));
+  }
+}
+
+struct DetachedCoroutine {
+  struct promise_type {
+    DetachedCoroutine get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+TEST(ProactorPriorityTest, AsyncResultTakesItsLane) {
+  Proactor<int, Identity, 1, OrderLog, PriorityTraits<4, 8>> proactor(16);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  proactor.process(0, &OrderLog::hold, []() {}, &entered, &release);
+  entered.acquire();
+  proactor.process(0, &OrderLog::append, []() {}, 1);
+  std::vector<int> seen{0};
+  std::binary_semaphore done{0};
+  auto coroutine = [&]() -> DetachedCoroutine {
+    seen = co_await proactor.process_async(0, Priority::kCritical,
+                                           &OrderLog::get);
+    done.release();
+  };
+  // Enqueued before 'coroutine()' returns.
+  coroutine();
+  release.release();
+  done.acquire();
+  proactor.stop();
+  EXPECT_THAT(seen, Eq(std::vector<int>{}));
+}
+
+// Collects coroutines to be resumed by the thread calling 'run()'.
+class PollingExecutor {
+ public:
+  void operator()(std::coroutine_handle<> handle) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    handles_.push_back(handle);
+  }
+
+  bool runOne() {
+    std::coroutine_handle<> handle;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (handles_.empty()) {
+        return false;
+      }
+      handle = handles_.front();
+      handles_.erase(handles_.begin());
+    }
+    handle.resume();
+    return true;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::coroutine_handle<>> handles_;
+};
+
+TEST_F(ProactorTest, AsyncGet) {
+  proactor.process_async(0, &Accumulator::add, 5u).get();
+  EXPECT_THAT(proactor.process_async(0, &Accumulator::get).get(), Eq(115u));
+}
+
+TEST_F(ProactorTest, AsyncCoroutineChainsStages) {
+  std::binary_semaphore done{0};
+  uint32_t total = 0;
+  auto chain = [&]() -> DetachedCoroutine {
+    co_await proactor.process_async(0, &Accumulator::add, 5u);
+    const uint32_t first = co_await proactor.process_async(0, &Accumulator::get);
+    const uint32_t second =
+        co_await proactor.process_async(1, &Accumulator::get);
+    total = first + second;
+    done.release();
+  };
+  chain();
+  done.acquire();
+  EXPECT_THAT(total, Eq(225u));
+}
+
+TEST_F(ProactorTest, AsyncCoroutineResumesOnExecutor) {
+  PollingExecutor executor;
+  std::atomic<bool> finished{false};
+  std::thread::id resumed_on;
+  auto coroutine = [&]() -> DetachedCoroutine {
+    const uint32_t sum =
+        co_await proactor.process_async(2, &Accumulator::get).via(
+            std::ref(executor));
+    EXPECT_THAT(sum, Eq(110u));
+    resumed_on = std::this_thread::get_id();
+    finished = true;
+  };
+  coroutine();
+  while (!finished) {
+    executor.runOne();
+  }
+  EXPECT_THAT(resumed_on, Eq(std::this_thread::get_id()));
+}
+
+struct DeferredTraits : DefaultProactorTraits {
+  static constexpr CompletionMode kCompletionMode = CompletionMode::kDeferred;
+};
+
+TEST(ProactorCompletionTest, CallbacksRunOnPollingThread) {
+  Proactor<int, Hash, 4, Accumulator, DeferredTraits> proactor(
+      16, std::make_unique<uint32_t>(0u), 0);
+  std::atomic<int> callbacks{0};
+  std::thread::id callback_thread;
+  for (int key = 0; key < 4; ++key) {
+    proactor.process(key, &Accumulator::get, [&](uint32_t) {
+      callback_thread = std::this_thread::get_id();
+      ++callbacks;
+    });
+  }
+  while (callbacks < 4) {
+    proactor.poll_completions();
+  }
+  proactor.stop();
+  EXPECT_THAT(callback_thread, Eq(std::this_thread::get_id()));
+  EXPECT_THAT(proactor.poll_completions(), Eq(0u));
+}
+
+struct ParkingDeferredTraits : DeferredTraits {
+  using WaitPolicy = FutexWaitPolicy<>;
+};
+
+TEST(ProactorCompletionTest, PollingWakesPartitionParkedOnFullRing) {
+  constexpr int kMessages = 64;
+  Proactor<int, Hash, 1, Accumulator, ParkingDeferredTraits> proactor(
+      4, std::make_unique<uint32_t>(0u), 0);
+  std::atomic<int> callbacks{0};
+  for (int i = 0; i < kMessages; ++i) {
+    proactor.process(0, &Accumulator::get, [&](uint32_t) { ++callbacks; });
+  }
+  // The partition parks with most completions still overflowing.
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  const auto until =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (callbacks < kMessages && std::chrono::steady_clock::now() < until) {
+    proactor.poll_completions();
+  }
+  EXPECT_THAT(callbacks.load(), Eq(kMessages));
+  proactor.stop();
+}
+
+TEST(ProactorCompletionTest, ParkedPoolThreadsWakeUpForCompletions) {
+  Proactor<int, Hash, 4, Accumulator, DeferredTraits> proactor(
+      16, std::make_unique<uint32_t>(0u), 0);
+  CompletionThreadPool pool(proactor, 2);
+  for (int round = 0; round < 3; ++round) {
+    // Long enough for the pool threads to back off and park.
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    std::binary_semaphore done{0};
+    proactor.process(round, &Accumulator::get,
+                     [&done](uint32_t) { done.release(); });
+    EXPECT_TRUE(done.try_acquire_for(std::chrono::seconds(5)));
+  }
+  proactor.stop();
+  // Stopping wakes up the parked threads.
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  pool.stop();
+}
+
+TEST(ProactorCompletionTest, BlockedCallbackDoesNotStallPartition) {
+  constexpr int kMessages = 20;
+  Proactor<int, Hash, 1, Gate, DeferredTraits> startLayer(64);
+  Proactor<int, Hash, 1, Gate> midLayer(4);
+  std::binary_semaphore entered{0};
+  std::binary_semaphore release{0};
+  midLayer.process(0, &Gate::hold, []() {}, &entered, &release);
+  entered.acquire();
+
+  CompletionThreadPool pool(startLayer, 1);
+  for (int i = 0; i < kMessages; ++i) {
+    // Once midLayer is full, these callbacks block the completion thread.
+    startLayer.process(
+        0, &Gate::add,
+        [&midLayer]() { midLayer.process(0, &Gate::add, []() {}, 1); }, 1);
+  }
+  int sum = 0;
+  std::binary_semaphore done{0};
+  startLayer.process(0, &Gate::report, []() {}, &sum, &done);
+  done.acquire();
+  EXPECT_THAT(sum, Eq(kMessages));
+
+  release.release();
+  startLayer.stop();
+  pool.stop();
+  midLayer.process(0, &Gate::report, []() {}, &sum, &done);
+  done.acquire();
+  midLayer.stop();
+  EXPECT_THAT(sum, Eq(kMessages));
+}
@@ -1,6 +1,8 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <memory>
 #include <thread>
 #include <vector>
 
@@ -62,3 +64,128 @@ TEST(LockFreeQueueTest, PushPopAndEmptyCheck) {
   int value;
   EXPECT_FALSE(queue.try_deque(value));
 }
+
+TEST(LockFreeQueueTest, CapacityIsRoundedUpToAPowerOfTwo) {
+  Queue<int> queue(3);
+  EXPECT_THAT(queue.capacity(), Eq(4u));
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(queue.writeIfNotFull(i));
+  }
+  EXPECT_FALSE(queue.writeIfNotFull(4));
+  int value = -1;
+  EXPECT_TRUE(queue.read(value));
+  EXPECT_THAT(value, Eq(0));
+  EXPECT_TRUE(queue.writeIfNotFull(4));
+}
+
+TEST(LockFreeQueueTest, ConstructsAndDestroysElementsInPlace) {
+  auto element = std::make_shared<int>(1);
+  {
+    Queue<std::shared_ptr<int>> queue(4);
+    EXPECT_THAT(element.use_count(), Eq(1));
+    queue.blockingWrite(element);
+    queue.blockingWrite(element);
+    EXPECT_THAT(element.use_count(), Eq(3));
+    std::shared_ptr<int> value;
+    EXPECT_TRUE(queue.read(value));
+    value.reset();
+    EXPECT_THAT(element.use_count(), Eq(2));
+  }
+  EXPECT_THAT(element.use_count(), Eq(1));
+}
+
+TEST(LockFreeQueueTest, EveryElementIsReadExactlyOnce) {
+  constexpr int kProducers = 4;
+  constexpr int kConsumers = 2;
+  constexpr int kItems = 100000;
+  Queue<int> queue(64);
+  std::vector<std::atomic<int>> seen(kProducers * kItems);
+  std::atomic<int> remaining(kProducers * kItems);
+  std::vector<std::thread> threads;
+  for (int p = 0; p < kProducers; ++p) {
+    threads.emplace_back([&queue, p]() {
+      for (int i = 0; i < kItems; ++i) {
+        queue.blockingWrite(p * kItems + i);
+      }
+    });
+  }
+  for (int c = 0; c < kConsumers; ++c) {
+    threads.emplace_back([&]() {
+      int value;
+      while (remaining.load() > 0) {
+        if (queue.read(value)) {
+          seen[value].fetch_add(1);
+          remaining.fetch_sub(1);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& count : seen) {
+    ASSERT_THAT(count.load(), Eq(1));
+  }
+}
+
+TEST(LockFreeQueueTest, BatchesArePartialWhenFull) {
+  Queue<int> queue(4);
+  EXPECT_TRUE(queue.write(-1));
+  EXPECT_THAT(queue.writeBatch(5, [](std::size_t i) { return int(i); }),
+              Eq(3u));
+  EXPECT_THAT(queue.writeBatch(1, [](std::size_t) { return 9; }), Eq(0u));
+  int value;
+  for (const int expected : {-1, 0, 1, 2}) {
+    ASSERT_TRUE(queue.read(value));
+    EXPECT_THAT(value, Eq(expected));
+  }
+  EXPECT_FALSE(queue.read(value));
+  // Wraps around.
+  EXPECT_THAT(queue.writeBatch(4, [](std::size_t i) { return int(i); }),
+              Eq(4u));
+  EXPECT_THAT(queue.sizeGuess(), Eq(4u));
+}
+
+TEST(LockFreeQueueTest, BatchesKeepTheOrderOfEachProducer) {
+  constexpr int kProducers = 4;
+  constexpr int kBatches = 10000;
+  constexpr int kBatchSize = 8;
+  Queue<int> queue(64);
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&queue, p]() {
+      for (int b = 0; b < kBatches; ++b) {
+        const int first = (p * kBatches + b) * kBatchSize;
+        std::size_t written = 0;
+        while (written < kBatchSize) {
+          written += queue.writeBatch(kBatchSize - written,
+                                      [&](std::size_t i) {
+                                        return first + int(written + i);
+                                      });
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  // Each producer's values arrive in order.
+  std::vector<int> next(kProducers);
+  for (int p = 0; p < kProducers; ++p) {
+    next[p] = p * kBatches * kBatchSize;
+  }
+  int value;
+  for (int read = 0; read < kProducers * kBatches * kBatchSize;) {
+    if (queue.read(value)) {
+      const int producer = value / (kBatches * kBatchSize);
+      ASSERT_THAT(value, Eq(next[producer]));
+      ++next[producer];
+      ++read;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  for (auto& thread : producers) {
+    thread.join();
+  }
+}
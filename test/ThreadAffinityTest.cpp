@@ -0,0 +1,96 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+#include "ThreadAffinity.h"
+
+using ::testing::ElementsAre;
+using ::testing::Eq;
+using namespace mbucko;
+
+namespace {
+
+// Two packages, each a NUMA node of two cores with two SMT threads. Like
+// Linux, CPUs 0-3 are the first threads of the cores and 4-7 their siblings.
+CpuInfo twoSocketCpu(int id) {
+  const int package = (id % 4) / 2;
+  return {.id = id, .core = id % 2, .package = package, .node = package};
+}
+
+CpuTopology twoSocketTopology() {
+  CpuTopology topology;
+  for (int id = 0; id < 8; ++id) {
+    topology.cpus.push_back(twoSocketCpu(id));
+  }
+  return topology;
+}
+
+}  // namespace
+
+TEST(ThreadAffinityTest, ReadsTopologyOfAllowedCpusFromSysfs) {
+  namespace fs = std::filesystem;
+  // A directory of its own, so that concurrent runs do not collide.
+  std::string pattern =
+      (fs::temp_directory_path() / "proactor_sysfs_XXXXXX").string();
+  ASSERT_THAT(mkdtemp(pattern.data()), ::testing::NotNull());
+  const fs::path root = pattern;
+  for (int id = 0; id < 8; ++id) {
+    const CpuInfo cpu = twoSocketCpu(id);
+    const fs::path dir = root / ("cpu" + std::to_string(id));
+    fs::create_directories(dir / "topology");
+    fs::create_directories(dir / ("node" + std::to_string(cpu.node)));
+    std::ofstream(dir / "topology" / "core_id") << cpu.core << "\n";
+    std::ofstream(dir / "topology" / "physical_package_id") << cpu.package;
+  }
+
+  // CPU 3 is isolated.
+  const CpuTopology topology =
+      readTopology(root.string(), {7, 0, 1, 2, 4, 5, 6});
+  fs::remove_all(root);
+
+  ASSERT_THAT(topology.cpus.size(), Eq(7u));
+  EXPECT_THAT(topology.nodes(), Eq(2u));
+  for (const CpuInfo& cpu : topology.cpus) {
+    const CpuInfo expected = twoSocketCpu(cpu.id);
+    EXPECT_THAT(cpu.core, Eq(expected.core));
+    EXPECT_THAT(cpu.package, Eq(expected.package));
+    EXPECT_THAT(cpu.node, Eq(expected.node));
+  }
+  EXPECT_THAT(topology.cpus.front().id, Eq(0));
+  EXPECT_THAT(topology.cpus.back().id, Eq(7));
+}
+
+TEST(ThreadAffinityTest, PlacementPolicies) {
+  const CpuTopology topology = twoSocketTopology();
+
+  // Every physical core before any SMT sibling, then wrapping around.
+  EXPECT_THAT(placeThreads(topology, {}, 10),
+              ElementsAre(0, 1, 2, 3, 4, 5, 6, 7, 0, 1));
+
+  // Alternating between the nodes.
+  EXPECT_THAT(placeThreads(topology, {PlacementPolicy::kSpreadNodes}, 8),
+              ElementsAre(0, 2, 1, 3, 4, 6, 5, 7));
+
+  EXPECT_THAT(
+      placeThreads(topology, {PlacementPolicy::kExplicit, {5, 3}}, 3),
+      ElementsAre(5, 3, 5));
+  EXPECT_THAT(placeThreads(topology, {PlacementPolicy::kUnpinned}, 2),
+              ElementsAre(-1, -1));
+}
+
+TEST(ThreadAffinityTest, RunOnCpuRunsOnAnotherThreadAndRethrows) {
+  const std::thread::id caller = std::this_thread::get_id();
+  std::thread::id runner;
+  runOnCpu(0, [&] { runner = std::this_thread::get_id(); });
+  EXPECT_FALSE(runner == caller);
+
+  EXPECT_THROW(runOnCpu(0, [] { throw std::runtime_error("failed"); }),
+               std::runtime_error);
+}
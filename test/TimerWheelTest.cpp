@@ -0,0 +1,69 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "TimerWheel.h"
+
+using ::testing::Eq;
+using namespace mbucko;
+
+TEST(TimerWheelTest, ExpiresExactlyAtDeadlinesAcrossLevels) {
+  const std::vector<std::uint64_t> deadlines = {
+      5, 63, 64, 70, 4100, 300000, (std::uint64_t{1} << 24) + 5};
+  std::vector<TimerNode> nodes(deadlines.size());
+  TimerWheel wheel(1);
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    wheel.schedule(&nodes[i], deadlines[i]);
+  }
+  std::vector<std::uint64_t> expired;
+  wheel.advance(std::uint64_t{1} << 25, [&](TimerNode* node) {
+    EXPECT_THAT(wheel.now(), Eq(node->deadline));
+    EXPECT_FALSE(node->scheduled());
+    expired.push_back(node->deadline);
+  });
+  EXPECT_THAT(expired, Eq(deadlines));
+  EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheelTest, CancelledTimersNeverExpire) {
+  TimerNode early;
+  TimerNode late;
+  TimerWheel wheel;
+  wheel.schedule(&early, 10);
+  wheel.schedule(&late, 200);
+  EXPECT_THAT(wheel.nextTick(), Eq(10u));
+  wheel.cancel(&early);
+  EXPECT_THAT(wheel.size(), Eq(1u));
+  int expired = 0;
+  wheel.advance(199, [&](TimerNode*) { ++expired; });
+  EXPECT_THAT(expired, Eq(0));
+  EXPECT_THAT(wheel.nextTick(), Eq(200u));
+  wheel.advance(200, [&](TimerNode* node) {
+    EXPECT_THAT(node, Eq(&late));
+    ++expired;
+  });
+  EXPECT_THAT(expired, Eq(1));
+}
+
+TEST(TimerWheelTest, RandomDeadlinesExpireOnTime) {
+  std::mt19937_64 random(42);
+  std::vector<TimerNode> nodes(10000);
+  TimerWheel wheel;
+  for (TimerNode& node : nodes) {
+    wheel.schedule(&node, 1 + random() % 1000000);
+  }
+  std::size_t expired = 0;
+  while (!wheel.empty()) {
+    // Never advance past the next tick by more than a few hundred ticks,
+    // like a partition thread would.
+    const std::uint64_t tick = wheel.now() + 1 + random() % 500;
+    wheel.advance(tick, [&](TimerNode* node) {
+      ASSERT_THAT(wheel.now(), Eq(node->deadline));
+      ++expired;
+    });
+  }
+  EXPECT_THAT(expired, Eq(nodes.size()));
+}
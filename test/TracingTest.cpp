@@ -0,0 +1,59 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Tracing.h"
+
+using ::testing::Eq;
+using namespace mbucko;
+
+TEST(TraceRingTest, KeepsTheLastCapacityEvents) {
+  auto ring = std::make_unique<TraceRing>(7);
+  const std::uint64_t total = TraceRing::kCapacity + 10;
+  for (std::uint64_t i = 0; i < total; ++i) {
+    ring->record(TraceEventType::kExecuteBegin, i, 3, i);
+  }
+  std::vector<TraceRecord> records;
+  ring->collect(records);
+  ASSERT_THAT(records.size(), Eq(TraceRing::kCapacity));
+  EXPECT_THAT(records.front().time, Eq(std::chrono::nanoseconds(10)));
+  EXPECT_THAT(records.front().flow, Eq(10u));
+  EXPECT_THAT(records.back().flow, Eq(total - 1));
+  EXPECT_THAT(records.back().partition, Eq(3u));
+  EXPECT_THAT(records.back().thread, Eq(7u));
+  EXPECT_THAT(records.back().type, Eq(TraceEventType::kExecuteBegin));
+}
+
+TEST(TraceRingTest, ClearSkipsTheEventsRecordedSoFar) {
+  auto ring = std::make_unique<TraceRing>(0);
+  ring->record(TraceEventType::kEnqueue, 1, 0, 100);
+  ring->clear();
+  ring->record(TraceEventType::kDequeue, 2, 0, 200);
+  std::vector<TraceRecord> records;
+  ring->collect(records);
+  ASSERT_THAT(records.size(), Eq(1u));
+  EXPECT_THAT(records[0].type, Eq(TraceEventType::kDequeue));
+  EXPECT_THAT(ring->newFlow(), ::testing::Ne(ring->newFlow()));
+}
+
+TEST(TraceRingTest, ExitedThreadsHandTheirRingOver) {
+  std::uint32_t first = 0;
+  std::thread([&first]() {
+    traceEvent(TraceEventType::kEnqueue, 1, 0);
+    first = traceRing().id();
+  }).join();
+  std::uint32_t second = 0;
+  std::vector<TraceRecord> records;
+  std::thread([&]() {
+    second = traceRing().id();
+    traceRing().collect(records);
+  }).join();
+  EXPECT_THAT(second, Eq(first));
+  // The events of the exited thread are discarded on reuse.
+  EXPECT_TRUE(records.empty());
+}